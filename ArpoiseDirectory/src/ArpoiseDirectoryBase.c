@@ -1,1334 +1,5356 @@
-/*
-ArpoiseDirectoryBase.c - base for ARpoise Directory front end service.
-
-Copyright (C) 2018 , Tamiko Thiel and Peter Graf - All Rights Reserved
-
-ARpoise - Augmented Reality Point Of Interest Service
-
-This file is part of ARpoise.
-
-	ARpoise is free software: you can redistribute it and/or modify
-	it under the terms of the GNU General Public License as published by
-	the Free Software Foundation, either version 3 of the License, or
-	(at your option) any later version.
-
-	ARpoise is distributed in the hope that it will be useful,
-	but WITHOUT ANY WARRANTY; without even the implied warranty of
-	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
-	GNU General Public License for more details.
-
-	You should have received a copy of the GNU General Public License
-	along with ARpoise.  If not, see <https://www.gnu.org/licenses/>.
-
-For more information on
-
-Tamiko Thiel, see www.TamikoThiel.com/
-Peter Graf, see www.mission-base.com/peter/
-ARpoise, see www.ARpoise.com/
-
-$Log: ArpoiseDirectoryBase.c,v $
-Revision 1.16  2026/04/25 20:29:19  peter
-Updates after using Claude
-
-Revision 1.15  2023/08/28 20:30:43  peter
-Added handling of old asset bundles on arpoise.com
-
-Revision 1.14  2022/03/07 19:47:35  peter
-Improved handling of areas
-
-Revision 1.13  2022/03/05 19:48:15  peter
-Added handling of bundle position
-
-*/
-
-/*
-* Make sure "strings <exe> | grep Id | sort -u" shows the source file versions
-*/
-char* ArpoiseDirectoryBase_c_id = "$Id: ArpoiseDirectoryBase.c,v 1.16 2026/04/25 20:29:19 peter Exp $";
-
-#include <stdio.h>
-#include <memory.h>
-
-#ifndef __APPLE__
-#include <malloc.h>
-#endif
-
-#include <assert.h>
-#include <stdlib.h>
-
-#ifdef _WIN32
-
-#include <winsock2.h>
-#include <direct.h>
-#include <windows.h> 
-#include <process.h>
-
-#define socket_close closesocket
-
-#else
-
-#include <sys/socket.h>
-#include <sys/time.h>
-#include <unistd.h>
-#include <netdb.h>
-#include <netinet/in.h>
-#include <dirent.h>
-#include <sys/types.h>
-#include <sys/stat.h>
-
-#define socket_close close
-
-#ifndef h_addr
-#define h_addr h_addr_list[0] /* for backward compatibility */
-#endif
-
-#endif
-
-#include "pblCgi.h"
-
-char* ArvosApplicationName = "Arvos";
-char* ArpoiseApplicationName = "Arpoise";
-char* OperatingSystemAndroid = "Android";
-char* OperatingSystemiOS = "iOS";
-
-/*
- * Receive some bytes from a socket
- */
-static int receiveBytesFromTcp(int socket, char* buffer, int bufferSize, struct timeval* timeout)
-{
-	char* tag = "receiveBytesFromTcp";
-	int    rc = 0;
-	int    socketError = 0;
-	unsigned int optlen = sizeof(socketError);
-
-	errno = 0;
-	if (getsockopt(socket, SOL_SOCKET, SO_ERROR, (char*)&socketError, &optlen))
-	{
-		pblCgiExitOnError("%s: getsockopt(%d) error, errno %d\n", tag, socket, errno);
-	}
-
-	struct timeval myTimeout;
-	fd_set readFds;
-	int nBytesRead = 0;
-
-	while (nBytesRead < bufferSize)
-	{
-		FD_ZERO(&readFds);
-		FD_SET(socket, &readFds);
-
-		myTimeout = *timeout;
-		errno = 0;
-
-		rc = select(socket + 1, &readFds, (fd_set*)NULL, (fd_set*)NULL, &myTimeout);
-		switch (rc)
-		{
-		case 0:
-			// The return value may be zero if the timeout expired before any file descriptors became ready.
-			return (-1);
-
-		case -1:
-			if (errno == EINTR)
-			{
-				pblCgiExitOnError("%s: select(%d) EINTR error, errno %d\n", tag, socket, errno);
-			}
-			pblCgiExitOnError("%s: select(%d) error, errno %d\n", tag, socket, errno);
-			break;
-
-		default:
-			errno = 0;
-			if (getsockopt(socket, SOL_SOCKET, SO_ERROR, (char*)&socketError, &optlen))
-			{
-				pblCgiExitOnError("%s: getsockopt(%d) error, errno %d\n", tag, socket, errno);
-			}
-
-			if (socketError)
-			{
-				continue;
-			}
-
-			errno = 0;
-			rc = recvfrom(socket, buffer + nBytesRead, bufferSize - nBytesRead, 0, NULL, NULL);
-			if (rc < 0)
-			{
-				if (errno == EINTR)
-				{
-					pblCgiExitOnError("%s: recvfrom(%d) EINTR error, errno %d\n", tag, socket, errno);
-				}
-				pblCgiExitOnError("%s: recvfrom(%d) error, errno %d\n", tag, socket, errno);
-			}
-			else if (rc == 0)
-			{
-				return nBytesRead;
-			}
-			nBytesRead += rc;
-		}
-	}
-	return nBytesRead;
-}
-
-static char adbReceiveBuffer[64 * 1024];
-/*
-* Receive some string bytes and return the result in a malloced buffer.
-*/
-static char* receiveStringFromTcp(int socket, int timeoutSeconds)
-{
-	static char* tag = "receiveStringFromTcp";
-
-	char* result = NULL;
-	PblStringBuilder* stringBuilder = NULL;
-
-	struct timeval timeoutValue;
-	timeoutValue.tv_sec = timeoutSeconds;
-	timeoutValue.tv_usec = 0;
-
-	adbReceiveBuffer[0] = '\0';
-
-	for (;;)
-	{
-		int rc = receiveBytesFromTcp(socket, adbReceiveBuffer, sizeof(adbReceiveBuffer) - 1, &timeoutValue);
-		if (rc < 0)
-		{
-			// Select had a timeout
-			return NULL;
-		}
-		if (rc < 0 || rc > sizeof(adbReceiveBuffer) - 1)
-		{
-			pblCgiExitOnError("%s: readTcp failed! rc %d\n", tag, rc);
-		}
-		else if (rc == 0)
-		{
-			break;
-		}
-		else
-		{
-			adbReceiveBuffer[rc] = '\0';
-		}
-
-		if (rc < sizeof(adbReceiveBuffer) - 1 && stringBuilder == NULL)
-		{
-			result = pblCgiStrDup(adbReceiveBuffer);
-			break;
-		}
-
-		if (stringBuilder == NULL)
-		{
-			stringBuilder = pblStringBuilderNew();
-			if (!stringBuilder)
-			{
-				pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
-			}
-		}
-		if (pblStringBuilderAppendStr(stringBuilder, adbReceiveBuffer) == ((size_t)-1))
-		{
-			pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
-		}
-	}
-
-	if (result == NULL)
-	{
-		if (stringBuilder == NULL)
-		{
-			pblCgiExitOnError("%s: socket %d received 0 bytes as response\n", tag, socket);
-		}
-
-		result = pblStringBuilderToString(stringBuilder);
-		if (!result)
-		{
-			pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
-		}
-	}
-	if (stringBuilder)
-	{
-		pblStringBuilderFree(stringBuilder);
-	}
-	return result;
-}
-
-/*
-* Send some bytes to a tcp socket
-*/
-static void sendBytesToTcp(int socket, char* buffer, int nBytesToSend)
-{
-	static char* tag = "sendBytesToTcp";
-
-	char* ptr = buffer;
-	while (nBytesToSend > 0)
-	{
-		errno = 0;
-		int rc = send(socket, ptr, nBytesToSend, 0);
-		if (rc > 0)
-		{
-			ptr += rc;
-			nBytesToSend -= rc;
-		}
-		else
-		{
-			pblCgiExitOnError("%s: send(%d) error, rc %d, errno %d\n", tag, socket, rc, errno);
-		}
-	}
-}
-
-/*
-* Connect to a tcp socket on machine with hostname and port
-*/
-static int connectToTcp(char* hostname, int port)
-{
-	static char* tag = "connectToTcp";
-
-	errno = 0;
-	struct hostent* hostInfo = gethostbyname(hostname);
-	if (!hostInfo)
-	{
-		pblCgiExitOnError("%s: gethostbyname(%s) error, errno %d.\n", tag, hostname, errno);
-		return -1;
-	}
-
-	short shortPort = 80;
-	if (port > 0)
-	{
-		shortPort = port;
-	}
-
-	struct sockaddr_in serverAddress;
-	memset((char*)&serverAddress, 0, sizeof(struct sockaddr_in));
-	serverAddress.sin_family = AF_INET;
-	serverAddress.sin_port = htons(shortPort);
-	memcpy(&(serverAddress.sin_addr.s_addr), hostInfo->h_addr, sizeof(serverAddress.sin_addr.s_addr));
-
-	errno = 0;
-	int socketFd = socket(AF_INET, SOCK_STREAM, 0);
-	if (socketFd < 0)
-	{
-		pblCgiExitOnError("%s: socket() error, errno %d\n", tag, errno);
-	}
-
-	errno = 0;
-	if (connect(socketFd, (struct sockaddr*)&serverAddress, sizeof(struct sockaddr_in)) < 0)
-	{
-		pblCgiExitOnError("%s: connect(%d) error, host '%s' on port %d, errno %d\n", tag, socketFd, hostname, shortPort, errno);
-		socket_close(socketFd);
-	}
-	return socketFd;
-}
-
-/*
-* Make a HTTP request with the given uri to the given host/port
-* and return the result content in a malloced buffer.
-*/
-char* adbGetHttpResponse(char* hostname, int port, char* uri, int timeoutSeconds, char* agent)
-{
-	char* response = NULL;
-	for (int n = 0; n < 3; n++)
-	{
-		int socketFd = connectToTcp(hostname, port);
-
-		char* sendBuffer = pblCgiSprintf("GET %s HTTP/1.0\r\nUser-Agent: %s\r\nHost: %s\r\n\r\n", uri, agent, hostname);
-		PBL_CGI_TRACE("HttpRequest=%s", sendBuffer);
-
-		sendBytesToTcp(socketFd, sendBuffer, strlen(sendBuffer));
-		PBL_FREE(sendBuffer);
-
-		response = receiveStringFromTcp(socketFd, timeoutSeconds);
-		socket_close(socketFd);
-		if (!response)
-		{
-			PBL_CGI_TRACE("HttpResponse=NULL, n=%d", n);
-			continue;
-		}
-		PBL_CGI_TRACE("HttpResponse=%s", response);
-		break;
-	}
-	if (!response)
-	{
-		pblCgiExitOnError("getHttpResponse: receiveStringFromTcp returned NULL\n");
-	}
-	return response;
-}
-
-static char* getMatchingString(char* string, char start, char end, char** nextPtr)
-{
-	char* tag = "getMatchingString";
-	char* ptr = string;
-	if (start != *ptr)
-	{
-		pblCgiExitOnError("%s: expected %c at start of string '%s'\n", tag, start, string);
-	}
-
-	int level = 1;
-	int c;
-	while ((c = *++ptr))
-	{
-		if (c == start)
-		{
-			level++;
-		}
-		if (c == end)
-		{
-			level--;
-			if (level < 1)
-			{
-				if (nextPtr)
-				{
-					*nextPtr = ptr + 1;
-				}
-				return pblCgiStrRangeDup(string + 1, ptr);
-			}
-		}
-	}
-	pblCgiExitOnError("%s: unexpected end of string in '%s', expected end character '%c'\n", tag, string, end);
-	return NULL;
-}
-
-char* adbGetStringBetween(char* string, char* start, char* end)
-{
-	char* tag = "adbGetStringBetween";
-	char* ptr = *start ? strstr(string, start) : string;
-	if (!ptr)
-	{
-		pblCgiExitOnError("%s: expected starting tag '%s' in string '%s'\n", tag, start, string);
-		return NULL;
-	}
-	ptr += strlen(start);
-	char* ptr2 = strstr(ptr, end);
-	if (!ptr2)
-	{
-		pblCgiExitOnError("%s: expected ending '%s' in string '%s'\n", tag, end, ptr);
-	}
-	return pblCgiStrRangeDup(ptr, ptr2);
-}
-
-static char* getNumberString(char* string, char* start)
-{
-	char* tag = "getNumberString";
-	char* ptr = strstr(string, start);
-	if (!ptr)
-	{
-		pblCgiExitOnError("%s: expected starting tag '%s' in string '%s'\n", tag, start, string);
-	}
-	ptr += strlen(start);
-
-	char* ptr2 = ptr;
-	while (ptr2 && *ptr2)
-	{
-		if (isdigit(*ptr2) || '.' == *ptr2 || '-' == *ptr2 || '+' == *ptr2)
-		{
-			ptr2++;
-			continue;
-		}
-		break;
-	}
-	if (!ptr2)
-	{
-		pblCgiExitOnError("%s: expected number ending in string '%s'\n", tag, ptr);
-	}
-	return pblCgiStrRangeDup(ptr, ptr2);
-}
-
-char* adbGetHttpResponseBody(char* response, char** cookiePtr)
-{
-	static char* tag = "adbGetHttpResponseBody";
-
-	// check for HTTP error code like HTTP/1.1 500 Server Error
-	//
-	if (cookiePtr && strstr(response, "Set-Cookie: "))
-	{
-		*cookiePtr = adbGetStringBetween(response, "Set-Cookie: ", "\r\n");
-	}
-
-	char* ptr = strstr(response, "HTTP/");
-	if (ptr)
-	{
-		ptr = strstr(ptr, " ");
-		if (ptr)
-		{
-			ptr++;
-			if (strncmp(ptr, "200", 3))
-			{
-				pblCgiExitOnError("%s: Bad HTTP response\n%s\n", tag, response);
-			}
-		}
-	}
-
-	if (ptr)
-	{
-		char* end = strstr(ptr, "\r\n\r\n");
-		if (!end)
-		{
-			end = strstr(ptr, "\n\n");
-			if (!end)
-			{
-				pblCgiExitOnError("%s: Illegal HTTP response, no separator.\n%s\n", tag, response);
-			}
-			else
-			{
-				end += 2;
-			}
-		}
-		else
-		{
-			end += 4;
-		}
-		return end;
-	}
-
-	pblCgiExitOnError("%s: Expecting HTTP response\n%s\n", tag, response);
-	return NULL;
-}
-
-static void putString(char* string, PblStringBuilder* stringBuilder)
-{
-	char* tag = "putString";
-
-	if (pblStringBuilderAppendStr(stringBuilder, string) == ((size_t)-1))
-	{
-		pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
-	}
-	fputs(string, stdout);
-}
-
-static char* changeLat(char* string, int i, int difference)
-{
-	if (!strstr(string, "\"lat\":"))
-	{
-		return pblCgiStrDup(string);
-	}
-
-	int factor = 1 + (i - 1) / 8;
-	int modulo = (i - 1) % 8;
-
-	switch (modulo)
-	{
-	case 0:
-		difference *= factor;
-		break;
-	case 1:
-		difference *= -factor;
-		break;
-	case 4:
-	case 5:
-		difference *= factor;
-		break;
-	case 6:
-	case 7:
-		difference *= -factor;
-		break;
-	default:
-		return pblCgiStrDup(string);
-	}
-
-	char* lat = getNumberString(string, "\"lat\":");
-	//PBL_CGI_TRACE("lat=%s", lat);
-
-	char* oldLat = pblCgiSprintf("\"lat\":%s,", lat);
-	//PBL_CGI_TRACE("oldLat=%s", oldLat);
-
-	char* newLat = pblCgiSprintf("\"lat\":%d,", atoi(lat) + difference);
-	//PBL_CGI_TRACE("newLat=%s", newLat);
-
-	char* replacedLat = pblCgiStrReplace(string, oldLat, newLat);
-
-	PBL_FREE(lat);
-	PBL_FREE(oldLat);
-	PBL_FREE(newLat);
-
-	return replacedLat;
-}
-
-static char* changeLon(char* string, int i, int difference)
-{
-	if (!strstr(string, "\"lon\":"))
-	{
-		return pblCgiStrDup(string);
-	}
-
-	int factor = 1 + (i - 1) / 8;
-	int modulo = (i - 1) % 8;
-
-	switch (modulo)
-	{
-	case 2:
-		difference *= factor;
-		break;
-	case 3:
-		difference *= -factor;
-		break;
-	case 4:
-	case 6:
-		difference *= factor;
-		break;
-	case 5:
-	case 7:
-		difference *= -factor;
-		break;
-	default:
-		return pblCgiStrDup(string);
-	}
-
-	char* lon = getNumberString(string, "\"lon\":");
-	//PBL_CGI_TRACE("lon=%s", lon);
-
-	char* oldLon = pblCgiSprintf("\"lon\":%s,", lon);
-	//PBL_CGI_TRACE("oldLon=%s", oldLon);
-
-	char* newLon = pblCgiSprintf("\"lon\":%d,", atoi(lon) + difference);
-	//PBL_CGI_TRACE("newLon=%s", newLon);
-
-	char* replacedLon = pblCgiStrReplace(string, oldLon, newLon);
-
-	PBL_FREE(lon);
-	PBL_FREE(oldLon);
-	PBL_FREE(newLon);
-
-	return replacedLon;
-}
-
-static char* changeBaseUrl(char* string, char * oldValue, char *newValue)
-{
-	char* baseUrlStart = "\"baseURL\":\"";
-	char* ptr = strstr(string, baseUrlStart);
-	if (!ptr)
-	{
-		return string;
-	}
-
-	char* assetBundleUrl = adbGetStringBetween(ptr, baseUrlStart, "\"");
-	if (!assetBundleUrl || !strstr(assetBundleUrl, oldValue) || strstr(assetBundleUrl, newValue))
-	{
-		return string;
-	}
-	PBL_FREE(assetBundleUrl);
-
-	ptr = pblCgiStrReplace(string, oldValue, newValue);
-	//PBL_CGI_TRACE("baseUrlFrom=%s", string);
-	//PBL_CGI_TRACE("baseUrlTo  =%s", ptr);
-	return ptr;
-}
-
-
-void adbGetLatAndLonOfDevice(char* queryString, int* latDifference, int* lonDifference)
-{
-	char* latOfDevice = "latOfDevice=";
-	char* lonOfDevice = "lonOfDevice=";
-	int latPtrInteger = 0;
-	int lonPtrInteger = 0;
-
-	char* latPtr = strstr(queryString, latOfDevice);
-	if (latPtr)
-	{
-		char* ptr = strstr(latPtr, "&");
-		if (ptr)
-		{
-			latPtr = pblCgiStrRangeDup(latPtr, ptr);
-		}
-		else
-		{
-			latPtr = pblCgiStrDup(latPtr);
-		}
-		latPtrInteger = (int)(1000000.0 * strtod(latPtr + strlen(latOfDevice), NULL));
-	}
-	char* lonPtr = strstr(queryString, lonOfDevice);
-	if (lonPtr)
-	{
-		char* ptr = strstr(lonPtr, "&");
-		if (ptr)
-		{
-			lonPtr = pblCgiStrRangeDup(lonPtr, ptr);
-		}
-		else
-		{
-			lonPtr = pblCgiStrDup(lonPtr);
-		}
-		lonPtrInteger = (int)(1000000.0 * strtod(lonPtr + strlen(lonOfDevice), NULL));
-	}
-	if (latDifference && lonDifference && latPtrInteger != 0 && lonPtrInteger != 0)
-	{
-		*latDifference = 0 - latPtrInteger;
-		*lonDifference = 0 - lonPtrInteger;
-	}
-}
-
-char* adbChangeLatAndLon(char* queryString, char* lat, char* lon, int* latDifference, int* lonDifference)
-{
-	if (!pblCgiStrIsNullOrWhiteSpace(lat) && !pblCgiStrIsNullOrWhiteSpace(lon))
-	{
-		char* replacementLat = pblCgiStrCat("lat=", lat);
-		char* replacementLon = pblCgiStrCat("lon=", lon);
-		double latDouble = strtod(replacementLat + 4, NULL);
-		int replacementLatInteger = (int)(1000000.0 * latDouble);
-		double lonDouble = strtod(replacementLon + 4, NULL);
-		int replacementLonInteger = (int)(1000000.0 * lonDouble);
-		int latPtrInteger = 0;
-		int lonPtrInteger = 0;
-
-		char* latPtr = strstr(queryString, "lat=");
-		if (latPtr)
-		{
-			char* ptr = strstr(latPtr, "&");
-			if (ptr)
-			{
-				latPtr = pblCgiStrRangeDup(latPtr, ptr);
-			}
-			else
-			{
-				latPtr = pblCgiStrDup(latPtr);
-			}
-			latPtrInteger = (int)(1000000.0 * strtod(latPtr + 4, NULL));
-			queryString = pblCgiStrReplace(queryString, latPtr, replacementLat);
-		}
-		char* lonPtr = strstr(queryString, "lon=");
-		if (lonPtr)
-		{
-			char* ptr = strstr(lonPtr, "&");
-			if (ptr)
-			{
-				lonPtr = pblCgiStrRangeDup(lonPtr, ptr);
-			}
-			else
-			{
-				lonPtr = pblCgiStrDup(lonPtr);
-			}
-			lonPtrInteger = (int)(1000000.0 * strtod(lonPtr + 4, NULL));
-			queryString = pblCgiStrReplace(queryString, lonPtr, replacementLon);
-		}
-		if (latDifference && lonDifference && latPtrInteger != 0 && lonPtrInteger != 0)
-		{
-			*latDifference = replacementLatInteger - latPtrInteger;
-			*lonDifference = replacementLonInteger - lonPtrInteger;
-		}
-		return queryString;
-	}
-	return NULL;
-}
-
-char* adbChangeRedirectionUrl(char* string, char* redirectionUrl)
-{
-	if (!strstr(string, "\"redirectionUrl\":"))
-	{
-		return pblCgiStrDup(string);
-	}
-
-	char* oldValue = adbGetStringBetween(string, "\"redirectionUrl\":", ",\"");
-
-	char* oldValueStr = pblCgiSprintf("\"redirectionUrl\":%s", oldValue);
-	char* newValueStr = pblCgiSprintf("\"redirectionUrl\":\"%s\"", redirectionUrl);
-
-	char* replacedString = pblCgiStrReplace(string, oldValueStr, newValueStr);
-
-	PBL_FREE(oldValue);
-	PBL_FREE(oldValueStr);
-	PBL_FREE(newValueStr);
-
-	return replacedString;
-}
-
-char* adbChangeLayer(char* string, char* layer)
-{
-	if (!strstr(string, "\"layer\":"))
-	{
-		return pblCgiStrDup(string);
-	}
-
-	char* oldValue = adbGetStringBetween(string, "\"layer\":", ",\"");
-
-	char* oldValueStr = pblCgiSprintf("\"layer\":%s", oldValue);
-	char* newValueStr = pblCgiSprintf("\"layer\":\"%s\"", layer);
-
-	char* replacedString = pblCgiStrReplace(string, oldValueStr, newValueStr);
-
-	PBL_FREE(oldValue);
-	PBL_FREE(oldValueStr);
-	PBL_FREE(newValueStr);
-
-	return replacedString;
-}
-
-char* adbChangeRedirectionLayer(char* string, char* redirectionLayer)
-{
-	if (!strstr(string, "\"redirectionLayer\":"))
-	{
-		return pblCgiStrDup(string);
-	}
-
-	char* oldValue = adbGetStringBetween(string, "\"redirectionLayer\":", ",\"");
-
-	char* oldValueStr = pblCgiSprintf("\"redirectionLayer\":%s", oldValue);
-	char* newValueStr = pblCgiSprintf("\"redirectionLayer\":\"%s\"", redirectionLayer);
-
-	char* replacedString = pblCgiStrReplace(string, oldValueStr, newValueStr);
-
-	PBL_FREE(oldValue);
-	PBL_FREE(oldValueStr);
-	PBL_FREE(newValueStr);
-
-	return replacedString;
-}
-
-char* adbChangeLayerName(char* string, char* layerName)
-{
-	if (!strstr(string, "layerName="))
-	{
-		return pblCgiStrDup(string);
-	}
-
-	char* oldLayerName = adbGetStringBetween(string, "layerName=", "&");
-
-	char* oldLayerNameStr = pblCgiSprintf("layerName=%s", oldLayerName);
-	char* newLayerNameStr = pblCgiSprintf("layerName=%s", layerName);
-
-	char* replacedString = pblCgiStrReplace(string, oldLayerNameStr, newLayerNameStr);
-
-	PBL_FREE(oldLayerName);
-	PBL_FREE(oldLayerNameStr);
-	PBL_FREE(newLayerNameStr);
-
-	return replacedString;
-}
-
-char* adbChangeShowMenuOption(char* string, char* value)
-{
-	if (!strstr(string, "\"showMenuButton\":"))
-	{
-		return pblCgiStrDup(string);
-	}
-
-	char* oldValue = adbGetStringBetween(string, "\"showMenuButton\":", ",\"");
-
-	char* oldValueStr = pblCgiSprintf("\"showMenuButton\":%s", oldValue);
-	char* newValueStr = pblCgiSprintf("\"showMenuButton\":\"%s\"", value);
-
-	char* replacedString = pblCgiStrReplace(string, oldValueStr, newValueStr);
-
-	PBL_FREE(oldValue);
-	PBL_FREE(oldValueStr);
-	PBL_FREE(newValueStr);
-
-	return replacedString;
-}
-
-static PblList* devicePositionList = NULL;
-
-char* adbHandleDevicePosition(char* deviceId, char* queryString, int* latDifference, int* lonDifference)
-{
-	if (pblCgiStrIsNullOrWhiteSpace(deviceId))
-	{
-		return NULL;
-	}
-
-	char* lat = NULL;
-	char* lon = NULL;
-
-	if (!devicePositionList)
-	{
-		char* devicePositionValue = pblCgiConfigValue("DevicePosition", NULL);
-		if (pblCgiStrIsNullOrWhiteSpace(devicePositionValue))
-		{
-			return NULL;
-		}
-		devicePositionList = pblCgiStrSplitToList(devicePositionValue, ",");
-		if (pblListIsEmpty(devicePositionList))
-		{
-			PBL_CGI_TRACE("DevicePositionList is empty");
-			return NULL;
-		}
-	}
-
-	int listSize = pblListSize(devicePositionList);
-
-	for (int i = 0; i < listSize - 2; i += 3)
-	{
-		char* device = pblListGet(devicePositionList, i);
-
-		if (pblCgiStrEquals(deviceId, device))
-		{
-			lat = pblListGet(devicePositionList, i + 1);
-			lon = pblListGet(devicePositionList, i + 2);
-			PBL_CGI_TRACE("Device %s, lat %s, lon %s", deviceId, lat ? lat : "", lon ? lon : "");
-			break;
-		}
-	}
-	return adbChangeLatAndLon(queryString, lat, lon, latDifference, lonDifference);
-}
-
-static PblList* bundlePositionList = NULL;
-
-char* adbHandleBundlePosition(char* bundleId, char* queryString, int* latDifference, int* lonDifference)
-{
-	if (pblCgiStrIsNullOrWhiteSpace(bundleId))
-	{
-		return NULL;
-	}
-
-	char* lat = NULL;
-	char* lon = NULL;
-
-	if (!bundlePositionList)
-	{
-		char* bundlePositionValue = pblCgiConfigValue("BundlePosition", NULL);
-		if (pblCgiStrIsNullOrWhiteSpace(bundlePositionValue))
-		{
-			return NULL;
-		}
-		bundlePositionList = pblCgiStrSplitToList(bundlePositionValue, ",");
-		if (pblListIsEmpty(bundlePositionList))
-		{
-			PBL_CGI_TRACE("BundlePositionList is empty");
-			return NULL;
-		}
-	}
-
-	int listSize = pblListSize(bundlePositionList);
-
-	for (int i = 0; i < listSize - 2; i += 3)
-	{
-		char* bundle = pblListGet(bundlePositionList, i);
-
-		if (pblCgiStrEquals(bundleId, bundle))
-		{
-			lat = pblListGet(bundlePositionList, i + 1);
-			lon = pblListGet(bundlePositionList, i + 2);
-			PBL_CGI_TRACE("Bundle %s, lat %s, lon %s", bundleId, lat ? lat : "", lon ? lon : "");
-			break;
-		}
-	}
-	return adbChangeLatAndLon(queryString, lat, lon, latDifference, lonDifference);
-}
-
-static PblList* deeplinkPositionList = NULL;
-
-char* adbHandleDeeplinkPosition(char* deeplinkName, char* queryString, int* latDifference, int* lonDifference)
-{
-	if (pblCgiStrIsNullOrWhiteSpace(deeplinkName))
-	{
-		return NULL;
-	}
-
-	char* lat = NULL;
-	char* lon = NULL;
-
-	if (!deeplinkPositionList)
-	{
-		char* deeplinkPositionValue = pblCgiConfigValue("DeeplinkPosition", NULL);
-		if (pblCgiStrIsNullOrWhiteSpace(deeplinkPositionValue))
-		{
-			return NULL;
-		}
-		deeplinkPositionList = pblCgiStrSplitToList(deeplinkPositionValue, ",");
-		if (pblListIsEmpty(deeplinkPositionList))
-		{
-			PBL_CGI_TRACE("DeeplinkPositionList is empty");
-			return NULL;
-		}
-	}
-
-	int listSize = pblListSize(deeplinkPositionList);
-
-	for (int i = 0; i < listSize - 2; i += 3)
-	{
-		char* deeplink = pblListGet(deeplinkPositionList, i);
-
-		if (pblCgiStrEquals(deeplinkName, deeplink))
-		{
-			lat = pblListGet(deeplinkPositionList, i + 1);
-			lon = pblListGet(deeplinkPositionList, i + 2);
-			PBL_CGI_TRACE("Deeplink %s, lat %s, lon %s", deeplinkName, lat ? lat : "", lon ? lon : "");
-			break;
-		}
-	}
-	return adbChangeLatAndLon(queryString, lat, lon, latDifference, lonDifference);
-}
-
-void adbTraceDuration()
-{
-	struct timeval now;
-	gettimeofday(&now, NULL);
-
-	unsigned long duration = now.tv_sec * 1000000 + now.tv_usec;
-	duration -= pblCgiStartTime.tv_sec * 1000000 + pblCgiStartTime.tv_usec;
-	char* string = pblCgiSprintf("%lu", duration);
-	PBL_CGI_TRACE("Duration=%s microseconds", string);
-}
-
-void adbPrintHeader(char* cookie)
-{
-	fputs("Content-Type: application/json\r\n", stdout);
-	if (cookie)
-	{
-		fputs("Set-Cookie: ", stdout);
-		fputs(cookie, stdout);
-		fputs("\r\n", stdout);
-	}
-	fputs("\r\n", stdout);
-}
-
-void adbHandleResponse(char* response, int latDifference, int lonDifference, int bundleInteger)
-{
-	static char* tag = "adbHandleResponse";
-	char* cookie = NULL;
-	response = adbGetHttpResponseBody(response, &cookie);
-
-	char* start = "{\"hotspots\":";
-	int length = strlen(start);
-
-	if (strncmp(start, response, length))
-	{
-		adbPrintHeader(cookie);
-		fputs(response, stdout);
-		PBL_CGI_TRACE("Response does not start with %s, no handling", start);
-		return;
-	}
-
-	PblStringBuilder* stringBuilder = pblStringBuilderNew();
-	if (!stringBuilder)
-	{
-		pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
-	}
-
-	char* rest = NULL;
-	char* hotspotsString = getMatchingString(response + length, '[', ']', &rest);
-
-	PblList* list = pblListNewArrayList();
-	if (!list)
-	{
-		pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
-	}
-
-	char* ptr = hotspotsString;
-	while (*ptr == '{')
-	{
-		char* ptr2 = NULL;
-		char* hotspot = getMatchingString(ptr, '{', '}', &ptr2);
-
-		if (pblListAdd(list, hotspot) < 0)
-		{
-			pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
-		}
-		if (*ptr2 != ',')
-		{
-			break;
-		}
-		ptr = ptr2 + 1;
-	}
-
-	adbPrintHeader(cookie);
-	putString(start, stringBuilder);
-	putString("[", stringBuilder);
-
-	int nPois = pblListSize(list);
-	PBL_CGI_TRACE("Number of pois=%d", nPois);
-
-	for (int j = 0; j < nPois; j++)
-	{
-		if (j > 0)
-		{
-			putString(",", stringBuilder);
-		}
-		putString("{", stringBuilder);
-
-		char* hotspot = pblListGet(list, j);
-
-		char* ptr = hotspot;
-		if (latDifference != 0 || lonDifference != 0)
-		{
-			char* replacedLat = changeLat(hotspot, 1, -1 * latDifference);
-			ptr = changeLon(replacedLat, 5, -1 * lonDifference);
-			PBL_CGI_TRACE("Applied latDifference=%d and lonDifference=%d", latDifference, lonDifference);
-		}
-
-		if (bundleInteger > 0 && bundleInteger < 20230828)
-		{
-			char* oldBaseUrl = "arpoise.com\\/AB\\/";
-			char* newBaseUrl = "arpoise.com\\/AB\\/U2018\\/";
-			ptr = changeBaseUrl(ptr, oldBaseUrl, newBaseUrl);
-			//PBL_CGI_TRACE("Applied changeBaseUrl='%s' to '%s'", oldBaseUrl, newBaseUrl);
-		}
-		putString(ptr, stringBuilder);
-		putString("}", stringBuilder);
-	}
-
-	putString("]", stringBuilder);
-
-	putString(rest, stringBuilder);
-	PBL_CGI_TRACE("output=%s", pblStringBuilderToString(stringBuilder));
-	pblStringBuilderFree(stringBuilder);
-}
-
-static void createStatisticsFile(char* directory, char* fileName)
-{
-	char* filePath = pblCgiSprintf("%s/%s", directory, fileName);
-
-	FILE* stream = NULL;
-
-#ifdef WIN32
-	errno_t err = fopen_s(&stream, filePath, "r");
-	if (err != 0)
-	{
-		stream = NULL;
-	}
-#else
-	stream = fopen(filePath, "r");
-#endif
-	if (!stream)
-	{
-		stream = pblCgiFopen(filePath, "a");
-		if (stream)
-		{
-			fputs("<title>Arpoise</title>\n<body>copyright  2019, Tamiko Thiel and Peter Graf</body>\n", stream);
-		}
-	}
-	if (stream)
-	{
-		fclose(stream);
-	}
-	PBL_FREE(filePath);
-}
-
-void adbCreateStatisticsHits(int layer, char* layerName, int layerServed)
-{
-	char* count = pblCgiQueryValue("count");
-	if (pblCgiStrEquals("1", count))
-	{
-		PBL_CGI_TRACE("-------> Statistics Request\n");
-
-		// Create a web hit for the os and bundle, so that web stats can be used to count hits
-
-		char* versionsDirectory = pblCgiConfigValue("VersionsDirectory", "");
-		if (versionsDirectory && *versionsDirectory)
-		{
-			char* os = pblCgiQueryValue("os");
-			if (!os || !*os || strstr(os, ".."))
-			{
-				os = "UnknownOperatingSystem";
-			}
-
-			char* bundle = pblCgiQueryValue("bundle");
-			if (!bundle || !*bundle || strstr(bundle, ".."))
-			{
-				bundle = "UnknownBundle";
-			}
-
-			char* clientApplication = pblCgiQueryValue("client");
-			if (!clientApplication || !*clientApplication || strstr(clientApplication, ".."))
-			{
-				clientApplication = "UnknownClient";
-			}
-
-			char* fileName = pblCgiSprintf("%s_%s_%s.htm", os, clientApplication, bundle);
-			createStatisticsFile(versionsDirectory, fileName);
-			char* uri = pblCgiSprintf("/ArpoiseDirectory/AppVersions/%s", fileName);
-			adbGetHttpResponse("www.arpoise.com", 80, uri, 16, "ArpoiseDirectory/AppVersions");
-		}
-
-		// Create a web hit for the location, so that web stats can be used to count hits
-
-		char* locationsDirectory = pblCgiConfigValue("LocationsDirectory", "");
-		if (locationsDirectory && *locationsDirectory)
-		{
-			char* queryLat = pblCgiQueryValue("lat");
-			if (!queryLat || !*queryLat || strstr(queryLat, ".."))
-			{
-				queryLat = "UnknownLat";
-			}
-			else
-			{
-				queryLat = pblCgiStrDup(queryLat);
-			}
-			char* ptr = strstr(queryLat, ".");
-			if (ptr && strlen(ptr) > 4)
-			{
-				ptr[4] = '\0'; // truncate latitude to 3 digits after the '.'
-			}
-
-			char* queryLon = pblCgiQueryValue("lon");
-			if (!queryLon || !*queryLon || strstr(queryLon, ".."))
-			{
-				queryLon = "UnknownLon";
-			}
-			else
-			{
-				queryLon = pblCgiStrDup(queryLon);
-			}
-			ptr = strstr(queryLon, ".");
-			if (ptr && strlen(ptr) > 4)
-			{
-				ptr[4] = '\0'; // truncate longitude to 3 digits after the '.'
-			}
-
-			char* fileName = pblCgiSprintf("%s_%s-%s.htm", queryLon, queryLat, layerName);
-			createStatisticsFile(locationsDirectory, fileName);
-			char* uri = pblCgiSprintf("/ArpoiseDirectory/Locations/%s", fileName);
-			adbGetHttpResponse("www.arpoise.com", 80, uri, 16, "ArpoiseDirectory/Locations");
-		}
-
-		// Create a web hit for the layer, so that web stats can be used to count hits
-
-		char* layersDirectory = pblCgiConfigValue("LayersDirectory", "");
-		if (layer && layersDirectory && *layersDirectory && layerName && *layerName)
-		{
-			if (!layerName || !*layerName || strstr(layerName, ".."))
-			{
-				layerName = "UnknownLayer";
-			}
-
-			char* fileName = pblCgiSprintf("%s.htm", layerName);
-			createStatisticsFile(layersDirectory, fileName);
-			char* uri = pblCgiSprintf("/ArpoiseDirectory/Layers/%s", fileName);
-			adbGetHttpResponse("www.arpoise.com", 80, uri, 16, "ArpoiseDirectory/Layers");
-		}
-
-		// Create a web hit for the layer served, so that web stats can be used to count hits
-
-		char* layersServedDirectory = pblCgiConfigValue("LayersServedDirectory", "");
-		if (layerServed && layersServedDirectory && *layersServedDirectory && layerName && *layerName)
-		{
-			if (!layerName || !*layerName || strstr(layerName, ".."))
-			{
-				layerName = "UnknownLayer";
-			}
-
-			char* fileName = pblCgiSprintf("%s.htm", layerName);
-			createStatisticsFile(layersServedDirectory, fileName);
-			char* uri = pblCgiSprintf("/ArpoiseDirectory/LayersServed/%s", fileName);
-			adbGetHttpResponse("www.arpoise.com", 80, uri, 16, "ArpoiseDirectory/LayersServed");
-		}
-	}
-}
-
-static void freeStringList(PblList* list)
-{
-	while (!pblListIsEmpty(list))
-	{
-		free(pblListPop(list));
-	}
-	pblListFree(list);
-}
-
-static int adbGetIntValue(char* queryString, char* label)
-{
-	int value = 0;
-	char* start = strstr(queryString, label);
-	if (start)
-	{
-		char* ptr = strstr(start, "&");
-		if (ptr)
-		{
-			ptr = pblCgiStrRangeDup(start, ptr);
-		}
-		else
-		{
-			ptr = pblCgiStrDup(start);
-		}
-		double lDouble = strtod(ptr + strlen(label), NULL);
-		value = (int)(1000000.0 * lDouble);
-		PBL_FREE(ptr);
-	}
-	return value;
-}
-
-static int adbGetLat(char* queryString)
-{
-	return adbGetIntValue(queryString, "lat=");
-}
-
-static int adbGetLon(char* queryString)
-{
-	return adbGetIntValue(queryString, "lon=");
-}
-
-char* adbGetArea(char* queryString, char* clientApplication)
-{
-	int lat = adbGetLat(queryString);
-	int lon = adbGetLon(queryString);
-
-	for (int i = 1; i <= 1000; i++)
-	{
-		char* areaKey = NULL;
-		char* areaValue = NULL;
-		int areaHasValue = 0;
-
-		for (int j = 0; j < 2; j++)
-		{
-			PBL_FREE(areaKey);
-			if (j == 0)
-			{
-				if (pblCgiStrEquals(ArvosApplicationName, clientApplication))
-				{
-					areaKey = pblCgiSprintf("%s_Area_%d", ArvosApplicationName, i);
-					areaValue = pblCgiConfigValue(areaKey, NULL);
-				}
-				else if (pblCgiStrEquals(ArpoiseApplicationName, clientApplication))
-				{
-					areaKey = pblCgiSprintf("%s_Area_%d", ArpoiseApplicationName, i);
-					areaValue = pblCgiConfigValue(areaKey, NULL);
-				}
-			}
-			else
-			{
-				areaKey = pblCgiSprintf("Area_%d", i);
-				areaValue = pblCgiConfigValue(areaKey, NULL);
-			}
-			if (pblCgiStrIsNullOrWhiteSpace(areaValue))
-			{
-				if (j == 0)
-				{
-					continue;
-				}
-				if (!areaHasValue)
-				{
-					PBL_CGI_TRACE("No value for area %s", areaKey);
-					PBL_FREE(areaKey);
-					return NULL;
-				}
-				break;
-			}
-
-			PblList* locationList = pblCgiStrSplitToList(areaValue, ",");
-			int size = pblListSize(locationList);
-			if (size != 4)
-			{
-				PBL_CGI_TRACE("%s, expecting 4 location values, current value is %s", areaKey, areaValue);
-
-				freeStringList(locationList);
-				continue;
-			}
-			areaHasValue = 1;
-			int list0 = atoi(pblListGet(locationList, 0));
-			int list1 = atoi(pblListGet(locationList, 1));
-			int list2 = atoi(pblListGet(locationList, 2));
-			int list3 = atoi(pblListGet(locationList, 3));
-
-			if (lat < list0 || lon < list1 || lat > list2 || lon > list3)
-			{
-				PBL_CGI_TRACE("%s, lat %d, lon %d is outside area value %s", areaKey, lat, lon, areaValue);
-
-				freeStringList(locationList);
-				continue;
-			}
-			PBL_CGI_TRACE("%s, lat %d, lon %d is inside area value %s", areaKey, lat, lon, areaValue);
-
-			freeStringList(locationList);
-			return areaKey;
-		}
-		PBL_FREE(areaKey);
-	}
-	return NULL;
-}
-
-char* adbGetAreaConfigValue(char* area, char* key, char* defaultValue)
-{
-	char* valueString = NULL;
-	if (!pblCgiStrIsNullOrWhiteSpace(area))
-	{
-		char* areaKey = pblCgiSprintf("%s_%s", area, key);
-		valueString = pblCgiConfigValue(areaKey, NULL);
-		PBL_FREE(areaKey);
-	}
-	if (pblCgiStrIsNullOrWhiteSpace(valueString))
-	{
-		valueString = pblCgiConfigValue(key, defaultValue);
-	}
-	if (pblCgiStrIsNullOrWhiteSpace(valueString))
-	{
-		PBL_CGI_TRACE("No value for %s", key);
-	}
-	return valueString;
-}
+/*
+ArpoiseDirectoryBase.c - base for ARpoise Directory front end service.
+
+Copyright (C) 2018 , Tamiko Thiel and Peter Graf - All Rights Reserved
+
+ARpoise - Augmented Reality Point Of Interest Service
+
+This file is part of ARpoise.
+
+	ARpoise is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	ARpoise is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with ARpoise.  If not, see <https://www.gnu.org/licenses/>.
+
+For more information on
+
+Tamiko Thiel, see www.TamikoThiel.com/
+Peter Graf, see www.mission-base.com/peter/
+ARpoise, see www.ARpoise.com/
+
+$Log: ArpoiseDirectoryBase.c,v $
+Revision 1.16  2026/04/25 20:29:19  peter
+Updates after using Claude
+
+Revision 1.15  2023/08/28 20:30:43  peter
+Added handling of old asset bundles on arpoise.com
+
+Revision 1.14  2022/03/07 19:47:35  peter
+Improved handling of areas
+
+Revision 1.13  2022/03/05 19:48:15  peter
+Added handling of bundle position
+
+*/
+
+/*
+* Make sure "strings <exe> | grep Id | sort -u" shows the source file versions
+*/
+char* ArpoiseDirectoryBase_c_id = "$Id: ArpoiseDirectoryBase.c,v 1.16 2026/04/25 20:29:19 peter Exp $";
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <memory.h>
+
+#ifndef __APPLE__
+#include <malloc.h>
+#endif
+
+#include <assert.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <stdint.h>
+#include <time.h>
+
+#ifdef _WIN32
+
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <direct.h>
+#include <windows.h> 
+#include <process.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#define socket_close closesocket
+#define poll WSAPoll
+
+#else
+
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#endif
+
+#define socket_close close
+
+#endif
+
+#include "pblCgi.h"
+#include "ArpoiseDirectoryBase.h"
+
+char* ArvosApplicationName = "Arvos";
+char* ArpoiseApplicationName = "Arpoise";
+char* OperatingSystemAndroid = "Android";
+char* OperatingSystemiOS = "iOS";
+
+/*
+* The client applications with areas of their own and the position tables of a configuration
+*/
+#define ADB_CLIENT_ARVOS        0
+#define ADB_CLIENT_ARPOISE      1
+#define ADB_CLIENT_OTHER        2
+#define ADB_N_CLIENTS           3
+
+#define ADB_DEVICE_POSITION     0
+#define ADB_BUNDLE_POSITION     1
+#define ADB_DEEPLINK_POSITION   2
+#define ADB_N_POSITIONS         3
+
+static char* adbPositionKeys[ADB_N_POSITIONS] = { "DevicePosition", "BundlePosition", "DeeplinkPosition" };
+
+/*
+* A configuration of a process, read from a text configuration file or mapped from a snapshot of it.
+*
+* The area indexes and position tables of a text configuration are created by the first request
+* needing them, those of a snapshot are read with the snapshot.
+*/
+struct AdbConfig_s
+{
+	PblMap* map;
+	void* table;                /* The config table of the snapshot */
+	void* snapshot;
+	size_t snapshotSize;
+
+	struct AdbAreaIndex_s* areaIndexes[ADB_N_CLIENTS];
+	void* positionTables[ADB_N_POSITIONS];    /* See adbPositionTableNew */
+};
+
+/*
+* The configuration used by the current request of a thread
+*/
+static PBL_THREAD_LOCAL AdbConfig* adbConfig = NULL;
+
+/*
+* The path of the configuration file of the current request of a thread, see adbConfigGet
+*/
+static PBL_THREAD_LOCAL char* adbConfigPath = NULL;
+
+/*
+* The pointers to a configuration and its parts are replaced while requests read them, see adbConfigGet
+*/
+#ifdef __GNUC__
+#define ADB_ATOMIC_LOAD(ptr)                   __atomic_load_n(ptr, __ATOMIC_SEQ_CST)
+#define ADB_ATOMIC_STORE(ptr, value)           __atomic_store_n(ptr, value, __ATOMIC_SEQ_CST)
+#define ADB_ATOMIC_EXCHANGE(ptr, value)        __atomic_exchange_n(ptr, value, __ATOMIC_SEQ_CST)
+#define ADB_ATOMIC_CAS(ptr, expectedPtr, value) \
+	__atomic_compare_exchange_n(ptr, expectedPtr, value, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)
+#else
+#define ADB_ATOMIC_LOAD(ptr)                   (*(ptr))
+#define ADB_ATOMIC_STORE(ptr, value)           (*(ptr) = (value))
+#define ADB_ATOMIC_EXCHANGE(ptr, value)        adbExchange((void**)(ptr), value)
+#define ADB_ATOMIC_CAS(ptr, expectedPtr, value) \
+	(*(ptr) == *(expectedPtr) ? (*(ptr) = (value), 1) : (*(expectedPtr) = *(ptr), 0))
+
+/*
+* Without gcc or clang the configuration is not reloaded, see adbConfigWatch
+*/
+static void* adbExchange(void** ptr, void* value)
+{
+	void* oldValue = *ptr;
+	*ptr = value;
+	return oldValue;
+}
+#endif
+
+static AdbConfig* adbGetConfig(void)
+{
+	if (!adbConfig)
+	{
+		pblCgiExitOnError("adbGetConfig: The configuration was never read!\n");
+	}
+	return adbConfig;
+}
+
+static int adbClientIndex(char* clientApplication)
+{
+	if (pblCgiStrEquals(ArvosApplicationName, clientApplication))
+	{
+		return ADB_CLIENT_ARVOS;
+	}
+	if (pblCgiStrEquals(ArpoiseApplicationName, clientApplication))
+	{
+		return ADB_CLIENT_ARPOISE;
+	}
+	return ADB_CLIENT_OTHER;
+}
+
+static void* adbMalloc(char* tag, size_t size);
+
+/*
+* The current time in milliseconds
+*/
+static int64_t adbMilliseconds(void)
+{
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return (int64_t)now.tv_sec * 1000 + now.tv_usec / 1000;
+}
+
+/*
+* The deadline of the current request in milliseconds, RequestTimeout seconds, 20 by default, after
+* its start. All http requests made for a client request, including retries and fallbacks, end by then.
+*/
+static int64_t adbRequestDeadline(void)
+{
+	int64_t start = pblCgiStartTime.tv_sec ? (int64_t)pblCgiStartTime.tv_sec * 1000 + pblCgiStartTime.tv_usec / 1000 : adbMilliseconds();
+	return start + 1000 * (int64_t)atoi(pblCgiConfigValue("RequestTimeout", "20"));
+}
+
+/*
+ * Receive some bytes from a socket, returns the number of bytes received,
+ * 0 if the connection was closed by the peer, or -1 if the deadline passed.
+ */
+static int receiveBytesFromTcp(int socket, char* buffer, int bufferSize, int64_t deadline)
+{
+	char* tag = "receiveBytesFromTcp";
+
+	for (;;)
+	{
+		int64_t timeout = deadline - adbMilliseconds();
+		if (timeout <= 0)
+		{
+			return (-1);
+		}
+
+		struct pollfd pollFd;
+		pollFd.fd = socket;
+		pollFd.events = POLLIN;
+		pollFd.revents = 0;
+
+		errno = 0;
+		int rc = poll(&pollFd, 1, (int)timeout);
+		if (rc == 0)
+		{
+			continue;
+		}
+		if (rc < 0)
+		{
+			if (errno == EINTR)
+			{
+				pblCgiExitOnError("%s: poll(%d) EINTR error, errno %d\n", tag, socket, errno);
+			}
+			pblCgiExitOnError("%s: poll(%d) error, errno %d\n", tag, socket, errno);
+		}
+
+		errno = 0;
+		rc = recvfrom(socket, buffer, bufferSize, 0, NULL, NULL);
+		if (rc < 0)
+		{
+			if (errno == ECONNRESET)
+			{
+				return 0;
+			}
+			if (errno == EINTR)
+			{
+				pblCgiExitOnError("%s: recvfrom(%d) EINTR error, errno %d\n", tag, socket, errno);
+			}
+			pblCgiExitOnError("%s: recvfrom(%d) error, errno %d\n", tag, socket, errno);
+		}
+		return rc;
+	}
+}
+
+/*
+* The bytes of a http response received so far, always terminated by a 0 byte
+*/
+typedef struct AdbHttpBuffer_s
+{
+	char* data;
+	size_t length;
+	size_t capacity;
+} AdbHttpBuffer;
+
+/*
+* Receive the next bytes of a http response, returns the number of bytes received,
+* 0 if the connection was closed by the peer, or -1 if the deadline passed.
+*/
+static int adbHttpReceive(int socket, AdbHttpBuffer* buffer, int64_t deadline)
+{
+	static char* tag = "adbHttpReceive";
+
+	if (buffer->capacity - buffer->length < 4 * 1024)
+	{
+		size_t capacity = 2 * buffer->capacity;
+		char* data = adbMalloc(tag, capacity);
+		memcpy(data, buffer->data, buffer->length + 1);
+		PBL_FREE(buffer->data);
+		buffer->data = data;
+		buffer->capacity = capacity;
+	}
+
+	int rc = receiveBytesFromTcp(socket, buffer->data + buffer->length, buffer->capacity - buffer->length - 1, deadline);
+	if (rc > 0)
+	{
+		buffer->length += rc;
+		buffer->data[buffer->length] = '\0';
+	}
+	return rc;
+}
+
+/*
+* Return the value of a header of a http response, the name is compared case insensitive.
+*/
+static char* adbHttpHeaderValue(char* headers, char* name)
+{
+	size_t length = strlen(name);
+	for (char* line = strchr(headers, '\n'); line; line = strchr(line, '\n'))
+	{
+		line++;
+		size_t i = 0;
+		while (i < length && tolower((unsigned char)line[i]) == tolower((unsigned char)name[i]))
+		{
+			i++;
+		}
+		if (i == length && line[i] == ':')
+		{
+			char* value = line + i + 1;
+			while (*value == ' ' || *value == '\t')
+			{
+				value++;
+			}
+			return value;
+		}
+	}
+	return NULL;
+}
+
+/*
+* Check whether a header value starts with the given token, the token is compared case insensitive.
+*/
+static int adbHttpHeaderIs(char* value, char* token)
+{
+	if (!value)
+	{
+		return 0;
+	}
+	while (*token)
+	{
+		if (tolower((unsigned char)*value++) != tolower((unsigned char)*token++))
+		{
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/*
+* Decode the chunked body of a http response in place, the chunks start at the given offset.
+*
+* Returns 0 if the body was decoded, 1 if the connection was closed before the last chunk,
+* or -1 if the deadline passed.
+*/
+static int adbHttpDechunk(int socket, AdbHttpBuffer* buffer, size_t offset, int64_t deadline)
+{
+	static char* tag = "adbHttpDechunk";
+
+	size_t in = offset;
+	size_t out = offset;
+	int rc = 1;
+	for (;;)
+	{
+		char* lineEnd;
+		while (!(lineEnd = strstr(buffer->data + in, "\r\n")))
+		{
+			if ((rc = adbHttpReceive(socket, buffer, deadline)) <= 0)
+			{
+				break;
+			}
+		}
+		if (!lineEnd)
+		{
+			break;
+		}
+		if (!isxdigit((unsigned char)buffer->data[in]))
+		{
+			pblCgiExitOnError("%s: Illegal chunk size '%s'\n", tag, buffer->data + in);
+		}
+		size_t chunkSize = strtoul(buffer->data + in, NULL, 16);
+		size_t lineLength = lineEnd + 2 - (buffer->data + in);
+
+		if (chunkSize == 0)
+		{
+			// Skip the trailer, it ends with an empty line
+			in += lineLength - 2;
+			char* trailerEnd;
+			while (!(trailerEnd = strstr(buffer->data + in, "\r\n\r\n")))
+			{
+				if ((rc = adbHttpReceive(socket, buffer, deadline)) <= 0)
+				{
+					break;
+				}
+			}
+			if (!trailerEnd)
+			{
+				break;
+			}
+			in = trailerEnd + 4 - buffer->data;
+			rc = 0;
+			break;
+		}
+
+		while (buffer->length < in + lineLength + chunkSize + 2)
+		{
+			if ((rc = adbHttpReceive(socket, buffer, deadline)) <= 0)
+			{
+				break;
+			}
+		}
+		if (rc <= 0)
+		{
+			// Keep what was received of the chunk
+			size_t length = buffer->length - in > lineLength ? buffer->length - in - lineLength : 0;
+			memmove(buffer->data + out, buffer->data + in + lineLength, length < chunkSize ? length : chunkSize);
+			out += length < chunkSize ? length : chunkSize;
+			break;
+		}
+		memmove(buffer->data + out, buffer->data + in + lineLength, chunkSize);
+		out += chunkSize;
+		in += lineLength + chunkSize + 2;
+	}
+
+	if (rc == 0 && in != buffer->length)
+	{
+		// Bytes after the end of the response, the connection cannot be used again
+		rc = 1;
+	}
+	buffer->length = out;
+	buffer->data[out] = '\0';
+	return rc < 0 ? -1 : rc;
+}
+
+/*
+* Receive a http response and return it in a malloced buffer, a chunked body is decoded.
+*
+* Returns NULL if the deadline passed or if the connection was closed before any byte was
+* received, in the latter case closedPtr is set. keepAlivePtr is set if the connection can
+* be used for another request.
+*/
+static char* receiveHttpResponse(int socket, int64_t deadline, int* keepAlivePtr, int* closedPtr)
+{
+	static char* tag = "receiveHttpResponse";
+
+	*keepAlivePtr = 0;
+	*closedPtr = 0;
+
+	AdbHttpBuffer buffer;
+	buffer.capacity = 16 * 1024;
+	buffer.data = adbMalloc(tag, buffer.capacity);
+	buffer.data[0] = '\0';
+	buffer.length = 0;
+
+	int rc = 0;
+	char* headerEnd;
+	while (!(headerEnd = strstr(buffer.data, "\r\n\r\n")))
+	{
+		if ((rc = adbHttpReceive(socket, &buffer, deadline)) < 0)
+		{
+			// The deadline passed
+			PBL_FREE(buffer.data);
+			return NULL;
+		}
+		if (rc == 0)
+		{
+			if (buffer.length == 0)
+			{
+				PBL_FREE(buffer.data);
+				*closedPtr = 1;
+				return NULL;
+			}
+
+			// Not a complete http response, let the caller handle it
+			return buffer.data;
+		}
+	}
+
+	size_t headerLength = headerEnd + 4 - buffer.data;
+	char* headers = pblCgiStrRangeDup(buffer.data, buffer.data + headerLength);
+
+	int status = 0;
+	int keepAlive = 0;
+	char* ptr = strchr(headers, ' ');
+	if (ptr)
+	{
+		status = atoi(ptr + 1);
+	}
+	char* connection = adbHttpHeaderValue(headers, "Connection");
+	if (!strncmp(headers, "HTTP/1.1", 8))
+	{
+		keepAlive = !adbHttpHeaderIs(connection, "close");
+	}
+	else
+	{
+		keepAlive = adbHttpHeaderIs(connection, "keep-alive");
+	}
+
+	char* contentLength = adbHttpHeaderValue(headers, "Content-Length");
+	if (status == 204 || status == 304 || (status >= 100 && status < 200))
+	{
+		rc = buffer.length == headerLength ? 0 : 1;
+	}
+	else if (adbHttpHeaderIs(adbHttpHeaderValue(headers, "Transfer-Encoding"), "chunked"))
+	{
+		rc = adbHttpDechunk(socket, &buffer, headerLength, deadline);
+	}
+	else if (contentLength)
+	{
+		size_t length = headerLength + strtoul(contentLength, NULL, 10);
+		while (buffer.length < length && (rc = adbHttpReceive(socket, &buffer, deadline)) > 0)
+		{
+		}
+		rc = buffer.length == length ? 0 : (buffer.length < length && rc < 0 ? -1 : 1);
+	}
+	else
+	{
+		// The body ends when the connection is closed
+		while ((rc = adbHttpReceive(socket, &buffer, deadline)) > 0)
+		{
+		}
+		rc = rc < 0 ? -1 : 1;
+	}
+	PBL_FREE(headers);
+
+	if (rc < 0)
+	{
+		// The deadline passed
+		PBL_FREE(buffer.data);
+		return NULL;
+	}
+	*keepAlivePtr = keepAlive && rc == 0;
+	return buffer.data;
+}
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#ifndef MSG_DONTWAIT
+#define MSG_DONTWAIT 0
+#endif
+
+/*
+* Send some bytes to a tcp socket, returns -1 if the connection failed or the deadline passed
+*/
+static int sendBytesToTcp(int socket, char* buffer, int nBytesToSend, int64_t deadline)
+{
+	static char* tag = "sendBytesToTcp";
+
+	char* ptr = buffer;
+	while (nBytesToSend > 0)
+	{
+		int64_t timeout = deadline - adbMilliseconds();
+		if (timeout <= 0)
+		{
+			PBL_CGI_TRACE("%s: send(%d) deadline passed", tag, socket);
+			return -1;
+		}
+
+		struct pollfd pollFd;
+		pollFd.fd = socket;
+		pollFd.events = POLLOUT;
+		pollFd.revents = 0;
+
+		errno = 0;
+		int rc = poll(&pollFd, 1, (int)timeout);
+		if (rc < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if (rc < 0)
+		{
+			PBL_CGI_TRACE("%s: poll(%d) error, errno %d", tag, socket, errno);
+			return -1;
+		}
+		if (rc == 0)
+		{
+			continue;
+		}
+
+		errno = 0;
+		rc = send(socket, ptr, nBytesToSend, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (rc > 0)
+		{
+			ptr += rc;
+			nBytesToSend -= rc;
+		}
+		else if (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK)
+		{
+			PBL_CGI_TRACE("%s: send(%d) error, rc %d, errno %d", tag, socket, rc, errno);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/*
+* The socket of the current http request of a thread, a request ending with an error
+* in a persistent process leaves it open, it is closed by the next request of the thread.
+*/
+static PBL_THREAD_LOCAL int adbSocket = -1;
+
+/*
+* The socket of the hedge of the current http request of a thread, see adbHttpAttempt
+*/
+static PBL_THREAD_LOCAL int adbHedgeSocket = -1;
+
+/*
+* The requests sent ahead by the current request of a thread, see adbHttpPrefetch
+*/
+#define ADB_MAX_PREFETCHES 4
+
+typedef struct AdbPrefetch_s
+{
+	char* hostname;
+	int port;
+	char* uri;
+	int socket;
+	int reused;
+	int64_t start;
+} AdbPrefetch;
+
+static PBL_THREAD_LOCAL AdbPrefetch adbPrefetches[ADB_MAX_PREFETCHES];
+static PBL_THREAD_LOCAL int adbNPrefetches = 0;
+
+/*
+* The idle keep-alive connections of a process to the hosts of its http requests,
+* they are shared by the threads of the process, see adbGetHttpResponse.
+*/
+#define ADB_MAX_IDLE_CONNECTIONS 32
+
+typedef struct AdbConnection_s
+{
+	char hostname[256];
+	int port;
+	int socket;
+	time_t idleSince;
+} AdbConnection;
+
+static AdbConnection adbIdleConnections[ADB_MAX_IDLE_CONNECTIONS];
+static int adbNIdleConnections = 0;
+static PblCgiMutex adbConnectionMutex = PBL_CGI_MUTEX_INITIALIZER;
+
+/*
+* Take an idle connection to hostname and port, returns -1 if there is none.
+*
+* Connections idle for keepAliveSeconds or longer are closed, so are connections the peer has closed.
+*/
+static int adbConnectionTake(char* hostname, int port, int keepAliveSeconds)
+{
+	for (;;)
+	{
+		int socketFd = -1;
+		time_t now = time(NULL);
+
+		pblCgiMutexLock(&adbConnectionMutex);
+		for (int i = adbNIdleConnections - 1; i >= 0; i--)
+		{
+			AdbConnection* connection = &adbIdleConnections[i];
+			if (now - connection->idleSince < keepAliveSeconds)
+			{
+				if (socketFd >= 0 || connection->port != port || strcmp(connection->hostname, hostname))
+				{
+					continue;
+				}
+				socketFd = connection->socket;
+			}
+			else
+			{
+				socket_close(connection->socket);
+			}
+			*connection = adbIdleConnections[--adbNIdleConnections];
+		}
+		pblCgiMutexUnlock(&adbConnectionMutex);
+
+		if (socketFd < 0)
+		{
+			return -1;
+		}
+
+		// An idle connection is readable only if the peer closed it
+		struct pollfd pollFd;
+		pollFd.fd = socketFd;
+		pollFd.events = POLLIN;
+		pollFd.revents = 0;
+		if (poll(&pollFd, 1, 0) == 0)
+		{
+			return socketFd;
+		}
+		socket_close(socketFd);
+	}
+}
+
+/*
+* Keep a connection to hostname and port for the next request, or close it if there are too many.
+*/
+static void adbConnectionPut(char* hostname, int port, int socketFd)
+{
+	if (strlen(hostname) < sizeof(adbIdleConnections[0].hostname))
+	{
+		pblCgiMutexLock(&adbConnectionMutex);
+		if (adbNIdleConnections < ADB_MAX_IDLE_CONNECTIONS)
+		{
+			AdbConnection* connection = &adbIdleConnections[adbNIdleConnections++];
+			strcpy(connection->hostname, hostname);
+			connection->port = port;
+			connection->socket = socketFd;
+			connection->idleSince = time(NULL);
+			socketFd = -1;
+		}
+		pblCgiMutexUnlock(&adbConnectionMutex);
+	}
+	if (socketFd >= 0)
+	{
+		socket_close(socketFd);
+	}
+}
+
+/*
+* Lock a table shared by the threads of the process and, if it is mapped from a file, by other processes
+*/
+static void adbSharedLock(PblCgiMutex* mutex, int fd)
+{
+	pblCgiMutexLock(mutex);
+#ifndef _WIN32
+	if (fd >= 0)
+	{
+		struct flock lock;
+		memset(&lock, 0, sizeof(lock));
+		lock.l_type = F_WRLCK;
+		lock.l_whence = SEEK_SET;
+		while (fcntl(fd, F_SETLKW, &lock) < 0 && errno == EINTR)
+		{
+		}
+	}
+#endif
+}
+
+static void adbSharedUnlock(PblCgiMutex* mutex, int fd)
+{
+#ifndef _WIN32
+	if (fd >= 0)
+	{
+		struct flock lock;
+		memset(&lock, 0, sizeof(lock));
+		lock.l_type = F_UNLCK;
+		lock.l_whence = SEEK_SET;
+		fcntl(fd, F_SETLK, &lock);
+	}
+#endif
+	pblCgiMutexUnlock(mutex);
+}
+
+/*
+* Map a table of the given size from the file given by a configuration value, so it is shared by all
+* processes mapping the file, NULL if no file is given or it cannot be mapped, called once per process
+*/
+static void* adbSharedMap(char* key, size_t size, int* fdPtr)
+{
+#ifndef _WIN32
+	char* path = pblCgiConfigValue(key, "");
+	if (!pblCgiStrIsNullOrWhiteSpace(path))
+	{
+		int fd = open(path, O_RDWR | O_CREAT, 0644);
+		if (fd >= 0)
+		{
+			struct flock lock;
+			memset(&lock, 0, sizeof(lock));
+			lock.l_type = F_WRLCK;
+			lock.l_whence = SEEK_SET;
+			fcntl(fd, F_SETLKW, &lock);
+
+			struct stat fileStat;
+			int ok = !fstat(fd, &fileStat) && ((size_t)fileStat.st_size == size || !ftruncate(fd, size));
+
+			lock.l_type = F_UNLCK;
+			fcntl(fd, F_SETLKW, &lock);
+
+			void* table = ok ? mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+			if (table != MAP_FAILED)
+			{
+				*fdPtr = fd;
+				return table;
+			}
+			close(fd);
+		}
+		PBL_CGI_TRACE("Cannot map %s %s, errno %d", key, path, errno);
+	}
+#endif
+	return NULL;
+}
+
+/*
+* The addresses of the hosts of the http requests of a process, resolved by getaddrinfo.
+*
+* An entry is used for DnsCacheTimeout seconds, 60 by default, a host that could not be resolved
+* is not looked up again for DnsNegativeCacheTimeout seconds, 5 by default. The entries have no
+* pointers, so if DnsCacheFile is set they are kept in that file and shared by all processes
+* mapping it, e.g. by the cgi-bin processes, otherwise they are shared by the threads of a process.
+*/
+#define ADB_DNS_MAX_ADDRESSES 4
+#define ADB_DNS_CACHE_SIZE    64
+
+typedef struct AdbAddress_s
+{
+	socklen_t length;
+	struct sockaddr_storage address;
+} AdbAddress;
+
+typedef struct AdbDnsEntry_s
+{
+	char hostname[256];
+	int64_t expires;
+	int error;                  /* The getaddrinfo error of a negative entry */
+	int nAddresses;
+	AdbAddress addresses[ADB_DNS_MAX_ADDRESSES];
+} AdbDnsEntry;
+
+static AdbDnsEntry adbDnsProcessEntries[ADB_DNS_CACHE_SIZE];
+static AdbDnsEntry* adbDnsEntries = NULL;
+static int adbDnsFd = -1;
+static PblCgiMutex adbDnsMutex = PBL_CGI_MUTEX_INITIALIZER;
+
+/*
+* Resolve hostname, returns the number of addresses copied to the given array, 0 if it cannot be resolved
+*/
+static int adbResolve(char* hostname, AdbAddress* addresses)
+{
+	static char* tag = "adbResolve";
+
+	int64_t now = time(NULL);
+	int nAddresses = 0;
+	int error = 0;
+	int found = 0;
+
+	if (strlen(hostname) < sizeof(adbDnsProcessEntries[0].hostname))
+	{
+		if (!adbDnsEntries)
+		{
+			pblCgiMutexLock(&adbDnsMutex);
+			if (!adbDnsEntries)
+			{
+				AdbDnsEntry* entries = adbSharedMap("DnsCacheFile", sizeof(adbDnsProcessEntries), &adbDnsFd);
+				adbDnsEntries = entries ? entries : adbDnsProcessEntries;
+			}
+			pblCgiMutexUnlock(&adbDnsMutex);
+		}
+
+		adbSharedLock(&adbDnsMutex, adbDnsFd);
+		for (int i = 0; i < ADB_DNS_CACHE_SIZE; i++)
+		{
+			AdbDnsEntry* entry = &adbDnsEntries[i];
+			if (entry->expires > now && !strcmp(entry->hostname, hostname))
+			{
+				found = 1;
+				error = entry->error;
+				nAddresses = entry->nAddresses;
+				memcpy(addresses, entry->addresses, nAddresses * sizeof(AdbAddress));
+				break;
+			}
+		}
+		adbSharedUnlock(&adbDnsMutex, adbDnsFd);
+	}
+
+	if (!found)
+	{
+		struct addrinfo hints;
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		hints.ai_flags = AI_ADDRCONFIG;
+
+		struct addrinfo* result = NULL;
+		error = getaddrinfo(hostname, NULL, &hints, &result);
+		if (!error)
+		{
+			// Take up to half of the addresses from each family first, so IPv4 is tried even if
+			// getaddrinfo lists more IPv6 addresses than are kept, then fill up in the given order
+			for (int pass = 0; pass < 2; pass++)
+			{
+				int nFamily[2] = { 0, 0 };
+				for (struct addrinfo* info = result; info && nAddresses < ADB_DNS_MAX_ADDRESSES; info = info->ai_next)
+				{
+					if (info->ai_addrlen > sizeof(struct sockaddr_storage))
+					{
+						continue;
+					}
+					int isFirstHalf = nFamily[info->ai_family == AF_INET6]++ < ADB_DNS_MAX_ADDRESSES / 2;
+					if (isFirstHalf == (pass == 0))
+					{
+						addresses[nAddresses].length = info->ai_addrlen;
+						memcpy(&addresses[nAddresses].address, info->ai_addr, info->ai_addrlen);
+						nAddresses++;
+					}
+				}
+			}
+			freeaddrinfo(result);
+		}
+		PBL_CGI_TRACE("Resolved %s, error %d, %d addresses", hostname, error, nAddresses);
+
+		if (strlen(hostname) < sizeof(adbDnsProcessEntries[0].hostname))
+		{
+			int timeout = error
+				? atoi(pblCgiConfigValue("DnsNegativeCacheTimeout", "5"))
+				: atoi(pblCgiConfigValue("DnsCacheTimeout", "60"));
+
+			adbSharedLock(&adbDnsMutex, adbDnsFd);
+
+			// Use the entry of the host or the one expiring first
+			AdbDnsEntry* entry = &adbDnsEntries[0];
+			for (int i = 0; i < ADB_DNS_CACHE_SIZE; i++)
+			{
+				if (!strcmp(adbDnsEntries[i].hostname, hostname))
+				{
+					entry = &adbDnsEntries[i];
+					break;
+				}
+				if (adbDnsEntries[i].expires < entry->expires)
+				{
+					entry = &adbDnsEntries[i];
+				}
+			}
+			strcpy(entry->hostname, hostname);
+			entry->expires = now + timeout;
+			entry->error = error;
+			entry->nAddresses = nAddresses;
+			memcpy(entry->addresses, addresses, nAddresses * sizeof(AdbAddress));
+
+			adbSharedUnlock(&adbDnsMutex, adbDnsFd);
+		}
+	}
+
+	if (error || nAddresses < 1)
+	{
+		PBL_CGI_TRACE("%s: getaddrinfo(%s) error, %s", tag, hostname, error ? gai_strerror(error) : "no address");
+		return 0;
+	}
+	return nAddresses;
+}
+
+static void adbSetNonBlocking(int socketFd, int nonBlocking)
+{
+#ifdef _WIN32
+	u_long mode = nonBlocking;
+	ioctlsocket(socketFd, FIONBIO, &mode);
+#else
+	int flags = fcntl(socketFd, F_GETFL, 0);
+	fcntl(socketFd, F_SETFL, nonBlocking ? flags | O_NONBLOCK : flags & ~O_NONBLOCK);
+#endif
+}
+
+/*
+* The delay before the connection attempt to the next address of a host is started, see RFC 8305
+*/
+#define ADB_CONNECT_ATTEMPT_DELAY 250
+
+/*
+* Connect to a tcp socket on machine with hostname and port
+*
+* The addresses of the host are tried alternating between IPv6 and IPv4, an attempt to the next
+* address starts when the previous one failed or did not succeed within ADB_CONNECT_ATTEMPT_DELAY
+* milliseconds, the first connection established is used. All attempts end after HttpConnectTimeout
+* milliseconds, 3000 by default, or at the given deadline if that is earlier, -1 is returned if the
+* host cannot be resolved or no connection was established.
+*
+* If watchFd is not negative, the attempts also end when that socket becomes readable, -1 is returned.
+*/
+static int connectToTcp(char* hostname, int port, int64_t deadline, int watchFd)
+{
+	static char* tag = "connectToTcp";
+
+	short shortPort = 80;
+	if (port > 0)
+	{
+		shortPort = port;
+	}
+
+	AdbAddress resolved[ADB_DNS_MAX_ADDRESSES];
+	int nAddresses = adbResolve(hostname, resolved);
+	if (nAddresses < 1)
+	{
+		return -1;
+	}
+
+	// Alternate the address families, starting with the family of the first address
+	AdbAddress addresses[ADB_DNS_MAX_ADDRESSES];
+	int family = resolved[0].address.ss_family;
+	for (int i = 0, taken = 0; i < nAddresses; i++)
+	{
+		int j = 0;
+		while (j < nAddresses && ((taken & (1 << j)) || resolved[j].address.ss_family != family))
+		{
+			j++;
+		}
+		if (j == nAddresses)
+		{
+			j = 0;
+			while (taken & (1 << j))
+			{
+				j++;
+			}
+		}
+		taken |= 1 << j;
+		addresses[i] = resolved[j];
+		family = addresses[i].address.ss_family == AF_INET6 ? AF_INET : AF_INET6;
+	}
+
+	int64_t now = adbMilliseconds();
+	int64_t connectDeadline = now + atoi(pblCgiConfigValue("HttpConnectTimeout", "3000"));
+	if (deadline > connectDeadline)
+	{
+		deadline = connectDeadline;
+	}
+	int64_t nextAttempt = now;
+
+	struct pollfd attempts[ADB_DNS_MAX_ADDRESSES + 1];
+	int nAttempts = 0;
+	int next = 0;
+	int socketFd = -1;
+	int connectErrno = ETIMEDOUT;
+
+	while (socketFd < 0 && now < deadline)
+	{
+		if (next < nAddresses && (now >= nextAttempt || nAttempts == 0))
+		{
+			struct sockaddr* address = (struct sockaddr*)&addresses[next].address;
+			if (address->sa_family == AF_INET6)
+			{
+				((struct sockaddr_in6*)address)->sin6_port = htons(shortPort);
+			}
+			else
+			{
+				((struct sockaddr_in*)address)->sin_port = htons(shortPort);
+			}
+
+			errno = 0;
+			int attemptFd = socket(address->sa_family, SOCK_STREAM, 0);
+			if (attemptFd < 0)
+			{
+				connectErrno = errno;
+			}
+			else
+			{
+				adbSetNonBlocking(attemptFd, 1);
+
+				errno = 0;
+				if (connect(attemptFd, address, addresses[next].length) == 0)
+				{
+					socketFd = attemptFd;
+				}
+				else if (errno == EINPROGRESS || errno == EWOULDBLOCK)
+				{
+					attempts[nAttempts].fd = attemptFd;
+					attempts[nAttempts].events = POLLOUT;
+					attempts[nAttempts++].revents = 0;
+				}
+				else
+				{
+					connectErrno = errno;
+					socket_close(attemptFd);
+				}
+			}
+			next++;
+			nextAttempt = now + ADB_CONNECT_ATTEMPT_DELAY;
+			continue;
+		}
+		if (nAttempts == 0)
+		{
+			break;
+		}
+
+		int64_t until = next < nAddresses && nextAttempt < deadline ? nextAttempt : deadline;
+		int nPollFds = nAttempts;
+		if (watchFd >= 0)
+		{
+			attempts[nPollFds].fd = watchFd;
+			attempts[nPollFds].events = POLLIN;
+			attempts[nPollFds++].revents = 0;
+		}
+		errno = 0;
+		int rc = poll(attempts, nPollFds, (int)(until - now));
+		if (rc < 0)
+		{
+			pblCgiExitOnError("%s: poll() error, errno %d\n", tag, errno);
+		}
+		if (watchFd >= 0 && attempts[nAttempts].revents)
+		{
+			connectErrno = 0;
+			break;
+		}
+		for (int i = nAttempts - 1; i >= 0 && rc > 0; i--)
+		{
+			if (!attempts[i].revents)
+			{
+				continue;
+			}
+
+			int socketError = 0;
+			socklen_t optlen = sizeof(socketError);
+			if (getsockopt(attempts[i].fd, SOL_SOCKET, SO_ERROR, (char*)&socketError, &optlen))
+			{
+				socketError = errno;
+			}
+			if (!socketError && socketFd < 0)
+			{
+				socketFd = attempts[i].fd;
+			}
+			else
+			{
+				connectErrno = socketError;
+				socket_close(attempts[i].fd);
+
+				// Start the next attempt right away
+				nextAttempt = now;
+			}
+			attempts[i] = attempts[--nAttempts];
+		}
+		now = adbMilliseconds();
+	}
+
+	for (int i = 0; i < nAttempts; i++)
+	{
+		socket_close(attempts[i].fd);
+	}
+	if (socketFd < 0)
+	{
+		if (connectErrno)
+		{
+			PBL_CGI_TRACE("%s: connect error, host '%s' on port %d, errno %d", tag, hostname, shortPort, connectErrno);
+		}
+		return -1;
+	}
+
+	adbSetNonBlocking(socketFd, 0);
+	return socketFd;
+}
+
+/*
+* The area of the current request of a thread, see adbGetAreaConfig, it is reset by adbConfigUse
+*/
+static PBL_THREAD_LOCAL AdbAreaConfig* adbRequestArea = NULL;
+
+/*
+* The retries of a process are limited by a token bucket. Every request adds HttpRetryBudget percent
+* of a token, 10 by default, every retry takes a whole token, the bucket holds up to ADB_RETRY_TOKENS
+* tokens. While an upstream host fails, retries are so limited to a small fraction of the requests.
+*/
+#define ADB_RETRY_TOKENS 10.0
+
+static double adbRetryTokens = ADB_RETRY_TOKENS;
+static PblCgiMutex adbRetryMutex = PBL_CGI_MUTEX_INITIALIZER;
+
+static void adbRetryDeposit(void)
+{
+	double deposit = atof(pblCgiConfigValue("HttpRetryBudget", "10")) / 100.0;
+
+	pblCgiMutexLock(&adbRetryMutex);
+	adbRetryTokens += deposit;
+	if (adbRetryTokens > ADB_RETRY_TOKENS)
+	{
+		adbRetryTokens = ADB_RETRY_TOKENS;
+	}
+	pblCgiMutexUnlock(&adbRetryMutex);
+}
+
+static int adbRetryWithdraw(void)
+{
+	int withdrawn = 0;
+
+	pblCgiMutexLock(&adbRetryMutex);
+	if (adbRetryTokens >= 1.0)
+	{
+		adbRetryTokens -= 1.0;
+		withdrawn = 1;
+	}
+	pblCgiMutexUnlock(&adbRetryMutex);
+	return withdrawn;
+}
+
+/*
+* A random number for the jitter of the retry delays, each thread has its own xorshift state
+*/
+static PBL_THREAD_LOCAL uint32_t adbRandomState = 0;
+
+static uint32_t adbRandom(void)
+{
+	uint32_t x = adbRandomState;
+	if (!x)
+	{
+		x = (uint32_t)adbMilliseconds() ^ ((uint32_t)getpid() << 16) ^ (uint32_t)(uintptr_t)&adbRandomState;
+		if (!x)
+		{
+			x = 1;
+		}
+	}
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return adbRandomState = x;
+}
+
+static void adbSleep(int milliseconds)
+{
+#ifdef _WIN32
+	Sleep(milliseconds);
+#else
+	struct timespec delay;
+	delay.tv_sec = milliseconds / 1000;
+	delay.tv_nsec = (milliseconds % 1000) * 1000000L;
+	while (nanosleep(&delay, &delay) < 0 && errno == EINTR)
+	{
+	}
+#endif
+}
+
+/*
+* The hosts of the http requests of a process, with their circuit breakers and latencies.
+*
+* Circuit breakers:
+*
+* After CircuitBreakerFailures failed attempts in a row, 5 by default, 0 turns the breakers off, the circuit
+* of a host opens for CircuitBreakerOpenTime seconds, 30 by default. An attempt fails if the host cannot be
+* connected, does not answer, answers with a server error or takes longer than CircuitBreakerSlowCall
+* milliseconds, 8000 by default. While the circuit is open, requests to the host fail at once and the
+* requests in the area of the host use the values given without area prefix, see adbGetAreaConfig.
+* Then a single request is let through as a probe, its result closes or opens the circuit again.
+*
+* Latencies:
+* The durations of the answered attempts to a host are counted in a histogram with four buckets per
+* power of two milliseconds. The counts are halved once ADB_LATENCY_SAMPLES attempts are counted,
+* so the histogram follows the recent latencies of the host, see adbLatencyPercentile.
+*/
+#define ADB_MAX_HOSTS 32
+#define ADB_LATENCY_BUCKETS 64
+#define ADB_LATENCY_SAMPLES 1000
+#define ADB_LATENCY_MIN_SAMPLES 20
+
+typedef struct AdbHost_s
+{
+	char hostname[256];
+	int port;
+	int failures;           /* The number of failed attempts in a row */
+	int64_t openUntil;      /* 0 while the circuit is closed */
+	int64_t probeStart;     /* The start of the probe of a half open circuit, 0 if there is none */
+	int nLatencies;         /* The number of attempts counted in the latency histogram */
+	int latencies[ADB_LATENCY_BUCKETS];
+} AdbHost;
+
+static AdbHost adbHosts[ADB_MAX_HOSTS];
+static int adbNHosts = 0;
+static PblCgiMutex adbHostMutex = PBL_CGI_MUTEX_INITIALIZER;
+
+/*
+* Find a host, called with adbHostMutex held
+*/
+static AdbHost* adbHostFind(char* hostname, int port, int create)
+{
+	for (int i = 0; i < adbNHosts; i++)
+	{
+		if (adbHosts[i].port == port && !strcmp(adbHosts[i].hostname, hostname))
+		{
+			return &adbHosts[i];
+		}
+	}
+	if (!create || strlen(hostname) >= sizeof(adbHosts[0].hostname))
+	{
+		return NULL;
+	}
+
+	AdbHost* host = NULL;
+	if (adbNHosts < ADB_MAX_HOSTS)
+	{
+		host = &adbHosts[adbNHosts++];
+	}
+	else
+	{
+		// Replace a host with a closed circuit without failures
+		for (int i = 0; i < adbNHosts && !host; i++)
+		{
+			if (!adbHosts[i].openUntil && !adbHosts[i].failures)
+			{
+				host = &adbHosts[i];
+			}
+		}
+	}
+	if (host)
+	{
+		memset(host, 0, sizeof(AdbHost));
+		strcpy(host->hostname, hostname);
+		host->port = port;
+	}
+	return host;
+}
+
+/*
+* Check whether the circuit of a host is open and no request may use it
+*/
+static int adbCircuitIsOpen(char* hostname, int port)
+{
+	int64_t now = adbMilliseconds();
+	int64_t openTime = 1000 * (int64_t)atoi(pblCgiConfigValue("CircuitBreakerOpenTime", "30"));
+	int isOpen = 0;
+
+	pblCgiMutexLock(&adbHostMutex);
+	AdbHost* circuit = adbHostFind(hostname, port, 0);
+	if (circuit && circuit->openUntil)
+	{
+		isOpen = now < circuit->openUntil || now < circuit->probeStart + openTime;
+	}
+	pblCgiMutexUnlock(&adbHostMutex);
+	return isOpen;
+}
+
+/*
+* Check whether an attempt to a host may be made, the first attempt after the open time is the probe
+*/
+static int adbCircuitAcquire(char* hostname, int port)
+{
+	int64_t now = adbMilliseconds();
+	int64_t openTime = 1000 * (int64_t)atoi(pblCgiConfigValue("CircuitBreakerOpenTime", "30"));
+	int acquired = 1;
+
+	pblCgiMutexLock(&adbHostMutex);
+	AdbHost* circuit = adbHostFind(hostname, port, 0);
+	if (circuit && circuit->openUntil)
+	{
+		if (now < circuit->openUntil || now < circuit->probeStart + openTime)
+		{
+			acquired = 0;
+		}
+		else
+		{
+			circuit->probeStart = now;
+			PBL_CGI_TRACE("Circuit of %s:%d is half open, probing", hostname, port);
+		}
+	}
+	pblCgiMutexUnlock(&adbHostMutex);
+	return acquired;
+}
+
+/*
+* Record the result of an attempt to a host
+*/
+static void adbCircuitRecord(char* hostname, int port, int success)
+{
+	int maxFailures = atoi(pblCgiConfigValue("CircuitBreakerFailures", "5"));
+	if (maxFailures < 1)
+	{
+		return;
+	}
+	int64_t now = adbMilliseconds();
+	int64_t openTime = 1000 * (int64_t)atoi(pblCgiConfigValue("CircuitBreakerOpenTime", "30"));
+
+	pblCgiMutexLock(&adbHostMutex);
+	AdbHost* circuit = adbHostFind(hostname, port, !success);
+	if (circuit)
+	{
+		if (success)
+		{
+			if (circuit->openUntil)
+			{
+				PBL_CGI_TRACE("Circuit of %s:%d is closed", hostname, port);
+			}
+			circuit->failures = 0;
+			circuit->openUntil = 0;
+			circuit->probeStart = 0;
+		}
+		else if (++circuit->failures >= maxFailures || circuit->probeStart)
+		{
+			PBL_CGI_TRACE("Circuit of %s:%d is open, %d failures", hostname, port, circuit->failures);
+			circuit->openUntil = now + openTime;
+			circuit->probeStart = 0;
+		}
+	}
+	pblCgiMutexUnlock(&adbHostMutex);
+}
+
+/*
+* The bucket of a latency, the values below 8 milliseconds have a bucket each,
+* above the three highest bits of the value select the bucket
+*/
+static int adbLatencyBucket(int milliseconds)
+{
+	if (milliseconds < 8)
+	{
+		return milliseconds < 0 ? 0 : milliseconds;
+	}
+	int shift = 0;
+	while ((milliseconds >> shift) > 7)
+	{
+		shift++;
+	}
+	int bucket = 4 * shift + (milliseconds >> shift);
+	return bucket < ADB_LATENCY_BUCKETS ? bucket : ADB_LATENCY_BUCKETS - 1;
+}
+
+/*
+* The highest latency of a bucket
+*/
+static int adbLatencyBucketLimit(int bucket)
+{
+	if (bucket < 8)
+	{
+		return bucket;
+	}
+	int shift = bucket / 4 - 1;
+	return ((bucket % 4 + 5) << shift) - 1;
+}
+
+/*
+* Record the latency of an answered attempt to a host
+*/
+static void adbLatencyRecord(char* hostname, int port, int milliseconds)
+{
+	pblCgiMutexLock(&adbHostMutex);
+	AdbHost* host = adbHostFind(hostname, port, 1);
+	if (host)
+	{
+		if (++host->nLatencies > ADB_LATENCY_SAMPLES)
+		{
+			host->nLatencies = 0;
+			for (int i = 0; i < ADB_LATENCY_BUCKETS; i++)
+			{
+				host->nLatencies += host->latencies[i] /= 2;
+			}
+			host->nLatencies++;
+		}
+		host->latencies[adbLatencyBucket(milliseconds)]++;
+	}
+	pblCgiMutexUnlock(&adbHostMutex);
+}
+
+/*
+* The latency in milliseconds the given percentage of the recent attempts to a host were answered in,
+* -1 if fewer than ADB_LATENCY_MIN_SAMPLES attempts were answered
+*/
+static int adbLatencyPercentile(char* hostname, int port, int percentile)
+{
+	int latency = -1;
+
+	pblCgiMutexLock(&adbHostMutex);
+	AdbHost* host = adbHostFind(hostname, port, 0);
+	if (host && host->nLatencies >= ADB_LATENCY_MIN_SAMPLES)
+	{
+		int64_t count = 0;
+		for (int i = 0; i < ADB_LATENCY_BUCKETS && latency < 0; i++)
+		{
+			count += host->latencies[i];
+			if (100 * count >= (int64_t)percentile * host->nLatencies)
+			{
+				latency = adbLatencyBucketLimit(i);
+			}
+		}
+	}
+	pblCgiMutexUnlock(&adbHostMutex);
+	return latency;
+}
+
+/*
+* Wait until one of the sockets is readable and return its index, -1 if the deadline passed
+*/
+static int adbWaitReadable(int* sockets, int nSockets, int64_t deadline)
+{
+	char* tag = "adbWaitReadable";
+	struct pollfd pollFds[2];
+
+	for (;;)
+	{
+		int64_t timeout = deadline - adbMilliseconds();
+		if (timeout <= 0)
+		{
+			return -1;
+		}
+
+		for (int i = 0; i < nSockets; i++)
+		{
+			pollFds[i].fd = sockets[i];
+			pollFds[i].events = POLLIN;
+			pollFds[i].revents = 0;
+		}
+
+		errno = 0;
+		int rc = poll(pollFds, nSockets, (int)timeout);
+		if (rc < 0)
+		{
+			pblCgiExitOnError("%s: poll() error, errno %d\n", tag, errno);
+		}
+		for (int i = 0; i < nSockets && rc > 0; i++)
+		{
+			if (pollFds[i].revents)
+			{
+				return i;
+			}
+		}
+	}
+}
+
+/*
+* Send a request on a kept or new connection by the deadline, -1 if it cannot be sent.
+* A new connection is given up when watchFd becomes readable, see connectToTcp.
+*/
+static int adbHttpSend(char* hostname, int port, char* sendBuffer, int64_t deadline, int keepAliveSeconds, int* reusedPtr, int watchFd)
+{
+	for (;;)
+	{
+		int socketFd = keepAliveSeconds > 0 ? adbConnectionTake(hostname, port, keepAliveSeconds) : -1;
+		*reusedPtr = socketFd >= 0;
+		if (socketFd < 0 && (socketFd = connectToTcp(hostname, port, deadline, watchFd)) < 0)
+		{
+			return -1;
+		}
+		if (!sendBytesToTcp(socketFd, sendBuffer, strlen(sendBuffer), deadline))
+		{
+			return socketFd;
+		}
+		socket_close(socketFd);
+		if (!*reusedPtr)
+		{
+			return -1;
+		}
+	}
+}
+
+/*
+* Send a request on a kept or new connection and receive the response, NULL if the host cannot
+* be connected, closes the new connection without an answer or if the deadline passed.
+*
+* If hedgeDelay is not negative and the request is not answered after hedgeDelay milliseconds,
+* the request is sent a second time on another connection, the first of the two to answer is used.
+* While the hedge connects, an answer to the request is not delayed. If the connection answering
+* first is closed without an answer, the other one is used.
+*/
+static char* adbHttpAttempt(char* hostname, int port, char* sendBuffer, int64_t deadline, int keepAliveSeconds, int hedgeDelay)
+{
+	for (;;)
+	{
+		if (adbSocket >= 0)
+		{
+			socket_close(adbSocket);
+			adbSocket = -1;
+		}
+		if (adbHedgeSocket >= 0)
+		{
+			socket_close(adbHedgeSocket);
+			adbHedgeSocket = -1;
+		}
+
+		int reused = 0;
+		int socketFd = adbHttpSend(hostname, port, sendBuffer, deadline, keepAliveSeconds, &reused, -1);
+		if (socketFd < 0)
+		{
+			return NULL;
+		}
+		adbSocket = socketFd;
+
+		int hedgeReused = 0;
+		int64_t hedgeTime = adbMilliseconds() + hedgeDelay;
+		if (hedgeDelay >= 0 && hedgeTime < deadline && adbWaitReadable(&socketFd, 1, hedgeTime) < 0 && adbRetryWithdraw())
+		{
+			adbHedgeSocket = adbHttpSend(hostname, port, sendBuffer, deadline, keepAliveSeconds, &hedgeReused, socketFd);
+			if (adbHedgeSocket < 0)
+			{
+				PBL_CGI_TRACE("HttpRequest hedge after %d milliseconds not sent", hedgeDelay);
+			}
+		}
+
+		int keepAlive = 0;
+		int closed = 1;
+		char* response = NULL;
+		for (;;)
+		{
+			int first = 0;
+			if (adbHedgeSocket >= 0)
+			{
+				int sockets[2] = { socketFd, adbHedgeSocket };
+				first = adbWaitReadable(sockets, 2, deadline);
+				PBL_CGI_TRACE("HttpRequest hedged after %d milliseconds, %s", hedgeDelay, first < 0 ? "no answer" : first ? "the hedge answered first" : "the request answered first");
+				if (first > 0)
+				{
+					// Use the hedge, keep the request as the other connection
+					adbSocket = adbHedgeSocket;
+					adbHedgeSocket = socketFd;
+					socketFd = adbSocket;
+					int tmp = reused;
+					reused = hedgeReused;
+					hedgeReused = tmp;
+				}
+			}
+
+			response = receiveHttpResponse(socketFd, deadline, &keepAlive, &closed);
+			if (!closed || adbHedgeSocket < 0)
+			{
+				break;
+			}
+
+			// The connection answering first was closed without an answer, wait for the other one
+			PBL_CGI_TRACE("HttpResponse=closed, waiting for the other connection");
+			socket_close(socketFd);
+			adbSocket = socketFd = adbHedgeSocket;
+			adbHedgeSocket = -1;
+			reused = hedgeReused;
+		}
+		if (adbHedgeSocket >= 0)
+		{
+			socket_close(adbHedgeSocket);
+			adbHedgeSocket = -1;
+		}
+
+		if (closed)
+		{
+			if (!reused)
+			{
+				PBL_CGI_TRACE("HttpResponse=closed without an answer");
+				socket_close(socketFd);
+				adbSocket = -1;
+				return NULL;
+			}
+
+			// The peer closed the idle connection, try the next one
+			PBL_CGI_TRACE("HttpResponse=closed");
+			continue;
+		}
+
+		adbSocket = -1;
+		if (keepAlive && keepAliveSeconds > 0)
+		{
+			adbConnectionPut(hostname, port, socketFd);
+		}
+		else
+		{
+			socket_close(socketFd);
+		}
+		return response;
+	}
+}
+
+/*
+* The text of a HTTP/1.1 request
+*/
+static char* adbHttpRequestText(char* hostname, char* uri, char* agent, int keepAliveSeconds)
+{
+	return pblCgiSprintf("GET %s HTTP/1.1\r\nUser-Agent: %s\r\nHost: %s\r\n%s\r\n",
+		uri, agent, hostname, keepAliveSeconds > 0 ? "" : "Connection: close\r\n");
+}
+
+/*
+* Send a HTTP request with the given uri to the given host/port ahead of time, a later call of
+* adbGetHttpResponse with the same host, port and uri during the same request receives its response.
+* Requests sent ahead that are not used are discarded by adbHttpPrefetchDiscard.
+*/
+void adbHttpPrefetch(char* hostname, int port, char* uri, char* agent)
+{
+	if (adbNPrefetches >= ADB_MAX_PREFETCHES || adbCircuitIsOpen(hostname, port))
+	{
+		return;
+	}
+	int keepAliveSeconds = atoi(pblCgiConfigValue("HttpKeepAliveTimeout", "4"));
+	char* sendBuffer = adbHttpRequestText(hostname, uri, agent, keepAliveSeconds);
+	PBL_CGI_TRACE("HttpPrefetch=%s", sendBuffer);
+
+	AdbPrefetch* prefetch = &adbPrefetches[adbNPrefetches];
+	prefetch->start = adbMilliseconds();
+	prefetch->socket = adbHttpSend(hostname, port, sendBuffer, adbRequestDeadline(), keepAliveSeconds, &prefetch->reused, -1);
+	PBL_FREE(sendBuffer);
+	if (prefetch->socket >= 0)
+	{
+		prefetch->hostname = hostname;
+		prefetch->port = port;
+		prefetch->uri = uri;
+		adbNPrefetches++;
+	}
+}
+
+/*
+* Close the connections of the requests sent ahead that were not used
+*/
+void adbHttpPrefetchDiscard(void)
+{
+	while (adbNPrefetches > 0)
+	{
+		socket_close(adbPrefetches[--adbNPrefetches].socket);
+	}
+}
+
+/*
+* Receive the response of a request sent ahead, NULL if there is none or it was not answered
+*/
+static char* adbHttpPrefetchReceive(char* hostname, int port, char* uri, int timeoutSeconds, int keepAliveSeconds)
+{
+	for (int i = 0; i < adbNPrefetches; i++)
+	{
+		AdbPrefetch prefetch = adbPrefetches[i];
+		if (prefetch.port != port || strcmp(prefetch.uri, uri) || strcmp(prefetch.hostname, hostname))
+		{
+			continue;
+		}
+		adbPrefetches[i] = adbPrefetches[--adbNPrefetches];
+
+		if (adbSocket >= 0)
+		{
+			socket_close(adbSocket);
+		}
+		adbSocket = prefetch.socket;
+
+		int64_t deadline = prefetch.start + 1000 * (int64_t)timeoutSeconds;
+		if (deadline > adbRequestDeadline())
+		{
+			deadline = adbRequestDeadline();
+		}
+		int keepAlive = 0;
+		int closed = 1;
+		char* response = receiveHttpResponse(prefetch.socket, deadline, &keepAlive, &closed);
+		adbSocket = -1;
+		if (!closed && keepAlive && keepAliveSeconds > 0)
+		{
+			adbConnectionPut(hostname, port, prefetch.socket);
+		}
+		else
+		{
+			socket_close(prefetch.socket);
+		}
+		if (closed)
+		{
+			response = NULL;
+		}
+
+		int latency = (int)(adbMilliseconds() - prefetch.start);
+		char* status = response && !strncmp(response, "HTTP/", 5) ? strchr(response, ' ') : NULL;
+		adbCircuitRecord(hostname, port, response && !(status && status[1] == '5')
+			&& latency <= atoi(pblCgiConfigValue("CircuitBreakerSlowCall", "8000")));
+		if (response)
+		{
+			adbLatencyRecord(hostname, port, latency);
+		}
+		PBL_CGI_TRACE("HttpPrefetchResponse=%s", response ? response : "NULL");
+		return response;
+	}
+	return NULL;
+}
+
+static char* adbHttpGet(char* key, char* hostname, int port, char* uri, int timeoutSeconds, char* agent, int* circuitOpenPtr);
+static char* adbGetSharedHttpResponse(char* key, char* hostname, int port, char* uri, int timeoutSeconds, char* agent);
+
+/*
+* Make a HTTP request with the given uri to the given host/port
+* and return the result content in a malloced buffer.
+*
+* The request is sent as HTTP/1.1, the connection is kept for further requests of the process
+* to the same host/port for HttpKeepAliveTimeout seconds, 0 closes it after each request.
+*
+* An attempt ends after timeoutSeconds. If it was not answered, it is repeated up to HttpRetries
+* times, 2 by default, after a random delay of up to HttpRetryBackoff milliseconds, 100 by default,
+* doubled for each further repetition. The values of the area of the current request are used if
+* the request goes to the host of the area, e.g. Area_1_HttpRetries. A repetition needs a token
+* of the retry budget, and neither an attempt nor a repetition extends beyond the deadline of the
+* client request, see adbRequestDeadline. No attempt is made while the circuit of the host is open.
+*
+* If HttpHedgePercentile is set, e.g. to 95, 0 by default, an attempt not answered within the latency
+* the given percentage of the recent attempts to the host were answered in is hedged, the request is sent
+* again on a second connection and the first answer is used. A hedge needs a token of the retry budget.
+* The value of the area of the current request is used if the request goes to the host of the area.
+*
+* If the request was sent ahead by adbHttpPrefetch, its response is used if it is answered.
+*/
+char* adbGetHttpResponse(char* hostname, int port, char* uri, int timeoutSeconds, char* agent)
+{
+	return adbGetSharedHttpResponse(NULL, hostname, port, uri, timeoutSeconds, agent);
+}
+
+/*
+* Make a HTTP request like adbGetHttpResponse, the requests in flight with the same key share one response,
+* see adbHttpCoalesce
+*/
+static char* adbGetSharedHttpResponse(char* key, char* hostname, int port, char* uri, int timeoutSeconds, char* agent)
+{
+	static char* tag = "adbGetHttpResponse";
+
+	int circuitOpen = 0;
+	char* response = adbHttpGet(key, hostname, port, uri, timeoutSeconds, agent, &circuitOpen);
+	if (!response)
+	{
+		pblCgiExitOnError("%s: no response from host '%s' on port %d%s\n", tag, hostname, port, circuitOpen ? ", its circuit is open" : "");
+	}
+	return response;
+}
+
+/*
+* Make the attempts of a HTTP request, NULL if there is no response
+*/
+static char* adbHttpFetch(char* hostname, int port, char* uri, int timeoutSeconds, char* agent, int keepAliveSeconds, int* circuitOpenPtr)
+{
+	AdbAreaConfig* area = adbRequestArea;
+	if (area && (area->port != port || !pblCgiStrEquals(area->hostName, hostname)))
+	{
+		area = NULL;
+	}
+	int retries = area ? area->httpRetries : atoi(pblCgiConfigValue("HttpRetries", "2"));
+	int backoff = area ? area->httpRetryBackoff : atoi(pblCgiConfigValue("HttpRetryBackoff", "100"));
+	int hedgePercentile = area ? area->httpHedgePercentile : atoi(pblCgiConfigValue("HttpHedgePercentile", "0"));
+
+	char* response = NULL;
+	char* sendBuffer = adbHttpRequestText(hostname, uri, agent, keepAliveSeconds);
+	PBL_CGI_TRACE("HttpRequest=%s", sendBuffer);
+
+	int64_t requestDeadline = adbRequestDeadline();
+	int slowCall = atoi(pblCgiConfigValue("CircuitBreakerSlowCall", "8000"));
+	for (int n = 0; n <= retries; n++)
+	{
+		if (!adbCircuitAcquire(hostname, port))
+		{
+			PBL_CGI_TRACE("HttpRequest circuit is open, n=%d", n);
+			*circuitOpenPtr = 1;
+			break;
+		}
+		if (n > 0)
+		{
+			if (!adbRetryWithdraw())
+			{
+				PBL_CGI_TRACE("HttpRequest retry budget exhausted, n=%d", n);
+				break;
+			}
+
+			// Full jitter, a random delay between 0 and the backoff doubled for each repetition
+			int delay = 0;
+			if (backoff > 0)
+			{
+				delay = (int)(adbRandom() % ((uint32_t)(backoff << (n < 16 ? n - 1 : 15)) + 1));
+			}
+			if (adbMilliseconds() + delay >= requestDeadline)
+			{
+				PBL_CGI_TRACE("HttpRequest deadline passed, n=%d", n);
+				break;
+			}
+			PBL_CGI_TRACE("HttpRequest retry in %d milliseconds, n=%d", delay, n);
+			adbSleep(delay);
+		}
+
+		int64_t deadline = adbMilliseconds();
+		if (deadline >= requestDeadline)
+		{
+			PBL_CGI_TRACE("HttpRequest deadline passed, n=%d", n);
+			break;
+		}
+		deadline += 1000 * (int64_t)timeoutSeconds;
+		if (deadline > requestDeadline)
+		{
+			deadline = requestDeadline;
+		}
+
+		int hedgeDelay = hedgePercentile > 0 && hedgePercentile < 100 ? adbLatencyPercentile(hostname, port, hedgePercentile) : -1;
+		int64_t start = adbMilliseconds();
+		response = adbHttpAttempt(hostname, port, sendBuffer, deadline, keepAliveSeconds, hedgeDelay);
+
+		int latency = (int)(adbMilliseconds() - start);
+		char* status = response && !strncmp(response, "HTTP/", 5) ? strchr(response, ' ') : NULL;
+		adbCircuitRecord(hostname, port, response && !(status && status[1] == '5') && latency <= slowCall);
+		if (response)
+		{
+			adbLatencyRecord(hostname, port, latency);
+		}
+		if (!response)
+		{
+			PBL_CGI_TRACE("HttpResponse=NULL, n=%d", n);
+			continue;
+		}
+		PBL_CGI_TRACE("HttpResponse=%s", response);
+		break;
+	}
+	PBL_FREE(sendBuffer);
+	return response;
+}
+
+#ifndef _WIN32
+
+/*
+* The HTTP requests in flight in a process. A request with the same key as a request in flight
+* waits for its response instead of being sent again, see adbHttpCoalesce.
+*/
+typedef struct AdbFlight_s
+{
+	struct AdbFlight_s* next;
+	char* key;              /* The key of the request, see adbFlightKey */
+	int nWaiters;           /* The number of requests waiting for the response */
+	int done;
+	char* response;         /* A copy of the response for the waiting requests, NULL if there is none */
+	int circuitOpen;
+
+} AdbFlight;
+
+static pthread_mutex_t adbFlightMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t adbFlightCondition = PTHREAD_COND_INITIALIZER;
+static AdbFlight* adbFlights = NULL;
+
+/*
+* The arguments and the result of the request in flight of a thread, see adbHttpFetchRequest
+*/
+typedef struct AdbFetch_s
+{
+	char* hostname;
+	int port;
+	char* uri;
+	int timeoutSeconds;
+	char* agent;
+	int keepAliveSeconds;
+	int circuitOpen;
+	char* response;
+
+} AdbFetch;
+
+static PBL_THREAD_LOCAL AdbFetch* adbFetch = NULL;
+
+/*
+* Make the attempts of the request in flight of the thread, run as a request, so the requests
+* waiting for it are answered even if an error ends it
+*/
+static int adbHttpFetchRequest(int argc, char* argv[])
+{
+	AdbFetch* fetch = adbFetch;
+	fetch->response = adbHttpFetch(fetch->hostname, fetch->port, fetch->uri, fetch->timeoutSeconds, fetch->agent,
+		fetch->keepAliveSeconds, &fetch->circuitOpen);
+	return 0;
+}
+
+/*
+* The key of a request in flight if the caller gives none, the host, port, uri and agent,
+* the cache buster p=getpid() is left out of the uri
+*/
+static char* adbFlightKey(char* hostname, int port, char* uri, char* agent)
+{
+	char* stripped = pblCgiStrDup(uri);
+	for (char* ptr = strchr(stripped, '?'); ptr; ptr = strchr(ptr + 1, '&'))
+	{
+		if (ptr[1] == 'p' && ptr[2] == '=')
+		{
+			char* end = strchr(ptr + 1, '&');
+			if (end)
+			{
+				memmove(ptr + 1, end + 1, strlen(end + 1) + 1);
+			}
+			else
+			{
+				*ptr = '\0';
+			}
+			break;
+		}
+	}
+	char* key = pblCgiSprintf("%s:%d%s %s", hostname, port, stripped, agent);
+	PBL_FREE(stripped);
+	return key;
+}
+
+/*
+* Free a flight, called with adbFlightMutex held
+*/
+static void adbFlightFree(AdbFlight* flight)
+{
+	PBL_FREE(flight->key);
+	PBL_FREE(flight->response);
+	PBL_FREE(flight);
+}
+
+/*
+* Make the attempts of a HTTP request, or wait for the response of a request with the same key in flight in another
+* thread of the process. The key is given by the caller, e.g. the key of a layer in the cache, so the requests of
+* all devices for the layer share one response, or it is made by adbFlightKey if it is NULL.
+* The request waits no longer than the deadline of the client request, see adbRequestDeadline.
+* If the request in flight gets no response, the first waiting request makes the next attempts for the others.
+* HttpCoalesce 0 turns this off, it is on by default.
+*/
+static char* adbHttpCoalesce(char* key, char* hostname, int port, char* uri, int timeoutSeconds, char* agent, int keepAliveSeconds, int* circuitOpenPtr)
+{
+	static char* tag = "adbHttpCoalesce";
+
+	if (!atoi(pblCgiConfigValue("HttpCoalesce", "1")))
+	{
+		return adbHttpFetch(hostname, port, uri, timeoutSeconds, agent, keepAliveSeconds, circuitOpenPtr);
+	}
+
+	if (!key)
+	{
+		key = adbFlightKey(hostname, port, uri, agent);
+	}
+	int64_t requestDeadline = adbRequestDeadline();
+
+	PblArena* arena = pblArenaSet(NULL);
+	AdbFlight* flight = adbMalloc(tag, sizeof(AdbFlight));
+	memset(flight, 0, sizeof(AdbFlight));
+	flight->key = pblCgiStrDup(key);
+	pblArenaSet(arena);
+
+	pthread_mutex_lock(&adbFlightMutex);
+	AdbFlight* leader = adbFlights;
+	while (leader && strcmp(leader->key, key))
+	{
+		leader = leader->next;
+	}
+	if (leader)
+	{
+		adbFlightFree(flight);
+
+		struct timespec deadline;
+		deadline.tv_sec = (time_t)(requestDeadline / 1000);
+		deadline.tv_nsec = (long)(requestDeadline % 1000) * 1000000;
+
+		leader->nWaiters++;
+		int rc = 0;
+		while (!leader->done && rc != ETIMEDOUT)
+		{
+			rc = pthread_cond_timedwait(&adbFlightCondition, &adbFlightMutex, &deadline);
+		}
+		int done = leader->done;
+		char* response = NULL;
+		if (done && leader->response)
+		{
+			size_t length = strlen(leader->response) + 1;
+			response = pbl_malloc(tag, length);
+			if (response)
+			{
+				memcpy(response, leader->response, length);
+			}
+		}
+		if (done && leader->circuitOpen)
+		{
+			*circuitOpenPtr = 1;
+		}
+		int failed = done && leader->response && !response;
+		int unanswered = done && !leader->response && !leader->circuitOpen;
+		if (--leader->nWaiters < 1 && done)
+		{
+			adbFlightFree(leader);
+		}
+		pthread_mutex_unlock(&adbFlightMutex);
+
+		if (failed)
+		{
+			pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
+		}
+		if (unanswered)
+		{
+			// The first of the waiting requests makes the next attempts, the others wait for it
+			//
+			PBL_CGI_TRACE("HttpRequest in flight got no response, attempting %s", key);
+			return adbHttpCoalesce(key, hostname, port, uri, timeoutSeconds, agent, keepAliveSeconds, circuitOpenPtr);
+		}
+		PBL_CGI_TRACE("HttpRequest %s %s", done ? "answered by the request in flight" : "deadline passed waiting for", key);
+		return response;
+	}
+	flight->next = adbFlights;
+	adbFlights = flight;
+	pthread_mutex_unlock(&adbFlightMutex);
+
+	AdbFetch fetch;
+	fetch.hostname = hostname;
+	fetch.port = port;
+	fetch.uri = uri;
+	fetch.timeoutSeconds = timeoutSeconds;
+	fetch.agent = agent;
+	fetch.keepAliveSeconds = keepAliveSeconds;
+	fetch.circuitOpen = 0;
+	fetch.response = NULL;
+
+	adbFetch = &fetch;
+	int rc = pblCgiRunRequest(adbHttpFetchRequest, 0, NULL);
+	adbFetch = NULL;
+
+	pthread_mutex_lock(&adbFlightMutex);
+	for (AdbFlight** ptr = &adbFlights; *ptr; ptr = &(*ptr)->next)
+	{
+		if (*ptr == flight)
+		{
+			*ptr = flight->next;
+			break;
+		}
+	}
+	int nWaiters = flight->nWaiters;
+	if (nWaiters > 0)
+	{
+		if (fetch.response)
+		{
+			arena = pblArenaSet(NULL);
+			flight->response = pbl_malloc(tag, strlen(fetch.response) + 1);
+			pblArenaSet(arena);
+			if (flight->response)
+			{
+				strcpy(flight->response, fetch.response);
+			}
+		}
+		flight->circuitOpen = fetch.circuitOpen;
+		flight->done = 1;
+		pthread_cond_broadcast(&adbFlightCondition);
+	}
+	else
+	{
+		adbFlightFree(flight);
+	}
+	pthread_mutex_unlock(&adbFlightMutex);
+
+	if (nWaiters > 0)
+	{
+		PBL_CGI_TRACE("HttpRequest answered %d waiting requests", nWaiters);
+	}
+	if (rc < 0)
+	{
+		pblCgiExitRequest();
+	}
+	if (fetch.circuitOpen)
+	{
+		*circuitOpenPtr = 1;
+	}
+	return fetch.response;
+}
+
+#else
+
+/*
+* Without pthreads every request is sent
+*/
+static char* adbHttpCoalesce(char* key, char* hostname, int port, char* uri, int timeoutSeconds, char* agent, int keepAliveSeconds, int* circuitOpenPtr)
+{
+	return adbHttpFetch(hostname, port, uri, timeoutSeconds, agent, keepAliveSeconds, circuitOpenPtr);
+}
+
+#endif
+
+/*
+* Make a HTTP request like adbGetHttpResponse, NULL if there is no response,
+* the flag is set if the circuit of the host is open. The requests in flight
+* with the same key share one response, see adbHttpCoalesce.
+*/
+static char* adbHttpGet(char* key, char* hostname, int port, char* uri, int timeoutSeconds, char* agent, int* circuitOpenPtr)
+{
+	int keepAliveSeconds = atoi(pblCgiConfigValue("HttpKeepAliveTimeout", "4"));
+
+	adbRetryDeposit();
+
+	char* response = adbHttpPrefetchReceive(hostname, port, uri, timeoutSeconds, keepAliveSeconds);
+	if (response)
+	{
+		return response;
+	}
+	return adbHttpCoalesce(key, hostname, port, uri, timeoutSeconds, agent, keepAliveSeconds, circuitOpenPtr);
+}
+
+/*
+* The responses kept by a process, see adbGetCachedHttpResponse and adbGetDefaultLayerResponse.
+* A key has one slot of the cache, it replaces the response kept for another key in the slot. Responses
+* longer than ADB_RESPONSE_CACHE_MAX_LENGTH bytes are not kept. The memory of the cache is on the heap.
+*
+* When a response expired, the first request for it refreshes it. Until the refresh is done, but no
+* longer than RequestTimeout seconds, the other requests for it use the expired response.
+*
+* For StaleWhileRevalidate seconds after a response expired, e.g. LayerCacheStaleWhileRevalidate, 0 by default,
+* the first request uses the expired response as well and the refresh thread of the process refreshes it, see
+* adbResponseRefreshStart. For StaleIfError seconds after it expired, e.g. LayerCacheStaleIfError, 0 by default,
+* the expired response is used if its refresh gets no response or a server error.
+*/
+#define ADB_RESPONSE_CACHE_SIZE 256
+#define ADB_RESPONSE_CACHE_MAX_LENGTH (256 * 1024)
+
+typedef struct AdbCachedResponse_s
+{
+	char* key;
+	char* response;
+	int64_t expires;
+	int64_t refreshStart;   /* The start of the refresh of the expired response, 0 if there is none */
+} AdbCachedResponse;
+
+static AdbCachedResponse adbResponseCache[ADB_RESPONSE_CACHE_SIZE];
+static PblCgiMutex adbResponseCacheMutex = PBL_CGI_MUTEX_INITIALIZER;
+
+/*
+* The FNV-1a hash of a string
+*/
+static uint32_t adbHash(char* string)
+{
+	uint32_t hash = 2166136261U;
+	for (unsigned char* ptr = (unsigned char*)string; *ptr; ptr++)
+	{
+		hash ^= *ptr;
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+/*
+* The 64 bit FNV-1a hash of a string
+*/
+static uint64_t adbHash64(char* string)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	for (unsigned char* ptr = (unsigned char*)string; *ptr; ptr++)
+	{
+		hash ^= *ptr;
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+/*
+* The index of the tile of a position given in degrees, the tiles are tileSize microdegrees wide
+*/
+static int64_t adbTileIndex(char* degrees, int tileSize)
+{
+	int64_t position = (int64_t)(1000000.0 * strtod(degrees, NULL));
+	return position / tileSize - (position % tileSize < 0 ? 1 : 0);
+}
+
+/*
+* The value of a parameter of the query of an uri, NULL if it is not given
+*/
+static char* adbUriParameter(char* uri, char* name)
+{
+	size_t length = strlen(name);
+	for (char* ptr = strchr(uri, '?'); ptr; ptr = strchr(ptr + 1, '&'))
+	{
+		if (!strncmp(ptr + 1, name, length) && ptr[1 + length] == '=')
+		{
+			char* value = ptr + 2 + length;
+			char* end = strchr(value, '&');
+			return end ? pblCgiStrRangeDup(value, end) : pblCgiStrDup(value);
+		}
+	}
+	return NULL;
+}
+
+/*
+* The slot of a key, called with adbResponseCacheMutex held
+*/
+static AdbCachedResponse* adbResponseCacheSlot(char* key)
+{
+	return &adbResponseCache[adbHash(key) % ADB_RESPONSE_CACHE_SIZE];
+}
+
+/*
+* How a response got from the cache is refreshed, see adbResponseCacheGet
+*/
+#define ADB_REFRESH_NONE         0    /* The response is used */
+#define ADB_REFRESH_BACKGROUND   1    /* The response is used, the refresh thread refreshes it */
+#define ADB_REFRESH_NOW          2    /* The caller refreshes it, the response is used if the refresh fails */
+
+/*
+* Get a copy of the response kept for a key and how it is refreshed, NULL if there is none,
+* or if the caller has to refresh it and it expired more than staleIfErrorSeconds ago
+*/
+static char* adbResponseCacheGet(char* key, int staleSeconds, int staleIfErrorSeconds, int* refreshPtr)
+{
+	static char* tag = "adbResponseCacheGet";
+	char* response = NULL;
+	int64_t now = adbMilliseconds();
+	int64_t refreshTime = 1000 * (int64_t)atoi(pblCgiConfigValue("RequestTimeout", "20"));
+
+	*refreshPtr = ADB_REFRESH_NOW;
+
+	pblCgiMutexLock(&adbResponseCacheMutex);
+	AdbCachedResponse* cached = adbResponseCacheSlot(key);
+	if (cached->key && !strcmp(cached->key, key))
+	{
+		if (now < cached->expires || (cached->refreshStart && now < cached->refreshStart + refreshTime))
+		{
+			*refreshPtr = ADB_REFRESH_NONE;
+		}
+		else
+		{
+			cached->refreshStart = now;
+			if (now < cached->expires + 1000 * (int64_t)staleSeconds)
+			{
+				*refreshPtr = ADB_REFRESH_BACKGROUND;
+			}
+		}
+	}
+	if (cached->key && !strcmp(cached->key, key)
+		&& (*refreshPtr != ADB_REFRESH_NOW || now < cached->expires + 1000 * (int64_t)staleIfErrorSeconds))
+	{
+		size_t length = strlen(cached->response) + 1;
+		response = pbl_malloc(tag, length);
+		if (response)
+		{
+			memcpy(response, cached->response, length);
+		}
+		else
+		{
+			pblCgiMutexUnlock(&adbResponseCacheMutex);
+			pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
+		}
+	}
+	pblCgiMutexUnlock(&adbResponseCacheMutex);
+	return response;
+}
+
+/*
+* Keep a response for a key until the given time
+*/
+static void adbResponseCachePut(char* key, char* response, int64_t expires)
+{
+	PblArena* arena = pblArenaSet(NULL);
+	AdbCachedResponse entry;
+	entry.key = pblCgiStrDup(key);
+	entry.response = pblCgiStrDup(response);
+	entry.expires = expires;
+	entry.refreshStart = 0;
+	pblArenaSet(arena);
+
+	pblCgiMutexLock(&adbResponseCacheMutex);
+	AdbCachedResponse* cached = adbResponseCacheSlot(key);
+	AdbCachedResponse replaced = *cached;
+	*cached = entry;
+	pblCgiMutexUnlock(&adbResponseCacheMutex);
+
+	PBL_FREE(replaced.key);
+	PBL_FREE(replaced.response);
+}
+
+/*
+* The key of a layer request in the cache, the host, port, path and the sorted parameters of the uri.
+* The parameter p and the parameters listed in LayerCacheIgnore, userId and deviceId by default, are left out,
+* the positions lat, lon, latOfDevice and lonOfDevice are reduced to tiles of LayerCacheTile microdegrees,
+* 1000 by default.
+*/
+static char* adbLayerCacheKey(char* hostname, int port, char* uri)
+{
+	static char* tag = "adbLayerCacheKey";
+
+	char* query = strchr(uri, '?');
+	if (!query)
+	{
+		return pblCgiSprintf("%s:%d%s", hostname, port, uri);
+	}
+
+	int tile = atoi(pblCgiConfigValue("LayerCacheTile", "1000"));
+	if (tile < 1)
+	{
+		tile = 1;
+	}
+	char* ignored = pblCgiSprintf(",p,%s,", pblCgiConfigValue("LayerCacheIgnore", "userId,deviceId"));
+
+	PblList* parameters = pblCgiStrSplitToList(query + 1, "&");
+	int nParameters = pblListSize(parameters);
+	for (int i = nParameters - 1; i >= 0; i--)
+	{
+		char* parameter = pblListGet(parameters, i);
+		char* value = strchr(parameter, '=');
+		char* name = value ? pblCgiStrRangeDup(parameter, value++) : parameter;
+		char* ignoredName = pblCgiSprintf(",%s,", name);
+
+		if (!*parameter || strstr(ignored, ignoredName))
+		{
+			pblListRemoveAt(parameters, i);
+		}
+		else if (value && (!strcmp(name, "lat") || !strcmp(name, "lon") || !strcmp(name, "latOfDevice") || !strcmp(name, "lonOfDevice")))
+		{
+			pblListSet(parameters, i, pblCgiSprintf("%s=%lld", name, (long long)adbTileIndex(value, tile)));
+		}
+		PBL_FREE(ignoredName);
+	}
+	PBL_FREE(ignored);
+
+	if (pblListSort(parameters, pblCollectionStringCompareFunction) < 0)
+	{
+		pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
+	}
+
+	char* path = pblCgiStrRangeDup(uri, query);
+	char* key = pblCgiSprintf("%s:%d%s?", hostname, port, path);
+	PBL_FREE(path);
+
+	nParameters = pblListSize(parameters);
+	for (int i = 0; i < nParameters; i++)
+	{
+		char* tmp = key;
+		key = pblCgiSprintf("%s%s%s", tmp, i > 0 ? "&" : "", (char*)pblListGet(parameters, i));
+		PBL_FREE(tmp);
+	}
+	return key;
+}
+
+/*
+* The number of seconds a layer response may be kept, 0 if it must not be kept.
+* Only responses of status 200 without a cookie are kept, for the refreshInterval of the layer,
+* at most for timeoutSeconds.
+*/
+static int adbLayerCacheSeconds(char* response, int timeoutSeconds)
+{
+	char* body = strstr(response, "\r\n\r\n");
+	if (strncmp(response, "HTTP/", 5) || !body || strlen(response) > ADB_RESPONSE_CACHE_MAX_LENGTH)
+	{
+		return 0;
+	}
+	char* status = strchr(response, ' ');
+	if (!status || strncmp(status + 1, "200", 3))
+	{
+		return 0;
+	}
+	char* cookie = strstr(response, "Set-Cookie: ");
+	if (cookie && cookie < body)
+	{
+		return 0;
+	}
+
+	int seconds = timeoutSeconds;
+	char* refreshInterval = strstr(body, "\"refreshInterval\":");
+	if (refreshInterval)
+	{
+		int interval = atoi(refreshInterval + strlen("\"refreshInterval\":"));
+		if (interval > 0 && interval < seconds)
+		{
+			seconds = interval;
+		}
+	}
+	return seconds;
+}
+
+/*
+* A number of seconds configured for a cache, the name of the cache is the prefix of the configuration value
+*/
+static int adbResponseCacheSeconds(char* name, char* value)
+{
+	char* key = pblCgiSprintf("%s%s", name, value);
+	int seconds = atoi(pblCgiConfigValue(key, "0"));
+	PBL_FREE(key);
+	return seconds;
+}
+
+/*
+* Keep a response for a key if it may be kept, see adbLayerCacheSeconds, returns the number of seconds it is kept
+*/
+static int adbResponseCacheKeep(char* name, char* key, char* response)
+{
+	int seconds = adbLayerCacheSeconds(response, adbResponseCacheSeconds(name, "Timeout"));
+	if (seconds > 0)
+	{
+		PBL_CGI_TRACE("%s keeps %s for %d seconds", name, key, seconds);
+		adbResponseCachePut(key, response, adbMilliseconds() + 1000 * (int64_t)seconds);
+	}
+	return seconds;
+}
+
+#ifndef _WIN32
+
+/*
+* The refreshes of expired responses waiting for the refresh thread of the process, see adbResponseRefreshStart
+*/
+#define ADB_MAX_REFRESHES 16
+
+typedef struct AdbRefresh_s
+{
+	char* name;             /* The name of the cache */
+	char* configPath;       /* The configuration file of the request that started the refresh */
+	char* key;
+	char* hostname;
+	int port;
+	char* uri;
+	int timeoutSeconds;
+	char* agent;
+
+} AdbRefresh;
+
+static pthread_mutex_t adbRefreshMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t adbRefreshCondition = PTHREAD_COND_INITIALIZER;
+static AdbRefresh adbRefreshes[ADB_MAX_REFRESHES];
+static int adbNRefreshes = 0;
+static pid_t adbRefreshPid = 0;            /* The process the refresh thread was started in */
+static AdbRefresh* adbRefreshCurrent = NULL;
+
+/*
+* Refresh an expired response, run as a request with the configuration of the request that started the refresh.
+* If the refresh fails, the response is refreshed again after RequestTimeout seconds.
+*/
+static int adbResponseRefresh(int argc, char* argv[])
+{
+	AdbRefresh* refresh = adbRefreshCurrent;
+
+	adbConfigUse(adbConfigGet(refresh->configPath));
+	gettimeofday(&pblCgiStartTime, NULL);
+
+	int circuitOpen = 0;
+	char* response = adbHttpGet(refresh->key, refresh->hostname, refresh->port, refresh->uri, refresh->timeoutSeconds, refresh->agent, &circuitOpen);
+	if (!response || adbResponseCacheKeep(refresh->name, refresh->key, response) < 1)
+	{
+		PBL_CGI_TRACE("%s refresh of %s failed%s", refresh->name, refresh->key, circuitOpen ? ", the circuit is open" : "");
+	}
+	return 0;
+}
+
+static void adbRefreshFree(AdbRefresh* refresh)
+{
+	PBL_FREE(refresh->key);
+	PBL_FREE(refresh->hostname);
+	PBL_FREE(refresh->uri);
+	PBL_FREE(refresh->agent);
+}
+
+/*
+* The refresh thread refreshes the expired responses one after the other
+*/
+static void* adbRefreshThread(void* arg)
+{
+	static char* tag = "adbRefreshThread";
+
+	// A failing refresh prints its error message like a request, keep it out of the output of the process
+	//
+	pblCgiOutputStream = fopen("/dev/null", "w");
+
+	PblArena* arena = pblArenaNew(0);
+	if (!arena)
+	{
+		PBL_CGI_TRACE("%s: pbl_errno = %d, message='%s'", tag, pbl_errno, pbl_errstr);
+		return NULL;
+	}
+
+	for (;;)
+	{
+		pthread_mutex_lock(&adbRefreshMutex);
+		while (adbNRefreshes < 1)
+		{
+			pthread_cond_wait(&adbRefreshCondition, &adbRefreshMutex);
+		}
+		AdbRefresh refresh = adbRefreshes[0];
+		memmove(adbRefreshes, adbRefreshes + 1, --adbNRefreshes * sizeof(AdbRefresh));
+		pthread_mutex_unlock(&adbRefreshMutex);
+
+		adbRefreshCurrent = &refresh;
+		PblArena* previousArena = pblArenaSet(arena);
+		pblCgiRunRequest(adbResponseRefresh, 0, NULL);
+		pblArenaSet(previousArena);
+		pblArenaReset(arena);
+
+		adbRefreshFree(&refresh);
+	}
+	return NULL;
+}
+
+/*
+* Have the refresh thread of the process refresh an expired response, the first refresh of a process starts the thread.
+* If ADB_MAX_REFRESHES refreshes are waiting, the response is refreshed after RequestTimeout seconds.
+* Returns 0 if the refresh thread cannot refresh it, then the caller has to.
+*/
+static int adbResponseRefreshStart(char* name, char* key, char* hostname, int port, char* uri, int timeoutSeconds, char* agent)
+{
+	if (!adbConfigPath)
+	{
+		return 0;
+	}
+
+	PblArena* arena = pblArenaSet(NULL);
+	AdbRefresh refresh;
+	refresh.name = name;
+	refresh.configPath = adbConfigPath;
+	refresh.key = pblCgiStrDup(key);
+	refresh.hostname = pblCgiStrDup(hostname);
+	refresh.port = port;
+	refresh.uri = pblCgiStrDup(uri);
+	refresh.timeoutSeconds = timeoutSeconds;
+	refresh.agent = pblCgiStrDup(agent);
+	pblArenaSet(arena);
+
+	pthread_mutex_lock(&adbRefreshMutex);
+	if (adbRefreshPid != getpid())
+	{
+		pthread_t thread;
+		int rc = pthread_create(&thread, NULL, adbRefreshThread, NULL);
+		if (rc)
+		{
+			pthread_mutex_unlock(&adbRefreshMutex);
+			PBL_CGI_TRACE("Cannot start the refresh thread, rc %d", rc);
+			adbRefreshFree(&refresh);
+			return 0;
+		}
+		pthread_detach(thread);
+		adbRefreshPid = getpid();
+		adbNRefreshes = 0;
+	}
+	if (adbNRefreshes >= ADB_MAX_REFRESHES)
+	{
+		pthread_mutex_unlock(&adbRefreshMutex);
+		PBL_CGI_TRACE("%s refresh of %s is delayed, %d refreshes are waiting", name, key, ADB_MAX_REFRESHES);
+		adbRefreshFree(&refresh);
+		return 1;
+	}
+	adbRefreshes[adbNRefreshes++] = refresh;
+	pthread_cond_signal(&adbRefreshCondition);
+	pthread_mutex_unlock(&adbRefreshMutex);
+	return 1;
+}
+
+#else
+
+/*
+* Without a refresh thread the caller refreshes an expired response
+*/
+static int adbResponseRefreshStart(char* name, char* key, char* hostname, int port, char* uri, int timeoutSeconds, char* agent)
+{
+	return 0;
+}
+
+#endif
+
+/*
+* Make a HTTP request like adbGetHttpResponse, its response is kept by the process for the requests with the same key,
+* see adbResponseCacheKeep. The name of the cache, LayerCache or DefaultLayer, is the prefix of its configuration values.
+*/
+static char* adbGetKeptHttpResponse(char* name, char* key, char* hostname, int port, char* uri, int timeoutSeconds, char* agent)
+{
+	int refresh;
+	char* kept = adbResponseCacheGet(key, adbResponseCacheSeconds(name, "StaleWhileRevalidate"), adbResponseCacheSeconds(name, "StaleIfError"), &refresh);
+	if (refresh == ADB_REFRESH_NONE)
+	{
+		PBL_CGI_TRACE("%s hit %s", name, key);
+		return kept;
+	}
+	if (refresh == ADB_REFRESH_BACKGROUND && adbResponseRefreshStart(name, key, hostname, port, uri, timeoutSeconds, agent))
+	{
+		PBL_CGI_TRACE("%s uses the expired %s while it is refreshed", name, key);
+		return kept;
+	}
+
+	int circuitOpen = 0;
+	char* response = kept ? adbHttpGet(key, hostname, port, uri, timeoutSeconds, agent, &circuitOpen) : adbGetSharedHttpResponse(key, hostname, port, uri, timeoutSeconds, agent);
+	if (response)
+	{
+		char* status = !strncmp(response, "HTTP/", 5) ? strchr(response, ' ') : NULL;
+		if (adbResponseCacheKeep(name, key, response) > 0 || !kept || !status || status[1] != '5')
+		{
+			PBL_FREE(kept);
+			return response;
+		}
+	}
+	PBL_CGI_TRACE("%s uses the expired %s, the refresh failed%s", name, key, circuitOpen ? ", the circuit is open" : "");
+	PBL_FREE(response);
+	return kept;
+}
+
+/*
+* Make a HTTP request for a layer like adbGetHttpResponse, the response is kept by the process and
+* used for the requests with the same key, see adbLayerCacheKey, for up to LayerCacheTimeout seconds,
+* 0 by default, which turns the cache off. A response is not kept longer than the refreshInterval of the layer.
+*/
+char* adbGetCachedHttpResponse(char* hostname, int port, char* uri, int timeoutSeconds, char* agent)
+{
+	char* key = adbLayerCacheKey(hostname, port, uri);
+	if (adbResponseCacheSeconds("LayerCache", "Timeout") < 1)
+	{
+		return adbGetSharedHttpResponse(key, hostname, port, uri, timeoutSeconds, agent);
+	}
+	return adbGetKeptHttpResponse("LayerCache", key, hostname, port, uri, timeoutSeconds, agent);
+}
+
+/*
+* The key of a default layer request in the cache, the host, port and path of the uri, the client
+* and the layer name. The other parameters are left out, a default layer is requested at latitude
+* and longitude 0 and its response is the same for all clients.
+*/
+static char* adbDefaultLayerKey(char* hostname, int port, char* uri)
+{
+	char* query = strchr(uri, '?');
+	char* path = query ? pblCgiStrRangeDup(uri, query) : pblCgiStrDup(uri);
+	char* client = adbUriParameter(uri, "client");
+	char* layerName = adbUriParameter(uri, "layerName");
+
+	char* key = pblCgiSprintf("%s:%d%s?client=%s&layerName=%s", hostname, port, path, client ? client : "", layerName ? layerName : "");
+
+	PBL_FREE(layerName);
+	PBL_FREE(client);
+	PBL_FREE(path);
+	return key;
+}
+
+/*
+* Make a HTTP request for a default layer like adbGetHttpResponse. If DefaultLayerTimeout is set, 0 by default,
+* which turns it off, the response is kept by the process for that many seconds, at most for the refreshInterval
+* of the layer, and used for the requests of the default layer of the area and client. While a request refreshes
+* the response, the other requests use the expired one, see adbResponseCache.
+*/
+char* adbGetDefaultLayerResponse(char* hostname, int port, char* uri, int timeoutSeconds, char* agent)
+{
+	char* key = adbDefaultLayerKey(hostname, port, uri);
+	if (adbResponseCacheSeconds("DefaultLayer", "Timeout") < 1)
+	{
+		return adbGetSharedHttpResponse(key, hostname, port, uri, timeoutSeconds, agent);
+	}
+	return adbGetKeptHttpResponse("DefaultLayer", key, hostname, port, uri, timeoutSeconds, agent);
+}
+
+/*
+* Send a HTTP request for a default layer ahead of time like adbHttpPrefetch,
+* unless its response is kept and used without waiting for a refresh
+*/
+void adbDefaultLayerPrefetch(char* hostname, int port, char* uri, char* agent)
+{
+	if (adbResponseCacheSeconds("DefaultLayer", "Timeout") > 0)
+	{
+		char* key = adbDefaultLayerKey(hostname, port, uri);
+		int64_t stale = 1000 * (int64_t)adbResponseCacheSeconds("DefaultLayer", "StaleWhileRevalidate");
+		int64_t now = adbMilliseconds();
+
+		pblCgiMutexLock(&adbResponseCacheMutex);
+		AdbCachedResponse* cached = adbResponseCacheSlot(key);
+		int isKept = cached->key && now < cached->expires + stale && !strcmp(cached->key, key);
+		pblCgiMutexUnlock(&adbResponseCacheMutex);
+
+		PBL_FREE(key);
+		if (isKept)
+		{
+			return;
+		}
+	}
+	adbHttpPrefetch(hostname, port, uri, agent);
+}
+
+/*
+* The geo cells known to have no directory entries, see adbDirectoryCellIsEmpty.
+*
+* The cells have no pointers, so if EmptyDirectoryCacheFile is set they are kept in that file and shared
+* by all processes mapping it, otherwise they are shared by the threads of a process. A cell has one slot
+* of the table, it replaces the cell kept in the slot.
+*/
+#define ADB_EMPTY_CELLS 8192
+
+typedef struct AdbEmptyCell_s
+{
+	uint64_t scope;         /* The 64 bit hash of the host, port, path and layer name of the directory request */
+	int32_t lat;            /* The tile indexes of the cell */
+	int32_t lon;
+	int64_t expires;
+} AdbEmptyCell;
+
+static AdbEmptyCell adbEmptyProcessCells[ADB_EMPTY_CELLS];
+static AdbEmptyCell* adbEmptyCells = NULL;
+static int adbEmptyCellsFd = -1;
+static PblCgiMutex adbEmptyCellsMutex = PBL_CGI_MUTEX_INITIALIZER;
+
+/*
+* Get the cell of a directory request and its slot, NULL if the request has no position
+*/
+static AdbEmptyCell* adbEmptyCellSlot(char* hostname, int port, char* uri, AdbEmptyCell* cell)
+{
+	char* lat = adbUriParameter(uri, "lat");
+	char* lon = adbUriParameter(uri, "lon");
+	if (!lat || !lon)
+	{
+		return NULL;
+	}
+	int tile = atoi(pblCgiConfigValue("EmptyDirectoryTile", "100"));
+	if (tile < 1)
+	{
+		tile = 1;
+	}
+
+	char* layerName = adbUriParameter(uri, "layerName");
+	char* path = pblCgiStrRangeDup(uri, strchr(uri, '?'));
+	char* scope = pblCgiSprintf("%s:%d%s?%s", hostname, port, path, layerName ? layerName : "");
+
+	cell->scope = adbHash64(scope);
+	cell->lat = (int32_t)adbTileIndex(lat, tile);
+	cell->lon = (int32_t)adbTileIndex(lon, tile);
+	cell->expires = 0;
+
+	PBL_FREE(scope);
+	PBL_FREE(path);
+	PBL_FREE(layerName);
+	PBL_FREE(lon);
+	PBL_FREE(lat);
+
+	if (!adbEmptyCells)
+	{
+		pblCgiMutexLock(&adbEmptyCellsMutex);
+		if (!adbEmptyCells)
+		{
+			AdbEmptyCell* cells = adbSharedMap("EmptyDirectoryCacheFile", sizeof(adbEmptyProcessCells), &adbEmptyCellsFd);
+			adbEmptyCells = cells ? cells : adbEmptyProcessCells;
+		}
+		pblCgiMutexUnlock(&adbEmptyCellsMutex);
+	}
+	uint32_t hash = (uint32_t)(cell->scope ^ (cell->scope >> 32)) ^ ((uint32_t)cell->lat * 2654435761U) ^ ((uint32_t)cell->lon * 40503U);
+	return &adbEmptyCells[hash % ADB_EMPTY_CELLS];
+}
+
+/*
+* Check whether the cell of a directory request is known to have no directory entries.
+*
+* If EmptyDirectoryTimeout is set, 0 by default, which turns the check off, a directory request answered
+* without hotspots marks the cell of its position as empty for that many seconds, see adbDirectoryCellSetEmpty.
+* The cells are EmptyDirectoryTile microdegrees wide, 100 by default, about ten meters. The directory
+* is not requested for a position in an empty cell, after the timeout the next request in the cell checks it again.
+*
+* One answer for one position marks the whole cell, so the tile has to be smaller than the smallest
+* area of a directory entry, otherwise an entry covering only a part of a cell is hidden in the rest
+* of the cell until the timeout. Larger tiles save more directory requests at that risk.
+*/
+int adbDirectoryCellIsEmpty(char* hostname, int port, char* uri)
+{
+	if (atoi(pblCgiConfigValue("EmptyDirectoryTimeout", "0")) < 1)
+	{
+		return 0;
+	}
+	AdbEmptyCell cell;
+	AdbEmptyCell* slot = adbEmptyCellSlot(hostname, port, uri, &cell);
+	if (!slot)
+	{
+		return 0;
+	}
+	int64_t now = time(NULL);
+
+	adbSharedLock(&adbEmptyCellsMutex, adbEmptyCellsFd);
+	int isEmpty = slot->expires > now && slot->scope == cell.scope && slot->lat == cell.lat && slot->lon == cell.lon;
+	adbSharedUnlock(&adbEmptyCellsMutex, adbEmptyCellsFd);
+
+	return isEmpty;
+}
+
+/*
+* Mark the cell of a directory request as empty
+*/
+void adbDirectoryCellSetEmpty(char* hostname, int port, char* uri)
+{
+	int timeout = atoi(pblCgiConfigValue("EmptyDirectoryTimeout", "0"));
+	if (timeout < 1)
+	{
+		return;
+	}
+	AdbEmptyCell cell;
+	AdbEmptyCell* slot = adbEmptyCellSlot(hostname, port, uri, &cell);
+	if (!slot)
+	{
+		return;
+	}
+	cell.expires = time(NULL) + timeout;
+
+	adbSharedLock(&adbEmptyCellsMutex, adbEmptyCellsFd);
+	*slot = cell;
+	adbSharedUnlock(&adbEmptyCellsMutex, adbEmptyCellsFd);
+}
+
+static char* getMatchingString(char* string, char start, char end, char** nextPtr)
+{
+	char* tag = "getMatchingString";
+	char* ptr = string;
+	if (start != *ptr)
+	{
+		pblCgiExitOnError("%s: expected %c at start of string '%s'\n", tag, start, string);
+	}
+
+	int level = 1;
+	int c;
+	while ((c = *++ptr))
+	{
+		if (c == start)
+		{
+			level++;
+		}
+		if (c == end)
+		{
+			level--;
+			if (level < 1)
+			{
+				if (nextPtr)
+				{
+					*nextPtr = ptr + 1;
+				}
+				return pblCgiStrRangeDup(string + 1, ptr);
+			}
+		}
+	}
+	pblCgiExitOnError("%s: unexpected end of string in '%s', expected end character '%c'\n", tag, string, end);
+	return NULL;
+}
+
+char* adbGetStringBetween(char* string, char* start, char* end)
+{
+	char* tag = "adbGetStringBetween";
+	char* ptr = *start ? strstr(string, start) : string;
+	if (!ptr)
+	{
+		pblCgiExitOnError("%s: expected starting tag '%s' in string '%s'\n", tag, start, string);
+		return NULL;
+	}
+	ptr += strlen(start);
+	char* ptr2 = strstr(ptr, end);
+	if (!ptr2)
+	{
+		pblCgiExitOnError("%s: expected ending '%s' in string '%s'\n", tag, end, ptr);
+	}
+	return pblCgiStrRangeDup(ptr, ptr2);
+}
+
+static char* getNumberString(char* string, char* start)
+{
+	char* tag = "getNumberString";
+	char* ptr = strstr(string, start);
+	if (!ptr)
+	{
+		pblCgiExitOnError("%s: expected starting tag '%s' in string '%s'\n", tag, start, string);
+	}
+	ptr += strlen(start);
+
+	char* ptr2 = ptr;
+	while (ptr2 && *ptr2)
+	{
+		if (isdigit(*ptr2) || '.' == *ptr2 || '-' == *ptr2 || '+' == *ptr2)
+		{
+			ptr2++;
+			continue;
+		}
+		break;
+	}
+	if (!ptr2)
+	{
+		pblCgiExitOnError("%s: expected number ending in string '%s'\n", tag, ptr);
+	}
+	return pblCgiStrRangeDup(ptr, ptr2);
+}
+
+char* adbGetHttpResponseBody(char* response, char** cookiePtr)
+{
+	static char* tag = "adbGetHttpResponseBody";
+
+	// check for HTTP error code like HTTP/1.1 500 Server Error
+	//
+	if (cookiePtr && strstr(response, "Set-Cookie: "))
+	{
+		*cookiePtr = adbGetStringBetween(response, "Set-Cookie: ", "\r\n");
+	}
+
+	char* ptr = strstr(response, "HTTP/");
+	if (ptr)
+	{
+		ptr = strstr(ptr, " ");
+		if (ptr)
+		{
+			ptr++;
+			if (strncmp(ptr, "200", 3))
+			{
+				pblCgiExitOnError("%s: Bad HTTP response\n%s\n", tag, response);
+			}
+		}
+	}
+
+	if (ptr)
+	{
+		char* end = strstr(ptr, "\r\n\r\n");
+		if (!end)
+		{
+			end = strstr(ptr, "\n\n");
+			if (!end)
+			{
+				pblCgiExitOnError("%s: Illegal HTTP response, no separator.\n%s\n", tag, response);
+			}
+			else
+			{
+				end += 2;
+			}
+		}
+		else
+		{
+			end += 4;
+		}
+		return end;
+	}
+
+	pblCgiExitOnError("%s: Expecting HTTP response\n%s\n", tag, response);
+	return NULL;
+}
+
+static void putString(char* string, PblStringBuilder* stringBuilder)
+{
+	char* tag = "putString";
+
+	if (pblStringBuilderAppendStr(stringBuilder, string) == ((size_t)-1))
+	{
+		pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
+	}
+	fputs(string, PBL_CGI_OUT);
+}
+
+static char* changeLat(char* string, int i, int difference)
+{
+	if (!strstr(string, "\"lat\":"))
+	{
+		return pblCgiStrDup(string);
+	}
+
+	int factor = 1 + (i - 1) / 8;
+	int modulo = (i - 1) % 8;
+
+	switch (modulo)
+	{
+	case 0:
+		difference *= factor;
+		break;
+	case 1:
+		difference *= -factor;
+		break;
+	case 4:
+	case 5:
+		difference *= factor;
+		break;
+	case 6:
+	case 7:
+		difference *= -factor;
+		break;
+	default:
+		return pblCgiStrDup(string);
+	}
+
+	char* lat = getNumberString(string, "\"lat\":");
+	//PBL_CGI_TRACE("lat=%s", lat);
+
+	char* oldLat = pblCgiSprintf("\"lat\":%s,", lat);
+	//PBL_CGI_TRACE("oldLat=%s", oldLat);
+
+	char* newLat = pblCgiSprintf("\"lat\":%d,", atoi(lat) + difference);
+	//PBL_CGI_TRACE("newLat=%s", newLat);
+
+	char* replacedLat = pblCgiStrReplace(string, oldLat, newLat);
+
+	PBL_FREE(lat);
+	PBL_FREE(oldLat);
+	PBL_FREE(newLat);
+
+	return replacedLat;
+}
+
+static char* changeLon(char* string, int i, int difference)
+{
+	if (!strstr(string, "\"lon\":"))
+	{
+		return pblCgiStrDup(string);
+	}
+
+	int factor = 1 + (i - 1) / 8;
+	int modulo = (i - 1) % 8;
+
+	switch (modulo)
+	{
+	case 2:
+		difference *= factor;
+		break;
+	case 3:
+		difference *= -factor;
+		break;
+	case 4:
+	case 6:
+		difference *= factor;
+		break;
+	case 5:
+	case 7:
+		difference *= -factor;
+		break;
+	default:
+		return pblCgiStrDup(string);
+	}
+
+	char* lon = getNumberString(string, "\"lon\":");
+	//PBL_CGI_TRACE("lon=%s", lon);
+
+	char* oldLon = pblCgiSprintf("\"lon\":%s,", lon);
+	//PBL_CGI_TRACE("oldLon=%s", oldLon);
+
+	char* newLon = pblCgiSprintf("\"lon\":%d,", atoi(lon) + difference);
+	//PBL_CGI_TRACE("newLon=%s", newLon);
+
+	char* replacedLon = pblCgiStrReplace(string, oldLon, newLon);
+
+	PBL_FREE(lon);
+	PBL_FREE(oldLon);
+	PBL_FREE(newLon);
+
+	return replacedLon;
+}
+
+static char* changeBaseUrl(char* string, char * oldValue, char *newValue)
+{
+	char* baseUrlStart = "\"baseURL\":\"";
+	char* ptr = strstr(string, baseUrlStart);
+	if (!ptr)
+	{
+		return string;
+	}
+
+	char* assetBundleUrl = adbGetStringBetween(ptr, baseUrlStart, "\"");
+	if (!assetBundleUrl || !strstr(assetBundleUrl, oldValue) || strstr(assetBundleUrl, newValue))
+	{
+		return string;
+	}
+	PBL_FREE(assetBundleUrl);
+
+	ptr = pblCgiStrReplace(string, oldValue, newValue);
+	//PBL_CGI_TRACE("baseUrlFrom=%s", string);
+	//PBL_CGI_TRACE("baseUrlTo  =%s", ptr);
+	return ptr;
+}
+
+
+void adbGetLatAndLonOfDevice(char* queryString, int* latDifference, int* lonDifference)
+{
+	char* latOfDevice = "latOfDevice=";
+	char* lonOfDevice = "lonOfDevice=";
+	int latPtrInteger = 0;
+	int lonPtrInteger = 0;
+
+	char* latPtr = strstr(queryString, latOfDevice);
+	if (latPtr)
+	{
+		char* ptr = strstr(latPtr, "&");
+		if (ptr)
+		{
+			latPtr = pblCgiStrRangeDup(latPtr, ptr);
+		}
+		else
+		{
+			latPtr = pblCgiStrDup(latPtr);
+		}
+		latPtrInteger = (int)(1000000.0 * strtod(latPtr + strlen(latOfDevice), NULL));
+	}
+	char* lonPtr = strstr(queryString, lonOfDevice);
+	if (lonPtr)
+	{
+		char* ptr = strstr(lonPtr, "&");
+		if (ptr)
+		{
+			lonPtr = pblCgiStrRangeDup(lonPtr, ptr);
+		}
+		else
+		{
+			lonPtr = pblCgiStrDup(lonPtr);
+		}
+		lonPtrInteger = (int)(1000000.0 * strtod(lonPtr + strlen(lonOfDevice), NULL));
+	}
+	if (latDifference && lonDifference && latPtrInteger != 0 && lonPtrInteger != 0)
+	{
+		*latDifference = 0 - latPtrInteger;
+		*lonDifference = 0 - lonPtrInteger;
+	}
+}
+
+/*
+* Replace lat and lon of the query, lat and lon are also given in millionths of a degree.
+*/
+static char* adbReplaceLatAndLon(char* queryString, char* lat, char* lon, int replacementLatInteger, int replacementLonInteger,
+	int* latDifference, int* lonDifference)
+{
+	char* replacementLat = pblCgiStrCat("lat=", lat);
+	char* replacementLon = pblCgiStrCat("lon=", lon);
+	int latPtrInteger = 0;
+	int lonPtrInteger = 0;
+
+	char* latPtr = strstr(queryString, "lat=");
+	if (latPtr)
+	{
+		char* ptr = strstr(latPtr, "&");
+		if (ptr)
+		{
+			latPtr = pblCgiStrRangeDup(latPtr, ptr);
+		}
+		else
+		{
+			latPtr = pblCgiStrDup(latPtr);
+		}
+		latPtrInteger = (int)(1000000.0 * strtod(latPtr + 4, NULL));
+		queryString = pblCgiStrReplace(queryString, latPtr, replacementLat);
+	}
+	char* lonPtr = strstr(queryString, "lon=");
+	if (lonPtr)
+	{
+		char* ptr = strstr(lonPtr, "&");
+		if (ptr)
+		{
+			lonPtr = pblCgiStrRangeDup(lonPtr, ptr);
+		}
+		else
+		{
+			lonPtr = pblCgiStrDup(lonPtr);
+		}
+		lonPtrInteger = (int)(1000000.0 * strtod(lonPtr + 4, NULL));
+		queryString = pblCgiStrReplace(queryString, lonPtr, replacementLon);
+	}
+	if (latDifference && lonDifference && latPtrInteger != 0 && lonPtrInteger != 0)
+	{
+		*latDifference = replacementLatInteger - latPtrInteger;
+		*lonDifference = replacementLonInteger - lonPtrInteger;
+	}
+	return queryString;
+}
+
+char* adbChangeLatAndLon(char* queryString, char* lat, char* lon, int* latDifference, int* lonDifference)
+{
+	if (!pblCgiStrIsNullOrWhiteSpace(lat) && !pblCgiStrIsNullOrWhiteSpace(lon))
+	{
+		int latInteger = (int)(1000000.0 * strtod(lat, NULL));
+		int lonInteger = (int)(1000000.0 * strtod(lon, NULL));
+		return adbReplaceLatAndLon(queryString, lat, lon, latInteger, lonInteger, latDifference, lonDifference);
+	}
+	return NULL;
+}
+
+char* adbChangeRedirectionUrl(char* string, char* redirectionUrl)
+{
+	if (!strstr(string, "\"redirectionUrl\":"))
+	{
+		return pblCgiStrDup(string);
+	}
+
+	char* oldValue = adbGetStringBetween(string, "\"redirectionUrl\":", ",\"");
+
+	char* oldValueStr = pblCgiSprintf("\"redirectionUrl\":%s", oldValue);
+	char* newValueStr = pblCgiSprintf("\"redirectionUrl\":\"%s\"", redirectionUrl);
+
+	char* replacedString = pblCgiStrReplace(string, oldValueStr, newValueStr);
+
+	PBL_FREE(oldValue);
+	PBL_FREE(oldValueStr);
+	PBL_FREE(newValueStr);
+
+	return replacedString;
+}
+
+char* adbChangeLayer(char* string, char* layer)
+{
+	if (!strstr(string, "\"layer\":"))
+	{
+		return pblCgiStrDup(string);
+	}
+
+	char* oldValue = adbGetStringBetween(string, "\"layer\":", ",\"");
+
+	char* oldValueStr = pblCgiSprintf("\"layer\":%s", oldValue);
+	char* newValueStr = pblCgiSprintf("\"layer\":\"%s\"", layer);
+
+	char* replacedString = pblCgiStrReplace(string, oldValueStr, newValueStr);
+
+	PBL_FREE(oldValue);
+	PBL_FREE(oldValueStr);
+	PBL_FREE(newValueStr);
+
+	return replacedString;
+}
+
+char* adbChangeRedirectionLayer(char* string, char* redirectionLayer)
+{
+	if (!strstr(string, "\"redirectionLayer\":"))
+	{
+		return pblCgiStrDup(string);
+	}
+
+	char* oldValue = adbGetStringBetween(string, "\"redirectionLayer\":", ",\"");
+
+	char* oldValueStr = pblCgiSprintf("\"redirectionLayer\":%s", oldValue);
+	char* newValueStr = pblCgiSprintf("\"redirectionLayer\":\"%s\"", redirectionLayer);
+
+	char* replacedString = pblCgiStrReplace(string, oldValueStr, newValueStr);
+
+	PBL_FREE(oldValue);
+	PBL_FREE(oldValueStr);
+	PBL_FREE(newValueStr);
+
+	return replacedString;
+}
+
+char* adbChangeLayerName(char* string, char* layerName)
+{
+	if (!strstr(string, "layerName="))
+	{
+		return pblCgiStrDup(string);
+	}
+
+	char* oldLayerName = adbGetStringBetween(string, "layerName=", "&");
+
+	char* oldLayerNameStr = pblCgiSprintf("layerName=%s", oldLayerName);
+	char* newLayerNameStr = pblCgiSprintf("layerName=%s", layerName);
+
+	char* replacedString = pblCgiStrReplace(string, oldLayerNameStr, newLayerNameStr);
+
+	PBL_FREE(oldLayerName);
+	PBL_FREE(oldLayerNameStr);
+	PBL_FREE(newLayerNameStr);
+
+	return replacedString;
+}
+
+char* adbChangeShowMenuOption(char* string, char* value)
+{
+	if (!strstr(string, "\"showMenuButton\":"))
+	{
+		return pblCgiStrDup(string);
+	}
+
+	char* oldValue = adbGetStringBetween(string, "\"showMenuButton\":", ",\"");
+
+	char* oldValueStr = pblCgiSprintf("\"showMenuButton\":%s", oldValue);
+	char* newValueStr = pblCgiSprintf("\"showMenuButton\":\"%s\"", value);
+
+	char* replacedString = pblCgiStrReplace(string, oldValueStr, newValueStr);
+
+	PBL_FREE(oldValue);
+	PBL_FREE(oldValueStr);
+	PBL_FREE(newValueStr);
+
+	return replacedString;
+}
+
+static void freeStringList(PblList* list);
+
+/*
+* The position of a device, bundle or deeplink, followed by the lat and lon strings of the configuration.
+*/
+typedef struct AdbPosition_s
+{
+	int lat;                /* Millionths of a degree */
+	int lon;
+
+} AdbPosition;
+
+/*
+* Create the position table of a position configuration value, e.g. DevicePosition,
+* a list of id, lat, lon triples. The table is a config table mapping the ids to their positions,
+* the first position given for an id is used.
+*/
+static void* adbPositionTableNew(char* value, size_t* sizePtr)
+{
+	static char* tag = "adbPositionTableNew";
+
+	PblList* list = pblCgiStrSplitToList(value, ",");
+	PblMap* map = pblCgiNewMap();
+
+	int listSize = pblListSize(list);
+	for (int i = 0; i < listSize - 2; i += 3)
+	{
+		char* id = pblListGet(list, i);
+		if (pblMapContainsKeyStr(map, id))
+		{
+			continue;
+		}
+		char* lat = pblListGet(list, i + 1);
+		char* lon = pblListGet(list, i + 2);
+
+		AdbPosition position;
+		position.lat = (int)(1000000.0 * strtod(lat, NULL));
+		position.lon = (int)(1000000.0 * strtod(lon, NULL));
+
+		size_t latLength = strlen(lat) + 1;
+		size_t lonLength = strlen(lon) + 1;
+		size_t length = sizeof(position) + latLength + lonLength;
+		char* entry = adbMalloc(tag, length);
+		memcpy(entry, &position, sizeof(position));
+		memcpy(entry + sizeof(position), lat, latLength);
+		memcpy(entry + sizeof(position) + latLength, lon, lonLength);
+
+		int rc = pblMapAdd(map, id, strlen(id) + 1, entry, length);
+		PBL_FREE(entry);
+		if (rc < 0)
+		{
+			pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
+		}
+	}
+
+	size_t size = pblCgiConfigTableBuild(map, NULL, 0);
+	void* table = adbMalloc(tag, size);
+	pblCgiConfigTableBuild(map, table, size);
+	if (sizePtr)
+	{
+		*sizePtr = size;
+	}
+
+	pblCgiMapFree(map);
+	freeStringList(list);
+	return table;
+}
+
+/*
+* Get the table of a position configuration value, the table of a text configuration is created
+* by the first request of a process needing it and lives on the heap, not in the request arena.
+*/
+static void* adbGetPositionTable(int position)
+{
+	AdbConfig* config = adbGetConfig();
+
+	void* table = ADB_ATOMIC_LOAD(&config->positionTables[position]);
+	if (!table && config->map)
+	{
+		char* value = pblCgiConfigValue(adbPositionKeys[position], NULL);
+		if (!pblCgiStrIsNullOrWhiteSpace(value))
+		{
+			PblArena* arena = pblArenaSet(NULL);
+			void* newTable = adbPositionTableNew(value, NULL);
+			pblArenaSet(arena);
+
+			// Of threads creating the table at the same time, the first one sets it
+			//
+			if (ADB_ATOMIC_CAS(&config->positionTables[position], &table, newTable))
+			{
+				table = newTable;
+			}
+			else
+			{
+				PBL_FREE(newTable);
+			}
+		}
+	}
+	return table;
+}
+
+/*
+* Move the location of the query to the position configured for a device, bundle or deeplink.
+*/
+static char* adbHandlePosition(int position, char* kind, char* id, char* queryString, int* latDifference, int* lonDifference)
+{
+	if (pblCgiStrIsNullOrWhiteSpace(id))
+	{
+		return NULL;
+	}
+
+	void* table = adbGetPositionTable(position);
+	if (!table)
+	{
+		return NULL;
+	}
+
+	char* entry = pblCgiConfigTableGet(table, id);
+	if (!entry)
+	{
+		return NULL;
+	}
+
+	AdbPosition location;
+	memcpy(&location, entry, sizeof(location));
+	char* lat = entry + sizeof(location);
+	char* lon = lat + strlen(lat) + 1;
+	PBL_CGI_TRACE("%s %s, lat %s, lon %s", kind, id, lat, lon);
+
+	if (pblCgiStrIsNullOrWhiteSpace(lat) || pblCgiStrIsNullOrWhiteSpace(lon))
+	{
+		return NULL;
+	}
+	return adbReplaceLatAndLon(queryString, lat, lon, location.lat, location.lon, latDifference, lonDifference);
+}
+
+char* adbHandleDevicePosition(char* deviceId, char* queryString, int* latDifference, int* lonDifference)
+{
+	return adbHandlePosition(ADB_DEVICE_POSITION, "Device", deviceId, queryString, latDifference, lonDifference);
+}
+
+char* adbHandleBundlePosition(char* bundleId, char* queryString, int* latDifference, int* lonDifference)
+{
+	return adbHandlePosition(ADB_BUNDLE_POSITION, "Bundle", bundleId, queryString, latDifference, lonDifference);
+}
+
+char* adbHandleDeeplinkPosition(char* deeplinkName, char* queryString, int* latDifference, int* lonDifference)
+{
+	return adbHandlePosition(ADB_DEEPLINK_POSITION, "Deeplink", deeplinkName, queryString, latDifference, lonDifference);
+}
+
+void adbTraceDuration()
+{
+	struct timeval now;
+	gettimeofday(&now, NULL);
+
+	unsigned long duration = now.tv_sec * 1000000 + now.tv_usec;
+	duration -= pblCgiStartTime.tv_sec * 1000000 + pblCgiStartTime.tv_usec;
+	char* string = pblCgiSprintf("%lu", duration);
+	PBL_CGI_TRACE("Duration=%s microseconds", string);
+}
+
+void adbPrintHeader(char* cookie)
+{
+	fputs("Content-Type: application/json\r\n", PBL_CGI_OUT);
+	if (cookie)
+	{
+		fputs("Set-Cookie: ", PBL_CGI_OUT);
+		fputs(cookie, PBL_CGI_OUT);
+		fputs("\r\n", PBL_CGI_OUT);
+	}
+	fputs("\r\n", PBL_CGI_OUT);
+}
+
+void adbHandleResponse(char* response, int latDifference, int lonDifference, int bundleInteger)
+{
+	static char* tag = "adbHandleResponse";
+	char* cookie = NULL;
+	response = adbGetHttpResponseBody(response, &cookie);
+
+	char* start = "{\"hotspots\":";
+	int length = strlen(start);
+
+	if (strncmp(start, response, length))
+	{
+		adbPrintHeader(cookie);
+		fputs(response, PBL_CGI_OUT);
+		PBL_CGI_TRACE("Response does not start with %s, no handling", start);
+		return;
+	}
+
+	PblStringBuilder* stringBuilder = pblStringBuilderNew();
+	if (!stringBuilder)
+	{
+		pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
+	}
+
+	char* rest = NULL;
+	char* hotspotsString = getMatchingString(response + length, '[', ']', &rest);
+
+	PblList* list = pblListNewArrayList();
+	if (!list)
+	{
+		pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
+	}
+
+	char* ptr = hotspotsString;
+	while (*ptr == '{')
+	{
+		char* ptr2 = NULL;
+		char* hotspot = getMatchingString(ptr, '{', '}', &ptr2);
+
+		if (pblListAdd(list, hotspot) < 0)
+		{
+			pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
+		}
+		if (*ptr2 != ',')
+		{
+			break;
+		}
+		ptr = ptr2 + 1;
+	}
+
+	adbPrintHeader(cookie);
+	putString(start, stringBuilder);
+	putString("[", stringBuilder);
+
+	int nPois = pblListSize(list);
+	PBL_CGI_TRACE("Number of pois=%d", nPois);
+
+	for (int j = 0; j < nPois; j++)
+	{
+		if (j > 0)
+		{
+			putString(",", stringBuilder);
+		}
+		putString("{", stringBuilder);
+
+		char* hotspot = pblListGet(list, j);
+
+		char* ptr = hotspot;
+		if (latDifference != 0 || lonDifference != 0)
+		{
+			char* replacedLat = changeLat(hotspot, 1, -1 * latDifference);
+			ptr = changeLon(replacedLat, 5, -1 * lonDifference);
+			PBL_CGI_TRACE("Applied latDifference=%d and lonDifference=%d", latDifference, lonDifference);
+		}
+
+		if (bundleInteger > 0 && bundleInteger < 20230828)
+		{
+			char* oldBaseUrl = "arpoise.com\\/AB\\/";
+			char* newBaseUrl = "arpoise.com\\/AB\\/U2018\\/";
+			ptr = changeBaseUrl(ptr, oldBaseUrl, newBaseUrl);
+			//PBL_CGI_TRACE("Applied changeBaseUrl='%s' to '%s'", oldBaseUrl, newBaseUrl);
+		}
+		putString(ptr, stringBuilder);
+		putString("}", stringBuilder);
+	}
+
+	putString("]", stringBuilder);
+
+	putString(rest, stringBuilder);
+	PBL_CGI_TRACE("output=%s", pblStringBuilderToString(stringBuilder));
+	pblStringBuilderFree(stringBuilder);
+}
+
+static void createStatisticsFile(char* directory, char* fileName)
+{
+	char* filePath = pblCgiSprintf("%s/%s", directory, fileName);
+
+	FILE* stream = NULL;
+
+#ifdef WIN32
+	errno_t err = fopen_s(&stream, filePath, "r");
+	if (err != 0)
+	{
+		stream = NULL;
+	}
+#else
+	stream = fopen(filePath, "r");
+#endif
+	if (!stream)
+	{
+		stream = pblCgiFopen(filePath, "a");
+		if (stream)
+		{
+			fputs("<title>Arpoise</title>\n<body>copyright  2019, Tamiko Thiel and Peter Graf</body>\n", stream);
+		}
+	}
+	if (stream)
+	{
+		fclose(stream);
+	}
+	PBL_FREE(filePath);
+}
+
+void adbCreateStatisticsHits(int layer, char* layerName, int layerServed)
+{
+	char* count = pblCgiQueryValue("count");
+	if (pblCgiStrEquals("1", count))
+	{
+		PBL_CGI_TRACE("-------> Statistics Request\n");
+
+		// Create a web hit for the os and bundle, so that web stats can be used to count hits
+
+		char* versionsDirectory = pblCgiConfigValue("VersionsDirectory", "");
+		if (versionsDirectory && *versionsDirectory)
+		{
+			char* os = pblCgiQueryValue("os");
+			if (!os || !*os || strstr(os, ".."))
+			{
+				os = "UnknownOperatingSystem";
+			}
+
+			char* bundle = pblCgiQueryValue("bundle");
+			if (!bundle || !*bundle || strstr(bundle, ".."))
+			{
+				bundle = "UnknownBundle";
+			}
+
+			char* clientApplication = pblCgiQueryValue("client");
+			if (!clientApplication || !*clientApplication || strstr(clientApplication, ".."))
+			{
+				clientApplication = "UnknownClient";
+			}
+
+			char* fileName = pblCgiSprintf("%s_%s_%s.htm", os, clientApplication, bundle);
+			createStatisticsFile(versionsDirectory, fileName);
+			char* uri = pblCgiSprintf("/ArpoiseDirectory/AppVersions/%s", fileName);
+			adbGetHttpResponse("www.arpoise.com", 80, uri, 16, "ArpoiseDirectory/AppVersions");
+		}
+
+		// Create a web hit for the location, so that web stats can be used to count hits
+
+		char* locationsDirectory = pblCgiConfigValue("LocationsDirectory", "");
+		if (locationsDirectory && *locationsDirectory)
+		{
+			char* queryLat = pblCgiQueryValue("lat");
+			if (!queryLat || !*queryLat || strstr(queryLat, ".."))
+			{
+				queryLat = "UnknownLat";
+			}
+			else
+			{
+				queryLat = pblCgiStrDup(queryLat);
+			}
+			char* ptr = strstr(queryLat, ".");
+			if (ptr && strlen(ptr) > 4)
+			{
+				ptr[4] = '\0'; // truncate latitude to 3 digits after the '.'
+			}
+
+			char* queryLon = pblCgiQueryValue("lon");
+			if (!queryLon || !*queryLon || strstr(queryLon, ".."))
+			{
+				queryLon = "UnknownLon";
+			}
+			else
+			{
+				queryLon = pblCgiStrDup(queryLon);
+			}
+			ptr = strstr(queryLon, ".");
+			if (ptr && strlen(ptr) > 4)
+			{
+				ptr[4] = '\0'; // truncate longitude to 3 digits after the '.'
+			}
+
+			char* fileName = pblCgiSprintf("%s_%s-%s.htm", queryLon, queryLat, layerName);
+			createStatisticsFile(locationsDirectory, fileName);
+			char* uri = pblCgiSprintf("/ArpoiseDirectory/Locations/%s", fileName);
+			adbGetHttpResponse("www.arpoise.com", 80, uri, 16, "ArpoiseDirectory/Locations");
+		}
+
+		// Create a web hit for the layer, so that web stats can be used to count hits
+
+		char* layersDirectory = pblCgiConfigValue("LayersDirectory", "");
+		if (layer && layersDirectory && *layersDirectory && layerName && *layerName)
+		{
+			if (!layerName || !*layerName || strstr(layerName, ".."))
+			{
+				layerName = "UnknownLayer";
+			}
+
+			char* fileName = pblCgiSprintf("%s.htm", layerName);
+			createStatisticsFile(layersDirectory, fileName);
+			char* uri = pblCgiSprintf("/ArpoiseDirectory/Layers/%s", fileName);
+			adbGetHttpResponse("www.arpoise.com", 80, uri, 16, "ArpoiseDirectory/Layers");
+		}
+
+		// Create a web hit for the layer served, so that web stats can be used to count hits
+
+		char* layersServedDirectory = pblCgiConfigValue("LayersServedDirectory", "");
+		if (layerServed && layersServedDirectory && *layersServedDirectory && layerName && *layerName)
+		{
+			if (!layerName || !*layerName || strstr(layerName, ".."))
+			{
+				layerName = "UnknownLayer";
+			}
+
+			char* fileName = pblCgiSprintf("%s.htm", layerName);
+			createStatisticsFile(layersServedDirectory, fileName);
+			char* uri = pblCgiSprintf("/ArpoiseDirectory/LayersServed/%s", fileName);
+			adbGetHttpResponse("www.arpoise.com", 80, uri, 16, "ArpoiseDirectory/LayersServed");
+		}
+	}
+}
+
+static void freeStringList(PblList* list)
+{
+	while (!pblListIsEmpty(list))
+	{
+		pbl_free(pblListPop(list));
+	}
+	pblListFree(list);
+}
+
+static int adbGetIntValue(char* queryString, char* label)
+{
+	int value = 0;
+	char* start = strstr(queryString, label);
+	if (start)
+	{
+		// strtod stops at the '&' of the next parameter
+		//
+		double lDouble = strtod(start + strlen(label), NULL);
+		value = (int)(1000000.0 * lDouble);
+	}
+	return value;
+}
+
+static int adbGetLat(char* queryString)
+{
+	return adbGetIntValue(queryString, "lat=");
+}
+
+static int adbGetLon(char* queryString)
+{
+	return adbGetIntValue(queryString, "lon=");
+}
+
+/*
+* The outline of a polygon area.
+*
+* The edges are split into bands of latitude, a location is only tested against the edges
+* of its band. The coordinates are relative to the bounding box of the area, the
+* edges of a band are stored as arrays, so the crossing test can be vectorized.
+*/
+typedef struct AdbPolygon_s
+{
+	int nBands;
+	int* bandStart;         /* Start of the edges of a band, nBands + 1 values */
+	double* lat0;
+	double* lon0;
+	double* lat1;
+	double* lon1;
+
+} AdbPolygon;
+
+/*
+* An area of the configuration, lat and lon in millionths of a degree.
+*
+* The area is either the rectangle given by its bounding box or a polygon inside the box.
+*/
+typedef struct AdbArea_s
+{
+	int minLat;
+	int minLon;
+	int maxLat;
+	int maxLon;
+	char* key;
+	AdbPolygon* polygon;    /* NULL for a rectangle */
+	AdbAreaConfig* config;
+
+} AdbArea;
+
+#define ADB_POLYGON_EDGES_PER_BAND 4
+#define ADB_POLYGON_MAX_BANDS 4096
+#define ADB_POLYGON_MAX_COPIES_PER_EDGE 16
+
+/*
+* The areas of a configuration as seen by one client application, in the order they are checked.
+*
+* A uniform grid over the bounding box of the areas lists for each cell the areas overlapping it,
+* in ascending order. Areas overlapping many cells are kept in a separate list that is merged
+* into the cell list when searching, so the first area containing a location is found in both.
+*/
+typedef struct AdbAreaIndex_s
+{
+	char* clientApplication;
+
+	int nAreas;
+	AdbArea* areas;
+
+	int minLat;
+	int minLon;
+	int maxLat;
+	int maxLon;
+	int nLatCells;
+	int nLonCells;
+	int* cellStart;         /* Start of the areas of a cell in cellAreas, nLatCells * nLonCells + 1 values */
+	int* cellAreas;
+
+	int nLargeAreas;
+	int* largeAreas;
+
+	AdbAreaConfig* defaultConfig;   /* The configuration used outside of all areas */
+
+} AdbAreaIndex;
+
+#define ADB_AREA_MAX_CELLS_PER_AREA 64
+
+char* adbGetAreaConfigValue(char* area, char* key, char* defaultValue);
+
+static void* adbMalloc(char* tag, size_t size)
+{
+	void* ptr = pbl_malloc0(tag, size ? size : 1);
+	if (!ptr)
+	{
+		pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
+	}
+	return ptr;
+}
+
+static int adbAreaLatCell(AdbAreaIndex* index, int lat)
+{
+	return (int)(((long long)lat - index->minLat) * index->nLatCells / ((long long)index->maxLat - index->minLat + 1));
+}
+
+static int adbAreaLonCell(AdbAreaIndex* index, int lon)
+{
+	return (int)(((long long)lon - index->minLon) * index->nLonCells / ((long long)index->maxLon - index->minLon + 1));
+}
+
+static int adbPolygonBand(AdbArea* area, int lat)
+{
+	return (int)(((long long)lat - area->minLat) * area->polygon->nBands / ((long long)area->maxLat - area->minLat + 1));
+}
+
+/*
+* Create the polygon of an area from the lat,lon pairs of its vertices, the bounding box is set in the area.
+*/
+static void adbPolygonNew(AdbArea* area, PblList* locationList)
+{
+	static char* tag = "adbPolygonNew";
+
+	int nVertices = pblListSize(locationList) / 2;
+	int* lat = adbMalloc(tag, (nVertices + 1) * sizeof(int));
+	int* lon = adbMalloc(tag, (nVertices + 1) * sizeof(int));
+
+	area->minLat = area->minLon = INT_MAX;
+	area->maxLat = area->maxLon = INT_MIN;
+	for (int i = 0; i < nVertices; i++)
+	{
+		lat[i] = atoi(pblListGet(locationList, 2 * i));
+		lon[i] = atoi(pblListGet(locationList, 2 * i + 1));
+		area->minLat = lat[i] < area->minLat ? lat[i] : area->minLat;
+		area->minLon = lon[i] < area->minLon ? lon[i] : area->minLon;
+		area->maxLat = lat[i] > area->maxLat ? lat[i] : area->maxLat;
+		area->maxLon = lon[i] > area->maxLon ? lon[i] : area->maxLon;
+	}
+
+	// The outline is closed by the edge from the last to the first vertex
+	//
+	lat[nVertices] = lat[0];
+	lon[nVertices] = lon[0];
+
+	AdbPolygon* polygon = area->polygon = adbMalloc(tag, sizeof(AdbPolygon));
+	polygon->nBands = (nVertices + ADB_POLYGON_EDGES_PER_BAND - 1) / ADB_POLYGON_EDGES_PER_BAND;
+	if (polygon->nBands > ADB_POLYGON_MAX_BANDS)
+	{
+		polygon->nBands = ADB_POLYGON_MAX_BANDS;
+	}
+
+	// An edge is stored in every band it crosses, use fewer bands for outlines with many long edges
+	//
+	for (;;)
+	{
+		long long nBandEdges = 0;
+		for (int i = 0; i < nVertices; i++)
+		{
+			nBandEdges += abs(adbPolygonBand(area, lat[i]) - adbPolygonBand(area, lat[i + 1])) + 1;
+		}
+		if (nBandEdges <= (long long)ADB_POLYGON_MAX_COPIES_PER_EDGE * nVertices || polygon->nBands == 1)
+		{
+			break;
+		}
+		polygon->nBands /= 2;
+	}
+	polygon->bandStart = adbMalloc(tag, (polygon->nBands + 1) * sizeof(int));
+
+	// Count the edges of the bands, then fill the bands
+	//
+	int* bandFill = NULL;
+	for (int pass = 0; pass < 2; pass++)
+	{
+		if (pass == 1)
+		{
+			for (int band = 0; band < polygon->nBands; band++)
+			{
+				polygon->bandStart[band + 1] += polygon->bandStart[band];
+			}
+			int nEdges = polygon->bandStart[polygon->nBands];
+			polygon->lat0 = adbMalloc(tag, nEdges * sizeof(double));
+			polygon->lon0 = adbMalloc(tag, nEdges * sizeof(double));
+			polygon->lat1 = adbMalloc(tag, nEdges * sizeof(double));
+			polygon->lon1 = adbMalloc(tag, nEdges * sizeof(double));
+			bandFill = adbMalloc(tag, polygon->nBands * sizeof(int));
+			memcpy(bandFill, polygon->bandStart, polygon->nBands * sizeof(int));
+		}
+
+		for (int i = 0; i < nVertices; i++)
+		{
+			int minBand = adbPolygonBand(area, lat[i] < lat[i + 1] ? lat[i] : lat[i + 1]);
+			int maxBand = adbPolygonBand(area, lat[i] > lat[i + 1] ? lat[i] : lat[i + 1]);
+			for (int band = minBand; band <= maxBand; band++)
+			{
+				if (pass == 0)
+				{
+					polygon->bandStart[band + 1]++;
+					continue;
+				}
+				int edge = bandFill[band]++;
+				polygon->lat0[edge] = (double)lat[i] - area->minLat;
+				polygon->lon0[edge] = (double)lon[i] - area->minLon;
+				polygon->lat1[edge] = (double)lat[i + 1] - area->minLat;
+				polygon->lon1[edge] = (double)lon[i + 1] - area->minLon;
+			}
+		}
+	}
+	PBL_FREE(bandFill);
+	PBL_FREE(lat);
+	PBL_FREE(lon);
+}
+
+#ifdef __GNUC__
+typedef double AdbDouble4 __attribute__((vector_size(4 * sizeof(double))));
+typedef long long AdbLong4 __attribute__((vector_size(4 * sizeof(long long))));
+#endif
+
+/*
+* Count the edges crossed by a ray from the location towards increasing longitude.
+*
+* An edge is crossed if it straddles the latitude of the location and the location is left of it.
+* With gcc and clang four edges are tested at once using vector extensions,
+* the compiler uses the SIMD instructions available for the target.
+*/
+static int adbPolygonCrossings(const double* lat0, const double* lon0,
+	const double* lat1, const double* lon1, int nEdges, double lat, double lon)
+{
+	int crossings = 0;
+	int i = 0;
+
+#ifdef __GNUC__
+	AdbDouble4 vLat = { lat, lat, lat, lat };
+	AdbDouble4 vLon = { lon, lon, lon, lon };
+	AdbDouble4 vZero = { 0, 0, 0, 0 };
+	AdbLong4 vCrossings = { 0, 0, 0, 0 };
+
+	for (; i + 4 <= nEdges; i += 4)
+	{
+		AdbDouble4 vLat0, vLon0, vLat1, vLon1;
+		memcpy(&vLat0, lat0 + i, sizeof(vLat0));
+		memcpy(&vLon0, lon0 + i, sizeof(vLon0));
+		memcpy(&vLat1, lat1 + i, sizeof(vLat1));
+		memcpy(&vLon1, lon1 + i, sizeof(vLon1));
+
+		AdbLong4 straddles = (vLat0 > vLat) ^ (vLat1 > vLat);
+		AdbDouble4 side = (vLon - vLon0) * (vLat1 - vLat0) - (vLon1 - vLon0) * (vLat - vLat0);
+		AdbLong4 left = ~((side < vZero) ^ (vLat1 > vLat0));
+
+		// The comparisons yield -1 for true
+		//
+		vCrossings -= straddles & left;
+	}
+	crossings = (int)(vCrossings[0] + vCrossings[1] + vCrossings[2] + vCrossings[3]);
+#endif
+
+	for (; i < nEdges; i++)
+	{
+		int straddles = (lat0[i] > lat) != (lat1[i] > lat);
+		double side = (lon - lon0[i]) * (lat1[i] - lat0[i]) - (lon1[i] - lon0[i]) * (lat - lat0[i]);
+		int left = (side < 0) == (lat1[i] > lat0[i]);
+		crossings += straddles & left;
+	}
+	return crossings;
+}
+
+/*
+* Test whether a location is inside an area, locations on the outline of a polygon may be inside or outside.
+*/
+static int adbAreaContains(AdbArea* area, int lat, int lon)
+{
+	if (lat < area->minLat || lon < area->minLon || lat > area->maxLat || lon > area->maxLon)
+	{
+		return 0;
+	}
+	AdbPolygon* polygon = area->polygon;
+	if (!polygon)
+	{
+		return 1;
+	}
+	int band = adbPolygonBand(area, lat);
+	int start = polygon->bandStart[band];
+	return adbPolygonCrossings(polygon->lat0 + start, polygon->lon0 + start, polygon->lat1 + start, polygon->lon1 + start,
+		polygon->bandStart[band + 1] - start, (double)lat - area->minLat, (double)lon - area->minLon) & 1;
+}
+
+/*
+* Resolve the configuration values of an area, NULL for the values used outside of all areas.
+*/
+static AdbAreaConfig* adbAreaConfigNew(char* area)
+{
+	static char* tag = "adbAreaConfigNew";
+
+	AdbAreaConfig* config = adbMalloc(tag, sizeof(AdbAreaConfig));
+	config->area = area;
+
+	config->hostName = adbGetAreaConfigValue(area, "HostName", "www.arpoise.com");
+	config->port = 80;
+	char* portString = adbGetAreaConfigValue(area, "Port", "80");
+	if (!pblCgiStrIsNullOrWhiteSpace(portString))
+	{
+		config->port = atoi(portString);
+	}
+	config->directoryUri = adbGetAreaConfigValue(area, "DirectoryUri", "/php/dir/web/porpoise.php");
+	config->porpoiseUri = adbGetAreaConfigValue(area, "PorpoiseUri", "/php/porpoise/web/porpoise.php");
+
+	config->defaultDirectory = adbGetAreaConfigValue(area, "DefaultDirectory", "");
+	config->defaultLayerUrl = adbGetAreaConfigValue(area, "DefaultLayerUrl", "/php/porpoise/web/porpoise.php");
+	config->defaultLayerName = adbGetAreaConfigValue(area, "DefaultLayerName", "Default-Layer-Reign-of-Gold");
+
+	config->arvosDefaultDirectory = adbGetAreaConfigValue(area, "ArvosDefaultDirectory", "");
+	config->arvosDefaultLayerUrl = adbGetAreaConfigValue(area, "ArvosDefaultLayerUrl", "/php/porpoise/web/porpoise.php");
+	config->arvosDefaultLayerName = adbGetAreaConfigValue(area, "ArvosDefaultLayerName", "Default-ImageTrigger");
+
+	config->httpRetries = atoi(adbGetAreaConfigValue(area, "HttpRetries", "2"));
+	config->httpRetryBackoff = atoi(adbGetAreaConfigValue(area, "HttpRetryBackoff", "100"));
+	config->httpHedgePercentile = atoi(adbGetAreaConfigValue(area, "HttpHedgePercentile", "0"));
+	config->speculativeRequests = atoi(adbGetAreaConfigValue(area, "SpeculativeRequests", "0"));
+
+	return config;
+}
+
+/*
+* Read the areas of the configuration in the order adbGetArea checks them.
+*
+* For each n the area of the client application, e.g. Arpoise_Area_n, is checked before Area_n.
+* The list ends at the first n without a plain Area_n and without a valid area of the client.
+* An area value is either minLat,minLon,maxLat,maxLon of a rectangle or at least
+* three lat,lon pairs, the vertices of a polygon.
+*/
+static void adbAreaIndexReadAreas(AdbAreaIndex* index)
+{
+	static char* tag = "adbAreaIndexReadAreas";
+
+	PblList* areaList = pblListNewArrayList();
+	if (!areaList)
+	{
+		pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
+	}
+
+	char* clientPrefix = NULL;
+	if (pblCgiStrEquals(ArvosApplicationName, index->clientApplication))
+	{
+		clientPrefix = ArvosApplicationName;
+	}
+	else if (pblCgiStrEquals(ArpoiseApplicationName, index->clientApplication))
+	{
+		clientPrefix = ArpoiseApplicationName;
+	}
+
+	int done = 0;
+	for (int i = 1; !done; i++)
+	{
+		int areaHasValue = 0;
+
+		for (int j = 0; j < 2; j++)
+		{
+			if (j == 0 && !clientPrefix)
+			{
+				continue;
+			}
+			char* areaKey = j == 0 ? pblCgiSprintf("%s_Area_%d", clientPrefix, i) : pblCgiSprintf("Area_%d", i);
+			char* areaValue = pblCgiConfigValue(areaKey, NULL);
+			if (pblCgiStrIsNullOrWhiteSpace(areaValue))
+			{
+				PBL_FREE(areaKey);
+				if (j == 0)
+				{
+					continue;
+				}
+				done = !areaHasValue;
+				break;
+			}
+
+			PblList* locationList = pblCgiStrSplitToList(areaValue, ",");
+			int size = pblListSize(locationList);
+			if (size != 4 && (size < 6 || size % 2))
+			{
+				PBL_CGI_TRACE("%s, expecting 4 location values or at least 3 lat,lon pairs, current value is %s", areaKey, areaValue);
+				freeStringList(locationList);
+				PBL_FREE(areaKey);
+				continue;
+			}
+			areaHasValue = 1;
+
+			AdbArea* area = adbMalloc(tag, sizeof(AdbArea));
+			if (size == 4)
+			{
+				area->minLat = atoi(pblListGet(locationList, 0));
+				area->minLon = atoi(pblListGet(locationList, 1));
+				area->maxLat = atoi(pblListGet(locationList, 2));
+				area->maxLon = atoi(pblListGet(locationList, 3));
+			}
+			else
+			{
+				adbPolygonNew(area, locationList);
+			}
+			area->key = areaKey;
+			area->config = adbAreaConfigNew(areaKey);
+			freeStringList(locationList);
+
+			if (area->minLat > area->maxLat || area->minLon > area->maxLon)
+			{
+				PBL_CGI_TRACE("%s, area value %s is empty", areaKey, areaValue);
+				PBL_FREE(area->config);
+				PBL_FREE(area->key);
+				PBL_FREE(area);
+				continue;
+			}
+			if (area->polygon)
+			{
+				PBL_CGI_TRACE("%s, polygon with %d vertices, %d bands", areaKey, size / 2, area->polygon->nBands);
+			}
+			if (pblListAdd(areaList, area) < 0)
+			{
+				pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
+			}
+		}
+	}
+
+	index->nAreas = pblListSize(areaList);
+	index->areas = adbMalloc(tag, index->nAreas * sizeof(AdbArea));
+	for (int i = 0; i < index->nAreas; i++)
+	{
+		AdbArea* area = pblListGet(areaList, i);
+		index->areas[i] = *area;
+		PBL_FREE(area);
+	}
+	pblListFree(areaList);
+}
+
+/*
+* Create the index of the areas of the configuration for a client application.
+*/
+static AdbAreaIndex* adbAreaIndexNew(char* clientApplication)
+{
+	static char* tag = "adbAreaIndexNew";
+
+	AdbAreaIndex* index = adbMalloc(tag, sizeof(AdbAreaIndex));
+	index->clientApplication = pblCgiStrDup(clientApplication ? clientApplication : "");
+
+	adbAreaIndexReadAreas(index);
+	index->defaultConfig = adbAreaConfigNew(NULL);
+
+	index->minLat = index->minLon = INT_MAX;
+	index->maxLat = index->maxLon = INT_MIN;
+	for (int i = 0; i < index->nAreas; i++)
+	{
+		AdbArea* area = index->areas + i;
+		index->minLat = area->minLat < index->minLat ? area->minLat : index->minLat;
+		index->minLon = area->minLon < index->minLon ? area->minLon : index->minLon;
+		index->maxLat = area->maxLat > index->maxLat ? area->maxLat : index->maxLat;
+		index->maxLon = area->maxLon > index->maxLon ? area->maxLon : index->maxLon;
+	}
+
+	// About one cell per area
+	//
+	int nCells = 1;
+	while (nCells * nCells < index->nAreas && nCells < 1024)
+	{
+		nCells++;
+	}
+	index->nLatCells = index->nAreas > 0 ? nCells : 0;
+	index->nLonCells = index->nLatCells;
+	nCells = index->nLatCells * index->nLonCells;
+
+	index->cellStart = adbMalloc(tag, (nCells + 1) * sizeof(int));
+	index->largeAreas = adbMalloc(tag, index->nAreas * sizeof(int));
+
+	// Count the areas of the cells, then fill the cells in the order of the areas
+	//
+	for (int pass = 0; pass < 2; pass++)
+	{
+		int* cellFill = NULL;
+		if (pass == 1)
+		{
+			for (int cell = 0; cell < nCells; cell++)
+			{
+				index->cellStart[cell + 1] += index->cellStart[cell];
+			}
+			index->cellAreas = adbMalloc(tag, index->cellStart[nCells] * sizeof(int));
+			cellFill = adbMalloc(tag, (nCells + 1) * sizeof(int));
+			memcpy(cellFill, index->cellStart, (nCells + 1) * sizeof(int));
+			index->nLargeAreas = 0;
+		}
+
+		for (int i = 0; i < index->nAreas; i++)
+		{
+			AdbArea* area = index->areas + i;
+			int minLatCell = adbAreaLatCell(index, area->minLat);
+			int maxLatCell = adbAreaLatCell(index, area->maxLat);
+			int minLonCell = adbAreaLonCell(index, area->minLon);
+			int maxLonCell = adbAreaLonCell(index, area->maxLon);
+
+			if ((maxLatCell - minLatCell + 1) * (maxLonCell - minLonCell + 1) > ADB_AREA_MAX_CELLS_PER_AREA)
+			{
+				if (pass == 1)
+				{
+					index->largeAreas[index->nLargeAreas++] = i;
+				}
+				continue;
+			}
+			for (int latCell = minLatCell; latCell <= maxLatCell; latCell++)
+			{
+				for (int lonCell = minLonCell; lonCell <= maxLonCell; lonCell++)
+				{
+					int cell = latCell * index->nLonCells + lonCell;
+					if (pass == 0)
+					{
+						index->cellStart[cell + 1]++;
+					}
+					else
+					{
+						index->cellAreas[cellFill[cell]++] = i;
+					}
+				}
+			}
+		}
+		PBL_FREE(cellFill);
+	}
+
+	PBL_CGI_TRACE("Area index for client '%s', %d areas, %d x %d cells, %d large areas",
+		index->clientApplication, index->nAreas, index->nLatCells, index->nLonCells, index->nLargeAreas);
+	return index;
+}
+
+/*
+* Release an area index, the strings and arrays of an index read from a snapshot are part of the snapshot.
+*/
+static void adbAreaIndexFree(AdbAreaIndex* index, int inSnapshot)
+{
+	if (!index)
+	{
+		return;
+	}
+	for (int i = 0; i < index->nAreas; i++)
+	{
+		AdbArea* area = index->areas + i;
+		if (area->polygon)
+		{
+			if (!inSnapshot)
+			{
+				PBL_FREE(area->polygon->bandStart);
+				PBL_FREE(area->polygon->lat0);
+				PBL_FREE(area->polygon->lon0);
+				PBL_FREE(area->polygon->lat1);
+				PBL_FREE(area->polygon->lon1);
+			}
+			PBL_FREE(area->polygon);
+		}
+		if (!inSnapshot)
+		{
+			PBL_FREE(area->key);
+		}
+		PBL_FREE(area->config);
+	}
+	PBL_FREE(index->areas);
+	PBL_FREE(index->defaultConfig);
+	if (!inSnapshot)
+	{
+		PBL_FREE(index->clientApplication);
+		PBL_FREE(index->cellStart);
+		PBL_FREE(index->cellAreas);
+		PBL_FREE(index->largeAreas);
+	}
+	PBL_FREE(index);
+}
+
+/*
+* Get the area index of the current configuration for a client application, the index of a text
+* configuration is created by the first request of a process needing it and lives on the heap.
+*/
+static AdbAreaIndex* adbGetAreaIndex(char* clientApplication)
+{
+	static char* clientApplications[ADB_N_CLIENTS] = { "Arvos", "Arpoise", "" };
+
+	AdbConfig* config = adbGetConfig();
+	int client = adbClientIndex(clientApplication);
+
+	AdbAreaIndex* index = ADB_ATOMIC_LOAD(&config->areaIndexes[client]);
+	if (!index)
+	{
+		PblArena* arena = pblArenaSet(NULL);
+		AdbAreaIndex* newIndex = adbAreaIndexNew(clientApplications[client]);
+		pblArenaSet(arena);
+
+		// Of threads creating the index at the same time, the first one sets it
+		//
+		if (ADB_ATOMIC_CAS(&config->areaIndexes[client], &index, newIndex))
+		{
+			index = newIndex;
+		}
+		else
+		{
+			adbAreaIndexFree(newIndex, 0);
+		}
+	}
+	return index;
+}
+
+/*
+* Get the configuration of the first area containing the location of the query,
+* the areas are looked up in the area index without allocating memory.
+*/
+AdbAreaConfig* adbGetAreaConfig(char* queryString, char* clientApplication)
+{
+	int lat = adbGetLat(queryString);
+	int lon = adbGetLon(queryString);
+
+	AdbAreaIndex* index = adbGetAreaIndex(clientApplication);
+	if (index->nAreas > 0
+		&& lat >= index->minLat && lon >= index->minLon && lat <= index->maxLat && lon <= index->maxLon)
+	{
+		int cell = adbAreaLatCell(index, lat) * index->nLonCells + adbAreaLonCell(index, lon);
+		int* cellAreas = index->cellAreas + index->cellStart[cell];
+		int nCellAreas = index->cellStart[cell + 1] - index->cellStart[cell];
+		int* largeAreas = index->largeAreas;
+		int nLargeAreas = index->nLargeAreas;
+
+		// Check the areas of the cell and the large areas in ascending order
+		//
+		while (nCellAreas > 0 || nLargeAreas > 0)
+		{
+			int i;
+			if (nLargeAreas < 1 || (nCellAreas > 0 && *cellAreas < *largeAreas))
+			{
+				i = *cellAreas++;
+				nCellAreas--;
+			}
+			else
+			{
+				i = *largeAreas++;
+				nLargeAreas--;
+			}
+
+			AdbArea* area = index->areas + i;
+			if (adbAreaContains(area, lat, lon))
+			{
+				PBL_CGI_TRACE("%s, lat %d, lon %d is inside %s %d,%d,%d,%d", area->key, lat, lon,
+					area->polygon ? "polygon" : "area", area->minLat, area->minLon, area->maxLat, area->maxLon);
+				if (adbCircuitIsOpen(area->config->hostName, area->config->port))
+				{
+					PBL_CGI_TRACE("Circuit of %s:%d is open, using the values without area prefix", area->config->hostName, area->config->port);
+					return adbRequestArea = index->defaultConfig;
+				}
+				return adbRequestArea = area->config;
+			}
+		}
+	}
+	PBL_CGI_TRACE("lat %d, lon %d is outside of all %d areas", lat, lon, index->nAreas);
+	return adbRequestArea = index->defaultConfig;
+}
+
+/*
+* Get the first configured area containing the location of the query, NULL if there is none.
+*/
+char* adbGetArea(char* queryString, char* clientApplication)
+{
+	return adbGetAreaConfig(queryString, clientApplication)->area;
+}
+
+char* adbGetAreaConfigValue(char* area, char* key, char* defaultValue)
+{
+	char* valueString = NULL;
+	if (!pblCgiStrIsNullOrWhiteSpace(area))
+	{
+		char* areaKey = pblCgiSprintf("%s_%s", area, key);
+		valueString = pblCgiConfigValue(areaKey, NULL);
+		PBL_FREE(areaKey);
+	}
+	if (pblCgiStrIsNullOrWhiteSpace(valueString))
+	{
+		valueString = pblCgiConfigValue(key, defaultValue);
+	}
+	if (pblCgiStrIsNullOrWhiteSpace(valueString))
+	{
+		PBL_CGI_TRACE("No value for %s", key);
+	}
+	return valueString;
+}
+
+/*
+* The snapshot of a configuration, written by adbConfigCompile and mapped by adbConfigLoad.
+*
+* All positions in the snapshot are offsets from its start, 0 for NULL, every section is 8 byte aligned.
+* The header is followed by the config table, the area indexes with their strings and the position tables.
+*/
+#define ADB_SNAPSHOT_MAGIC "ADBSNAP"
+#define ADB_SNAPSHOT_VERSION 6
+
+#ifdef _WIN32
+#define ADB_STAT_MTIME_NS(st) ((int64_t)(st).st_mtime * 1000000000)
+#else
+#define ADB_STAT_MTIME_NS(st) ((int64_t)(st).st_mtim.tv_sec * 1000000000 + (st).st_mtim.tv_nsec)
+#endif
+
+typedef struct AdbSnapshotHeader_s
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t size;
+	int64_t sourceSize;        /* Size and FNV-1a hash of the text configuration file */
+	uint64_t sourceHash;
+	int64_t sourceMtime;       /* Modification time in nanoseconds and inode of the text configuration file */
+	uint64_t sourceInode;
+	uint32_t configTable;
+	uint32_t areaIndexes[ADB_N_CLIENTS];
+	uint32_t positionTables[ADB_N_POSITIONS];
+
+} AdbSnapshotHeader;
+
+typedef struct AdbSnapshotAreaConfig_s
+{
+	uint32_t area;
+	uint32_t hostName;
+	int32_t port;
+	uint32_t directoryUri;
+	uint32_t porpoiseUri;
+	uint32_t defaultDirectory;
+	uint32_t defaultLayerUrl;
+	uint32_t defaultLayerName;
+	uint32_t arvosDefaultDirectory;
+	uint32_t arvosDefaultLayerUrl;
+	uint32_t arvosDefaultLayerName;
+	int32_t httpRetries;
+	int32_t httpRetryBackoff;
+	int32_t httpHedgePercentile;
+	int32_t speculativeRequests;
+
+} AdbSnapshotAreaConfig;
+
+typedef struct AdbSnapshotPolygon_s
+{
+	int32_t nBands;
+	uint32_t bandStart;
+	uint32_t lat0;
+	uint32_t lon0;
+	uint32_t lat1;
+	uint32_t lon1;
+
+} AdbSnapshotPolygon;
+
+typedef struct AdbSnapshotArea_s
+{
+	int32_t minLat;
+	int32_t minLon;
+	int32_t maxLat;
+	int32_t maxLon;
+	uint32_t key;
+	uint32_t polygon;
+	uint32_t config;
+
+} AdbSnapshotArea;
+
+typedef struct AdbSnapshotAreaIndex_s
+{
+	int32_t nAreas;
+	int32_t minLat;
+	int32_t minLon;
+	int32_t maxLat;
+	int32_t maxLon;
+	int32_t nLatCells;
+	int32_t nLonCells;
+	int32_t nLargeAreas;
+	uint32_t clientApplication;
+	uint32_t areas;
+	uint32_t cellStart;
+	uint32_t cellAreas;
+	uint32_t largeAreas;
+	uint32_t defaultConfig;
+
+} AdbSnapshotAreaIndex;
+
+/*
+* The buffer a snapshot is written to, strings are only written once.
+*/
+typedef struct AdbSnapshotBuffer_s
+{
+	char* data;
+	size_t size;
+	size_t capacity;
+	PblMap* strings;         /* Maps the strings written to their offsets */
+
+} AdbSnapshotBuffer;
+
+/*
+* Append a section to the snapshot, NULL data appends zeros.
+*/
+static uint32_t adbSnapshotAppend(AdbSnapshotBuffer* buffer, void* data, size_t size)
+{
+	static char* tag = "adbSnapshotAppend";
+
+	size_t offset = (buffer->size + 7) & ~(size_t)7;
+	if (offset + size > UINT32_MAX)
+	{
+		pblCgiExitOnError("%s: The snapshot is larger than 4 GB\n", tag);
+	}
+	if (offset + size > buffer->capacity)
+	{
+		size_t capacity = buffer->capacity ? buffer->capacity : 64 * 1024;
+		while (capacity < offset + size)
+		{
+			capacity *= 2;
+		}
+		char* data = adbMalloc(tag, capacity);
+		if (buffer->data)
+		{
+			memcpy(data, buffer->data, buffer->size);
+			PBL_FREE(buffer->data);
+		}
+		buffer->data = data;
+		buffer->capacity = capacity;
+	}
+	if (data)
+	{
+		memcpy(buffer->data + offset, data, size);
+	}
+	buffer->size = offset + size;
+	return (uint32_t)offset;
+}
+
+static uint32_t adbSnapshotString(AdbSnapshotBuffer* buffer, char* string)
+{
+	static char* tag = "adbSnapshotString";
+
+	if (!string)
+	{
+		return 0;
+	}
+	size_t length = strlen(string) + 1;
+	size_t offsetLength = 0;
+	uint32_t* known = pblMapGet(buffer->strings, string, length, &offsetLength);
+	if (known)
+	{
+		return *known;
+	}
+	uint32_t offset = adbSnapshotAppend(buffer, string, length);
+	if (pblMapAdd(buffer->strings, string, length, &offset, sizeof(offset)) < 0)
+	{
+		pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
+	}
+	return offset;
+}
+
+static uint32_t adbSnapshotAreaConfig(AdbSnapshotBuffer* buffer, AdbAreaConfig* config)
+{
+	AdbSnapshotAreaConfig snapshotConfig;
+	snapshotConfig.area = adbSnapshotString(buffer, config->area);
+	snapshotConfig.hostName = adbSnapshotString(buffer, config->hostName);
+	snapshotConfig.port = config->port;
+	snapshotConfig.directoryUri = adbSnapshotString(buffer, config->directoryUri);
+	snapshotConfig.porpoiseUri = adbSnapshotString(buffer, config->porpoiseUri);
+	snapshotConfig.defaultDirectory = adbSnapshotString(buffer, config->defaultDirectory);
+	snapshotConfig.defaultLayerUrl = adbSnapshotString(buffer, config->defaultLayerUrl);
+	snapshotConfig.defaultLayerName = adbSnapshotString(buffer, config->defaultLayerName);
+	snapshotConfig.arvosDefaultDirectory = adbSnapshotString(buffer, config->arvosDefaultDirectory);
+	snapshotConfig.arvosDefaultLayerUrl = adbSnapshotString(buffer, config->arvosDefaultLayerUrl);
+	snapshotConfig.arvosDefaultLayerName = adbSnapshotString(buffer, config->arvosDefaultLayerName);
+	snapshotConfig.httpRetries = config->httpRetries;
+	snapshotConfig.httpRetryBackoff = config->httpRetryBackoff;
+	snapshotConfig.httpHedgePercentile = config->httpHedgePercentile;
+	snapshotConfig.speculativeRequests = config->speculativeRequests;
+	return adbSnapshotAppend(buffer, &snapshotConfig, sizeof(snapshotConfig));
+}
+
+static uint32_t adbSnapshotPolygon(AdbSnapshotBuffer* buffer, AdbPolygon* polygon)
+{
+	int nEdges = polygon->bandStart[polygon->nBands];
+
+	AdbSnapshotPolygon snapshotPolygon;
+	snapshotPolygon.nBands = polygon->nBands;
+	snapshotPolygon.bandStart = adbSnapshotAppend(buffer, polygon->bandStart, (polygon->nBands + 1) * sizeof(int));
+	snapshotPolygon.lat0 = adbSnapshotAppend(buffer, polygon->lat0, nEdges * sizeof(double));
+	snapshotPolygon.lon0 = adbSnapshotAppend(buffer, polygon->lon0, nEdges * sizeof(double));
+	snapshotPolygon.lat1 = adbSnapshotAppend(buffer, polygon->lat1, nEdges * sizeof(double));
+	snapshotPolygon.lon1 = adbSnapshotAppend(buffer, polygon->lon1, nEdges * sizeof(double));
+	return adbSnapshotAppend(buffer, &snapshotPolygon, sizeof(snapshotPolygon));
+}
+
+static uint32_t adbSnapshotAreaIndex(AdbSnapshotBuffer* buffer, AdbAreaIndex* index)
+{
+	int nCells = index->nLatCells * index->nLonCells;
+
+	AdbSnapshotAreaIndex snapshotIndex;
+	snapshotIndex.nAreas = index->nAreas;
+	snapshotIndex.minLat = index->minLat;
+	snapshotIndex.minLon = index->minLon;
+	snapshotIndex.maxLat = index->maxLat;
+	snapshotIndex.maxLon = index->maxLon;
+	snapshotIndex.nLatCells = index->nLatCells;
+	snapshotIndex.nLonCells = index->nLonCells;
+	snapshotIndex.nLargeAreas = index->nLargeAreas;
+	snapshotIndex.clientApplication = adbSnapshotString(buffer, index->clientApplication);
+	snapshotIndex.cellStart = adbSnapshotAppend(buffer, index->cellStart, (nCells + 1) * sizeof(int));
+	snapshotIndex.cellAreas = adbSnapshotAppend(buffer, index->cellAreas, index->cellStart[nCells] * sizeof(int));
+	snapshotIndex.largeAreas = adbSnapshotAppend(buffer, index->largeAreas, index->nLargeAreas * sizeof(int));
+	snapshotIndex.defaultConfig = adbSnapshotAreaConfig(buffer, index->defaultConfig);
+
+	// The areas are written after their polygons and configurations
+	//
+	AdbSnapshotArea* areas = adbMalloc("adbSnapshotAreaIndex", index->nAreas * sizeof(AdbSnapshotArea));
+	for (int i = 0; i < index->nAreas; i++)
+	{
+		AdbArea* area = index->areas + i;
+		areas[i].minLat = area->minLat;
+		areas[i].minLon = area->minLon;
+		areas[i].maxLat = area->maxLat;
+		areas[i].maxLon = area->maxLon;
+		areas[i].key = adbSnapshotString(buffer, area->key);
+		areas[i].polygon = area->polygon ? adbSnapshotPolygon(buffer, area->polygon) : 0;
+		areas[i].config = adbSnapshotAreaConfig(buffer, area->config);
+	}
+	snapshotIndex.areas = adbSnapshotAppend(buffer, areas, index->nAreas * sizeof(AdbSnapshotArea));
+	PBL_FREE(areas);
+
+	return adbSnapshotAppend(buffer, &snapshotIndex, sizeof(snapshotIndex));
+}
+
+/*
+* The snapshot of a text configuration file, ../config/ArpoiseDirectory.bin for ../config/ArpoiseDirectory.txt
+*/
+static char* adbConfigSnapshotPath(char* configPath)
+{
+	size_t length = strlen(configPath);
+	if (length > 4 && !strcmp(configPath + length - 4, ".txt"))
+	{
+		char* snapshotPath = pblCgiStrDup(configPath);
+		strcpy(snapshotPath + length - 4, ".bin");
+		return snapshotPath;
+	}
+	return pblCgiStrCat(configPath, ".bin");
+}
+
+/*
+* Get the FNV-1a hash of a file, returns 0 if the file cannot be read.
+*/
+static uint64_t adbFileHash(char* path)
+{
+	FILE* stream = fopen(path, "rb");
+	if (!stream)
+	{
+		return 0;
+	}
+	uint64_t hash = 14695981039346656037ULL;
+	unsigned char buffer[64 * 1024];
+	size_t n;
+	while ((n = fread(buffer, 1, sizeof(buffer), stream)) > 0)
+	{
+		for (size_t i = 0; i < n; i++)
+		{
+			hash ^= buffer[i];
+			hash *= 1099511628211ULL;
+		}
+	}
+	fclose(stream);
+	return hash;
+}
+
+#define ADB_SNAPSHOT_CHAR(snapshot, offset)   ((offset) ? (char*)(snapshot) + (offset) : NULL)
+
+static AdbAreaConfig* adbSnapshotReadAreaConfig(char* snapshot, uint32_t offset)
+{
+	AdbSnapshotAreaConfig* snapshotConfig = (AdbSnapshotAreaConfig*)(snapshot + offset);
+	AdbAreaConfig* config = adbMalloc("adbSnapshotReadAreaConfig", sizeof(AdbAreaConfig));
+
+	config->area = ADB_SNAPSHOT_CHAR(snapshot, snapshotConfig->area);
+	config->hostName = ADB_SNAPSHOT_CHAR(snapshot, snapshotConfig->hostName);
+	config->port = snapshotConfig->port;
+	config->directoryUri = ADB_SNAPSHOT_CHAR(snapshot, snapshotConfig->directoryUri);
+	config->porpoiseUri = ADB_SNAPSHOT_CHAR(snapshot, snapshotConfig->porpoiseUri);
+	config->defaultDirectory = ADB_SNAPSHOT_CHAR(snapshot, snapshotConfig->defaultDirectory);
+	config->defaultLayerUrl = ADB_SNAPSHOT_CHAR(snapshot, snapshotConfig->defaultLayerUrl);
+	config->defaultLayerName = ADB_SNAPSHOT_CHAR(snapshot, snapshotConfig->defaultLayerName);
+	config->arvosDefaultDirectory = ADB_SNAPSHOT_CHAR(snapshot, snapshotConfig->arvosDefaultDirectory);
+	config->arvosDefaultLayerUrl = ADB_SNAPSHOT_CHAR(snapshot, snapshotConfig->arvosDefaultLayerUrl);
+	config->arvosDefaultLayerName = ADB_SNAPSHOT_CHAR(snapshot, snapshotConfig->arvosDefaultLayerName);
+	config->httpRetries = snapshotConfig->httpRetries;
+	config->httpRetryBackoff = snapshotConfig->httpRetryBackoff;
+	config->httpHedgePercentile = snapshotConfig->httpHedgePercentile;
+	config->speculativeRequests = snapshotConfig->speculativeRequests;
+	return config;
+}
+
+/*
+* Read an area index from a snapshot, the arrays of the index and of its polygons stay in the snapshot.
+*/
+static AdbAreaIndex* adbSnapshotReadAreaIndex(char* snapshot, uint32_t offset)
+{
+	static char* tag = "adbSnapshotReadAreaIndex";
+
+	AdbSnapshotAreaIndex* snapshotIndex = (AdbSnapshotAreaIndex*)(snapshot + offset);
+	AdbAreaIndex* index = adbMalloc(tag, sizeof(AdbAreaIndex));
+
+	index->clientApplication = ADB_SNAPSHOT_CHAR(snapshot, snapshotIndex->clientApplication);
+	index->nAreas = snapshotIndex->nAreas;
+	index->minLat = snapshotIndex->minLat;
+	index->minLon = snapshotIndex->minLon;
+	index->maxLat = snapshotIndex->maxLat;
+	index->maxLon = snapshotIndex->maxLon;
+	index->nLatCells = snapshotIndex->nLatCells;
+	index->nLonCells = snapshotIndex->nLonCells;
+	index->cellStart = (int*)(snapshot + snapshotIndex->cellStart);
+	index->cellAreas = (int*)(snapshot + snapshotIndex->cellAreas);
+	index->nLargeAreas = snapshotIndex->nLargeAreas;
+	index->largeAreas = (int*)(snapshot + snapshotIndex->largeAreas);
+	index->defaultConfig = adbSnapshotReadAreaConfig(snapshot, snapshotIndex->defaultConfig);
+
+	index->areas = adbMalloc(tag, index->nAreas * sizeof(AdbArea));
+	AdbSnapshotArea* snapshotAreas = (AdbSnapshotArea*)(snapshot + snapshotIndex->areas);
+	for (int i = 0; i < index->nAreas; i++)
+	{
+		AdbArea* area = index->areas + i;
+		AdbSnapshotArea* snapshotArea = snapshotAreas + i;
+
+		area->minLat = snapshotArea->minLat;
+		area->minLon = snapshotArea->minLon;
+		area->maxLat = snapshotArea->maxLat;
+		area->maxLon = snapshotArea->maxLon;
+		area->key = ADB_SNAPSHOT_CHAR(snapshot, snapshotArea->key);
+		area->config = adbSnapshotReadAreaConfig(snapshot, snapshotArea->config);
+		if (snapshotArea->polygon)
+		{
+			AdbSnapshotPolygon* snapshotPolygon = (AdbSnapshotPolygon*)(snapshot + snapshotArea->polygon);
+			AdbPolygon* polygon = area->polygon = adbMalloc(tag, sizeof(AdbPolygon));
+
+			polygon->nBands = snapshotPolygon->nBands;
+			polygon->bandStart = (int*)(snapshot + snapshotPolygon->bandStart);
+			polygon->lat0 = (double*)(snapshot + snapshotPolygon->lat0);
+			polygon->lon0 = (double*)(snapshot + snapshotPolygon->lon0);
+			polygon->lat1 = (double*)(snapshot + snapshotPolygon->lat1);
+			polygon->lon1 = (double*)(snapshot + snapshotPolygon->lon1);
+		}
+	}
+	return index;
+}
+
+/*
+* Map the snapshot of a configuration if it exists and was compiled from the current text configuration file.
+* The text file is not read while its size, modification time and inode are the ones of the compiled file,
+* otherwise it is only hashed, not parsed. If the text file does not exist, the snapshot is used.
+*
+* Returns 1 if the snapshot is used, 0 otherwise.
+*/
+static int adbConfigMapSnapshot(AdbConfig* config, char* configPath, char* snapshotPath)
+{
+#ifdef _WIN32
+
+	return 0;
+
+#else
+
+	int fd = open(snapshotPath, O_RDONLY);
+	if (fd < 0)
+	{
+		return 0;
+	}
+	struct stat snapshotStat;
+	if (fstat(fd, &snapshotStat) || snapshotStat.st_size < (off_t)sizeof(AdbSnapshotHeader))
+	{
+		close(fd);
+		return 0;
+	}
+	size_t size = snapshotStat.st_size;
+	char* snapshot = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (snapshot == MAP_FAILED)
+	{
+		PBL_CGI_TRACE("Cannot map snapshot %s", snapshotPath);
+		return 0;
+	}
+
+	AdbSnapshotHeader* header = (AdbSnapshotHeader*)snapshot;
+	struct stat sourceStat;
+	if (memcmp(header->magic, ADB_SNAPSHOT_MAGIC, sizeof(header->magic))
+		|| header->version != ADB_SNAPSHOT_VERSION || header->size != size)
+	{
+		PBL_CGI_TRACE("Snapshot %s is not a snapshot of version %d", snapshotPath, ADB_SNAPSHOT_VERSION);
+		munmap(snapshot, size);
+		return 0;
+	}
+	if (!stat(configPath, &sourceStat)
+		&& (sourceStat.st_size != header->sourceSize
+			|| ((ADB_STAT_MTIME_NS(sourceStat) != header->sourceMtime || (uint64_t)sourceStat.st_ino != header->sourceInode)
+				&& adbFileHash(configPath) != header->sourceHash)))
+	{
+		PBL_CGI_TRACE("Snapshot %s was not compiled from %s", snapshotPath, configPath);
+		munmap(snapshot, size);
+		return 0;
+	}
+
+	config->snapshot = snapshot;
+	config->snapshotSize = size;
+	config->table = snapshot + header->configTable;
+	for (int i = 0; i < ADB_N_CLIENTS; i++)
+	{
+		config->areaIndexes[i] = adbSnapshotReadAreaIndex(snapshot, header->areaIndexes[i]);
+	}
+	for (int i = 0; i < ADB_N_POSITIONS; i++)
+	{
+		config->positionTables[i] = header->positionTables[i] ? snapshot + header->positionTables[i] : NULL;
+	}
+	PBL_CGI_TRACE("Mapped snapshot %s, %lu bytes", snapshotPath, (unsigned long)size);
+	return 1;
+
+#endif
+}
+
+/*
+* Load the configuration of a process, see AdbConfig.
+*
+* The configuration lives on the heap, not in the request arena.
+*/
+AdbConfig* adbConfigLoad(char* configPath)
+{
+	static char* tag = "adbConfigLoad";
+
+	PblArena* arena = pblArenaSet(NULL);
+
+	AdbConfig* config = adbMalloc(tag, sizeof(AdbConfig));
+	char* snapshotPath = adbConfigSnapshotPath(configPath);
+	if (!adbConfigMapSnapshot(config, configPath, snapshotPath))
+	{
+		config->map = pblCgiFileToMap(NULL, configPath);
+	}
+	PBL_FREE(snapshotPath);
+
+	pblArenaSet(arena);
+	return config;
+}
+
+/*
+* Use a configuration for the current request of the thread.
+*/
+void adbConfigUse(AdbConfig* config)
+{
+	adbConfig = config;
+	adbRequestArea = NULL;
+	adbHttpPrefetchDiscard();
+	pblCgiConfigMap = config->map;
+	pblCgiConfigTable = config->table;
+}
+
+/*
+* Create the area indexes and position tables of a configuration and use it for the current thread.
+*/
+static void adbConfigBuild(AdbConfig* config)
+{
+	char* clientApplications[ADB_N_CLIENTS] = { ArvosApplicationName, ArpoiseApplicationName, "" };
+
+	adbConfigUse(config);
+	for (int i = 0; i < ADB_N_CLIENTS; i++)
+	{
+		adbGetAreaIndex(clientApplications[i]);
+	}
+	for (int i = 0; i < ADB_N_POSITIONS; i++)
+	{
+		adbGetPositionTable(i);
+	}
+}
+
+#ifdef __linux__
+
+/*
+* Release a configuration that is no longer used by any request.
+*/
+static void adbConfigFree(AdbConfig* config)
+{
+	int inSnapshot = config->snapshot != NULL;
+
+	for (int i = 0; i < ADB_N_CLIENTS; i++)
+	{
+		adbAreaIndexFree(config->areaIndexes[i], inSnapshot);
+	}
+	for (int i = 0; i < ADB_N_POSITIONS && !inSnapshot; i++)
+	{
+		PBL_FREE(config->positionTables[i]);
+	}
+	pblCgiMapFree(config->map);
+	if (config->snapshot)
+	{
+		munmap(config->snapshot, config->snapshotSize);
+	}
+	PBL_FREE(config);
+}
+
+#endif
+
+/*
+* Compile a text configuration file to a snapshot, if the snapshot path is NULL the snapshot
+* is written next to the text file, see adbConfigSnapshotPath.
+*
+* The snapshot is written to a temporary file first and then renamed,
+* so a process loading the configuration never sees a partially written snapshot.
+*
+* Returns the size of the snapshot.
+*/
+int adbConfigCompile(char* configPath, char* snapshotPath)
+{
+	static char* tag = "adbConfigCompile";
+
+	struct stat sourceStat;
+	if (stat(configPath, &sourceStat))
+	{
+		pblCgiExitOnError("%s: Cannot read %s\n", tag, configPath);
+	}
+	AdbConfig* config = adbMalloc(tag, sizeof(AdbConfig));
+	config->map = pblCgiFileToMap(NULL, configPath);
+
+	AdbSnapshotBuffer buffer;
+	memset(&buffer, 0, sizeof(buffer));
+	if (!(buffer.strings = pblMapNewHashMap()))
+	{
+		pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
+	}
+
+	AdbSnapshotHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, ADB_SNAPSHOT_MAGIC, sizeof(header.magic));
+	header.version = ADB_SNAPSHOT_VERSION;
+	header.sourceSize = sourceStat.st_size;
+	header.sourceHash = adbFileHash(configPath);
+	header.sourceMtime = ADB_STAT_MTIME_NS(sourceStat);
+	header.sourceInode = (uint64_t)sourceStat.st_ino;
+	adbSnapshotAppend(&buffer, NULL, sizeof(header));
+
+	size_t tableSize = pblCgiConfigTableBuild(config->map, NULL, 0);
+	header.configTable = adbSnapshotAppend(&buffer, NULL, tableSize);
+	pblCgiConfigTableBuild(config->map, buffer.data + header.configTable, tableSize);
+
+	adbConfigBuild(config);
+	for (int i = 0; i < ADB_N_CLIENTS; i++)
+	{
+		header.areaIndexes[i] = adbSnapshotAreaIndex(&buffer, config->areaIndexes[i]);
+	}
+	for (int i = 0; i < ADB_N_POSITIONS; i++)
+	{
+		if (config->positionTables[i])
+		{
+			size_t size = 0;
+			PBL_FREE(config->positionTables[i]);
+			config->positionTables[i] = adbPositionTableNew(pblCgiConfigValue(adbPositionKeys[i], NULL), &size);
+			header.positionTables[i] = adbSnapshotAppend(&buffer, config->positionTables[i], size);
+		}
+	}
+
+	header.size = (uint32_t)buffer.size;
+	memcpy(buffer.data, &header, sizeof(header));
+
+	if (!snapshotPath)
+	{
+		snapshotPath = adbConfigSnapshotPath(configPath);
+	}
+	char* tempPath = pblCgiSprintf("%s.%d", snapshotPath, (int)getpid());
+	FILE* stream = fopen(tempPath, "wb");
+	if (!stream)
+	{
+		pblCgiExitOnError("%s: Cannot open %s for writing\n", tag, tempPath);
+	}
+	if (fwrite(buffer.data, 1, buffer.size, stream) != buffer.size || fclose(stream))
+	{
+		pblCgiExitOnError("%s: Cannot write %s\n", tag, tempPath);
+	}
+	if (rename(tempPath, snapshotPath))
+	{
+		remove(tempPath);
+		pblCgiExitOnError("%s: Cannot rename %s to %s\n", tag, tempPath, snapshotPath);
+	}
+	PBL_FREE(tempPath);
+	pblMapFree(buffer.strings);
+	PBL_FREE(buffer.data);
+	return (int)header.size;
+}
+
+/*
+* The configurations of a process, a configuration file is read by the first request using it
+* and reloaded by the watch thread of a persistent process when the file changes, see adbConfigWatch.
+*
+* A reload replaces the pointer to the configuration of a file. A request publishes the configuration
+* it uses in the reader record of its thread, a replaced configuration is released by the watch thread
+* once no reader uses it anymore. Requests never wait for a reload and never take a lock.
+*/
+#define ADB_MAX_CONFIGS 8
+
+typedef struct AdbConfigFile_s
+{
+	char* configPath;
+	AdbConfig* config;
+	int reload;            /* Set by the watch thread if the file has to be read again */
+
+} AdbConfigFile;
+
+static AdbConfigFile adbConfigFiles[ADB_MAX_CONFIGS];
+static int adbNConfigFiles = 0;
+
+typedef struct AdbConfigReader_s
+{
+	struct AdbConfigReader_s* next;
+	AdbConfig* config;     /* The configuration of the current or the last request of the thread */
+
+} AdbConfigReader;
+
+static AdbConfigReader* adbConfigReaders = NULL;
+static PBL_THREAD_LOCAL AdbConfigReader* adbConfigReader = NULL;
+
+static void adbConfigWatchFile(AdbConfigFile* file);
+
+/*
+* Get the current configuration of a file and publish it as the configuration used by the thread.
+*
+* The configuration is loaded by the first call for the file, see adbConfigLoad, a persistent process
+* keeps using it until it is reloaded. The configuration stays valid until the next call of the thread.
+*/
+AdbConfig* adbConfigGet(char* configPath)
+{
+	static char* tag = "adbConfigGet";
+
+	AdbConfigFile* file = NULL;
+	int nFiles = ADB_ATOMIC_LOAD(&adbNConfigFiles);
+	for (int i = 0; i < nFiles; i++)
+	{
+		if (!strcmp(adbConfigFiles[i].configPath, configPath))
+		{
+			file = adbConfigFiles + i;
+			break;
+		}
+	}
+	if (!file)
+	{
+		pblCgiLock();
+		for (int i = 0; i < adbNConfigFiles; i++)
+		{
+			if (!strcmp(adbConfigFiles[i].configPath, configPath))
+			{
+				file = adbConfigFiles + i;
+				break;
+			}
+		}
+		if (!file)
+		{
+			if (adbNConfigFiles >= ADB_MAX_CONFIGS)
+			{
+				pblCgiExitOnError("%s: More than %d configuration files\n", tag, ADB_MAX_CONFIGS);
+			}
+			file = adbConfigFiles + adbNConfigFiles;
+			file->config = adbConfigLoad(configPath);
+
+			PblArena* arena = pblArenaSet(NULL);
+			file->configPath = pblCgiStrDup(configPath);
+			pblArenaSet(arena);
+
+			adbConfigWatchFile(file);
+			ADB_ATOMIC_STORE(&adbNConfigFiles, adbNConfigFiles + 1);
+		}
+		pblCgiUnlock();
+	}
+
+	if (!adbConfigReader)
+	{
+		PblArena* arena = pblArenaSet(NULL);
+		AdbConfigReader* reader = adbMalloc(tag, sizeof(AdbConfigReader));
+		pblArenaSet(arena);
+
+		reader->next = ADB_ATOMIC_LOAD(&adbConfigReaders);
+		while (!ADB_ATOMIC_CAS(&adbConfigReaders, &reader->next, reader))
+			;
+		adbConfigReader = reader;
+	}
+
+	// If the configuration was replaced before it was published, the watch thread might not have seen it
+	//
+	AdbConfig* config;
+	do
+	{
+		config = ADB_ATOMIC_LOAD(&file->config);
+		ADB_ATOMIC_STORE(&adbConfigReader->config, config);
+	} while (config != ADB_ATOMIC_LOAD(&file->config));
+
+	adbConfigPath = file->configPath;
+	return config;
+}
+
+#ifdef __linux__
+
+#define ADB_CONFIG_RELOAD_DELAY_MS    200
+#define ADB_CONFIG_RECLAIM_DELAY_MS   1000
+
+static int adbConfigWatching = 0;
+static int adbConfigInotify = -1;
+static int adbConfigSignal = -1;
+static AdbConfigFile* adbConfigReloadFile = NULL;
+static PblList* adbConfigsReplaced = NULL;
+
+static char* adbFileName(char* path)
+{
+	char* name = strrchr(path, '/');
+	return name ? name + 1 : path;
+}
+
+/*
+* Watch the directory of a configuration file, a new version of a file is usually renamed into place.
+*/
+static void adbConfigWatchFile(AdbConfigFile* file)
+{
+	if (adbConfigInotify < 0)
+	{
+		return;
+	}
+	char* name = adbFileName(file->configPath);
+	char* directory = name == file->configPath ? pblCgiStrDup(".") : pblCgiStrRangeDup(file->configPath, name - 1);
+	if (inotify_add_watch(adbConfigInotify, directory, IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+	{
+		PBL_CGI_TRACE("Cannot watch directory %s, errno %d", directory, errno);
+	}
+	PBL_FREE(directory);
+}
+
+/*
+* Read a configuration file again and replace the configuration of the file,
+* run as a request, so an error keeps the current configuration.
+*/
+static int adbConfigReload(int argc, char* argv[])
+{
+	AdbConfigFile* file = adbConfigReloadFile;
+
+	AdbConfig* config = adbConfigLoad(file->configPath);
+	adbConfigBuild(config);
+
+	AdbConfig* oldConfig = ADB_ATOMIC_EXCHANGE(&file->config, config);
+	PBL_CGI_TRACE("Reloaded %s", file->configPath);
+	if (pblListAdd(adbConfigsReplaced, oldConfig) < 0)
+	{
+		pblCgiExitOnError("adbConfigReload: pbl_errno = %d, message='%s'\n", pbl_errno, pbl_errstr);
+	}
+	return 0;
+}
+
+/*
+* Release the replaced configurations no reader uses anymore.
+*/
+static void adbConfigReclaim(void)
+{
+	for (int i = pblListSize(adbConfigsReplaced) - 1; i >= 0; i--)
+	{
+		AdbConfig* config = pblListGet(adbConfigsReplaced, i);
+		int used = 0;
+		for (AdbConfigReader* reader = ADB_ATOMIC_LOAD(&adbConfigReaders); reader && !used; reader = reader->next)
+		{
+			used = ADB_ATOMIC_LOAD(&reader->config) == config;
+		}
+		if (!used)
+		{
+			pblListRemoveAt(adbConfigsReplaced, i);
+			adbConfigFree(config);
+			PBL_CGI_TRACE("Released a replaced configuration, %d left", pblListSize(adbConfigsReplaced));
+		}
+	}
+}
+
+/*
+* The watch thread reloads a configuration file after it was written or renamed into place,
+* a reload is started once the directory of the file was quiet for ADB_CONFIG_RELOAD_DELAY_MS.
+* SIGHUP reloads all configuration files.
+*/
+static void* adbConfigWatchThread(void* arg)
+{
+	static char* tag = "adbConfigWatchThread";
+
+	// A failing reload prints its error message like a request, keep it out of the output of the process
+	//
+	pblCgiOutputStream = fopen("/dev/null", "w");
+
+	adbConfigsReplaced = pblListNewArrayList();
+	if (!adbConfigsReplaced)
+	{
+		PBL_CGI_TRACE("%s: pbl_errno = %d, message='%s'", tag, pbl_errno, pbl_errstr);
+		return NULL;
+	}
+
+	int reloadPending = 0;
+	for (;;)
+	{
+		struct pollfd fds[2];
+		fds[0].fd = adbConfigSignal;
+		fds[0].events = POLLIN;
+		fds[1].fd = adbConfigInotify;
+		fds[1].events = POLLIN;
+
+		int timeout = reloadPending ? ADB_CONFIG_RELOAD_DELAY_MS : pblListIsEmpty(adbConfigsReplaced) ? -1 : ADB_CONFIG_RECLAIM_DELAY_MS;
+		int rc = poll(fds, 2, timeout);
+		if (rc < 0)
+		{
+			if (errno != EINTR)
+			{
+				PBL_CGI_TRACE("%s: poll failed, errno %d", tag, errno);
+				sleep(1);
+			}
+			continue;
+		}
+		int nFiles = ADB_ATOMIC_LOAD(&adbNConfigFiles);
+
+		if (fds[0].revents & POLLIN)
+		{
+			struct signalfd_siginfo info;
+			while (read(adbConfigSignal, &info, sizeof(info)) == sizeof(info))
+				;
+			PBL_CGI_TRACE("SIGHUP, reloading %d configuration files", nFiles);
+			for (int i = 0; i < nFiles; i++)
+			{
+				adbConfigFiles[i].reload = 1;
+			}
+			reloadPending = 1;
+		}
+
+		if (fds[1].revents & POLLIN)
+		{
+			char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+			ssize_t length;
+			while ((length = read(adbConfigInotify, buffer, sizeof(buffer))) > 0)
+			{
+				for (char* ptr = buffer; ptr < buffer + length; ptr += sizeof(struct inotify_event) + ((struct inotify_event*)ptr)->len)
+				{
+					struct inotify_event* event = (struct inotify_event*)ptr;
+					if (!event->len)
+					{
+						continue;
+					}
+					for (int i = 0; i < nFiles; i++)
+					{
+						// The text file and its snapshot, e.g. ArpoiseDirectory.txt and ArpoiseDirectory.bin
+						//
+						char* name = adbFileName(adbConfigFiles[i].configPath);
+						char* dot = strrchr(name, '.');
+						size_t baseLength = dot ? (size_t)(dot - name) : strlen(name);
+						if (!strcmp(event->name, name)
+							|| (!strncmp(event->name, name, baseLength) && !strcmp(event->name + baseLength, ".bin")))
+						{
+							adbConfigFiles[i].reload = 1;
+							reloadPending = 1;
+						}
+					}
+				}
+			}
+		}
+
+		if (rc == 0 && reloadPending)
+		{
+			reloadPending = 0;
+			for (int i = 0; i < nFiles; i++)
+			{
+				if (adbConfigFiles[i].reload)
+				{
+					adbConfigFiles[i].reload = 0;
+					adbConfigReloadFile = adbConfigFiles + i;
+					if (pblCgiRunRequest(adbConfigReload, 0, NULL) < 0)
+					{
+						PBL_CGI_TRACE("Reloading %s failed, keeping the current configuration", adbConfigFiles[i].configPath);
+					}
+				}
+			}
+		}
+		adbConfigReclaim();
+	}
+	return NULL;
+}
+
+#else
+
+static void adbConfigWatchFile(AdbConfigFile* file)
+{
+}
+
+#endif
+
+/*
+* Let a persistent process reload its configuration files when they change or when it receives SIGHUP.
+*
+* The configuration files are watched by a thread of the process, SIGHUP is blocked in the calling thread
+* and in the threads it starts afterwards, so only the watch thread receives it.
+* Only available on Linux.
+*/
+void adbConfigWatch(void)
+{
+#ifdef __linux__
+
+	static char* tag = "adbConfigWatch";
+
+	if (ADB_ATOMIC_LOAD(&adbConfigWatching))
+	{
+		return;
+	}
+	pblCgiLock();
+	if (!adbConfigWatching)
+	{
+		sigset_t hangup;
+		sigemptyset(&hangup);
+		sigaddset(&hangup, SIGHUP);
+		pthread_sigmask(SIG_BLOCK, &hangup, NULL);
+
+		adbConfigSignal = signalfd(-1, &hangup, SFD_NONBLOCK | SFD_CLOEXEC);
+		adbConfigInotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (adbConfigSignal < 0 || adbConfigInotify < 0)
+		{
+			pblCgiExitOnError("%s: signalfd or inotify_init1 failed, errno %d\n", tag, errno);
+		}
+		for (int i = 0; i < adbNConfigFiles; i++)
+		{
+			adbConfigWatchFile(adbConfigFiles + i);
+		}
+
+		pthread_t thread;
+		int rc = pthread_create(&thread, NULL, adbConfigWatchThread, NULL);
+		if (rc)
+		{
+			pblCgiExitOnError("%s: pthread_create failed, rc %d\n", tag, rc);
+		}
+		pthread_detach(thread);
+		ADB_ATOMIC_STORE(&adbConfigWatching, 1);
+	}
+	pblCgiUnlock();
+
+#endif
+}
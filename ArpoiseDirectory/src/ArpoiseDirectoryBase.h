@@ -0,0 +1,91 @@
+#ifndef _ARPOISE_DIRECTORY_BASE_H_
+#define _ARPOISE_DIRECTORY_BASE_H_
+/*
+ArpoiseDirectoryBase.h - include file for the base of the ARpoise Directory front end service.
+
+Copyright (C) 2026, Tamiko Thiel and Peter Graf - All Rights Reserved
+
+ARpoise - Augmented Reality Point Of Interest Service
+
+This file is part of ARpoise.
+
+	ARpoise is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	ARpoise is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with ARpoise.  If not, see <https://www.gnu.org/licenses/>.
+
+For more information on
+
+Tamiko Thiel, see www.TamikoThiel.com/
+Peter Graf, see www.mission-base.com/peter/
+ARpoise, see www.ARpoise.com/
+
+$Log: ArpoiseDirectoryBase.h,v $
+Revision 1.1  2026/10/18 14:40:12  peter
+Added the resolved configuration of the areas
+
+
+*/
+
+/*
+* The configuration values of an area, resolved when the configuration is read.
+*
+* A value given for the area, e.g. Area_1_HostName, is used if it is set,
+* otherwise the value given without the area prefix, e.g. HostName, or the default value.
+*/
+typedef struct AdbAreaConfig_s
+{
+	char* area;                  /* The area key, e.g. Area_1, NULL if no area matched */
+
+	char* hostName;
+	int port;                    /* 80 if no port is given, < 1 if the port is invalid */
+	char* directoryUri;
+	char* porpoiseUri;
+
+	char* defaultDirectory;
+	char* defaultLayerUrl;
+	char* defaultLayerName;
+
+	char* arvosDefaultDirectory;
+	char* arvosDefaultLayerUrl;
+	char* arvosDefaultLayerName;
+
+	int httpRetries;             /* The number of times a request to the host is repeated if it is not answered */
+	int httpRetryBackoff;        /* The maximum delay before the first repetition in milliseconds */
+	int httpHedgePercentile;     /* The latency percentile after which a request to the host is hedged, 0 if never */
+	int speculativeRequests;     /* Whether the fallbacks of a directory request are requested along with it */
+
+} AdbAreaConfig;
+
+extern AdbAreaConfig* adbGetAreaConfig(char* queryString, char* clientApplication);
+
+/*
+* The configuration of a process.
+*
+* A configuration is read from a text configuration file, e.g. ../config/ArpoiseDirectory.txt,
+* or from the binary snapshot of the file written by the config compiler ArpoiseDirectoryConfig,
+* e.g. ../config/ArpoiseDirectory.bin. The snapshot is mapped read-only into the memory of the process,
+* it is used instead of the text file if it was compiled from the current version of the text file.
+*/
+typedef struct AdbConfig_s AdbConfig;
+
+extern AdbConfig* adbConfigLoad(char* configPath);
+extern void adbConfigUse(AdbConfig* config);
+extern int adbConfigCompile(char* configPath, char* snapshotPath);
+
+/*
+* The current configuration of a file, a persistent process calling adbConfigWatch reloads it
+* when the text file or its snapshot is replaced or when the process receives SIGHUP.
+*/
+extern AdbConfig* adbConfigGet(char* configPath);
+extern void adbConfigWatch(void);
+
+#endif
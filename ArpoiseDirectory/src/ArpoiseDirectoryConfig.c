@@ -0,0 +1,64 @@
+/*
+ArpoiseDirectoryConfig.c - main for the ARpoise Directory config compiler.
+
+Copyright (C) 2026, Tamiko Thiel and Peter Graf - All Rights Reserved
+
+ARpoise - Augmented Reality Point Of Interest Service
+
+This file is part of ARpoise.
+
+	ARpoise is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	ARpoise is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with ARpoise.  If not, see <https://www.gnu.org/licenses/>.
+
+For more information on
+
+Tamiko Thiel, see www.TamikoThiel.com/
+Peter Graf, see www.mission-base.com/peter/
+ARpoise, see www.ARpoise.com/
+
+$Log: ArpoiseDirectoryConfig.c,v $
+Revision 1.1  2026/10/18 14:40:12  peter
+Added the config compiler
+
+
+*/
+
+/*
+* Make sure "strings <exe> | grep Id | sort -u" shows the source file versions
+*/
+char* ArpoiseDirectoryConfig_c_id = "$Id: ArpoiseDirectoryConfig.c,v 1.1 2026/10/18 14:40:12 peter Exp $";
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pblCgi.h"
+#include "ArpoiseDirectoryBase.h"
+
+/*
+* Compile a text configuration file to the snapshot read by the directory service, see AdbConfig.
+*
+* Usage: ArpoiseDirectoryConfig [config.txt [snapshot.bin]]
+*
+* The configuration defaults to ../config/ArpoiseDirectory.txt, the snapshot is written next to it,
+* e.g. ../config/ArpoiseDirectory.bin. The snapshot must be compiled again whenever the text file changes,
+* otherwise the text file is used.
+*/
+int main(int argc, char* argv[])
+{
+	char* configPath = argc > 1 ? argv[1] : "../config/ArpoiseDirectory.txt";
+	char* snapshotPath = argc > 2 ? argv[2] : NULL;
+
+	int size = adbConfigCompile(configPath, snapshotPath);
+	printf("Compiled %s, %d bytes\n", configPath, size);
+	return 0;
+}
@@ -0,0 +1,100 @@
+/*
+ArpoiseDirectoryServer.c - main for the ARpoise Directory HTTP server.
+
+Copyright (C) 2026, Tamiko Thiel and Peter Graf - All Rights Reserved
+
+ARpoise - Augmented Reality Point Of Interest Service
+
+This file is part of ARpoise.
+
+	ARpoise is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	ARpoise is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with ARpoise.  If not, see <https://www.gnu.org/licenses/>.
+
+For more information on
+
+Tamiko Thiel, see www.TamikoThiel.com/
+Peter Graf, see www.mission-base.com/peter/
+ARpoise, see www.ARpoise.com/
+
+$Log: ArpoiseDirectoryServer.c,v $
+Revision 1.1  2026/10/18 14:40:12  peter
+Added the HTTP server front end
+
+
+*/
+
+/*
+* Make sure "strings <exe> | grep Id | sort -u" shows the source file versions
+*/
+char* ArpoiseDirectoryServer_c_id = "$Id: ArpoiseDirectoryServer.c,v 1.1 2026/10/18 14:40:12 peter Exp $";
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include "pblCgi.h"
+#include "ArpoiseDirectoryBase.h"
+
+extern int arpoiseDirectory(int argc, char* argv[]);
+extern int upload(int argc, char* argv[]);
+extern void adbTraceDuration();
+
+static int arpoiseDirectoryRequest(int argc, char* argv[])
+{
+	int rc = arpoiseDirectory(argc, argv);
+	adbTraceDuration();
+	return rc;
+}
+
+static int uploadRequest(int argc, char* argv[])
+{
+	int rc = upload(argc, argv);
+	adbTraceDuration();
+	return rc;
+}
+
+/*
+* The request path selects the handler, e.g. /cgi-bin/ArpoiseDirectory.cgi?... or /ArpoiseDirectory.cgi?...
+*/
+static PblCgiRoute routes[] =
+{
+	{ "ArpoiseDirectory.cgi", arpoiseDirectoryRequest },
+	{ "Upload.cgi", uploadRequest },
+	{ NULL, NULL }
+};
+
+/*
+* Run the directory service as a stand alone HTTP server, the server settings are read from the
+* configuration of the directory service, the port can also be given on the command line.
+*
+* Usage: ArpoiseDirectoryServer [port]
+*/
+int main(int argc, char* argv[])
+{
+	struct timeval startTime;
+	gettimeofday(&startTime, NULL);
+
+	adbConfigUse(adbConfigLoad("../config/ArpoiseDirectory.txt"));
+
+	char* traceFile = pblCgiConfigValue(PBL_CGI_TRACE_FILE, "/tmp/ArpoiseDirectory.txt");
+	pblCgiInitTrace(&startTime, traceFile);
+	PBL_CGI_TRACE("> Id %s", ArpoiseDirectoryServer_c_id);
+
+	char* address = pblCgiConfigValue("ServerAddress", "");
+	char* port = argc > 1 ? argv[1] : pblCgiConfigValue("ServerPort", "8080");
+	int nProcesses = atoi(pblCgiConfigValue("ServerProcesses", "4"));
+	int nThreads = atoi(pblCgiConfigValue("ServerThreads", "8"));
+	int idleTimeout = atoi(pblCgiConfigValue("ServerIdleTimeout", "30"));
+
+	return pblCgiServerRun(address, port, nProcesses, nThreads, idleTimeout, routes);
+}
@@ -83,6 +83,7 @@ char* Upload_c_id = "$Id: Upload.c,v 1.8 2026/04/25 20:29:19 peter Exp $";
 #endif
 
 #include "pblCgi.h"
+#include "ArpoiseDirectoryBase.h"
 
 extern char* adbGetHttpResponse(char* hostname, int port, char* uri, int timeoutSeconds, char* agent);
 extern char* adbGetStringBetween(char* string, char* start, char* end);
@@ -235,7 +236,7 @@ static int uploadFile()
 	return 0;
 }
 
-static int upload(int argc, char* argv[])
+int upload(int argc, char* argv[])
 {
 	char* tag = "Upload";
 	int layerServed = 0;
@@ -245,13 +246,18 @@ static int upload(int argc, char* argv[])
 	gettimeofday(&startTime, NULL);
 	srand(rand() ^ getpid() ^ startTime.tv_sec ^ startTime.tv_usec);
 
+	// A persistent process reads the configuration only once, the HTTP server reloads it when it changes
+	//
+#ifdef ADB_SERVER
+	adbConfigWatch();
+#endif
 #ifdef _WIN32
 
-	pblCgiConfigMap = pblCgiFileToMap(NULL, "../config/Win32Upload.txt");
+	adbConfigUse(adbConfigGet("../config/Win32Upload.txt"));
 
 #else
 
-	pblCgiConfigMap = pblCgiFileToMap(NULL, "../config/Upload.txt");
+	adbConfigUse(adbConfigGet("../config/Upload.txt"));
 
 #endif
 
@@ -282,46 +288,9 @@ static int upload(int argc, char* argv[])
 		uploadFile();
 	}
 
-	return 0;
-}
-
-static char* contentType = NULL;
-static void pblCgiSetContentType(char* type)
-{
-	if (!contentType)
-	{
-		char* cookie = pblCgiValue(PBL_CGI_COOKIE);
-		char* cookiePath = pblCgiValue(PBL_CGI_COOKIE_PATH);
-		char* cookieDomain = pblCgiValue(PBL_CGI_COOKIE_DOMAIN);
-
-		contentType = type;
-
-		if (cookie && cookiePath && cookieDomain)
-		{
-			char* format = "Content-Type: %s\n";
-			printf(format, contentType);
-			PBL_CGI_TRACE(format, contentType);
-
-			format = "Set-Cookie: %s%s; Path=%s; DOMAIN=%s; HttpOnly\n\n";
-			printf(format, pblCgiCookieTag, cookie, cookiePath, cookieDomain);
-			PBL_CGI_TRACE(format, pblCgiCookieTag, cookie, cookiePath, cookieDomain);
-		}
-		else
-		{
-			printf("Content-Type: %s\n\n", contentType);
-			PBL_CGI_TRACE("Content-Type: %s\n", contentType);
-		}
-	}
-}
-
-int main(int argc, char* argv[])
-{
-	int rc = upload(argc, argv);
-	adbTraceDuration();
-
 	pblCgiSetContentType("text/html");
 
-	printf(
+	fprintf(PBL_CGI_OUT,
 		"<!DOCTYPE html>\n"
 		"<html>\n"
 		"<head>\n<title>Mission-Base PBL CGI Error</title>\n</head>\n"
@@ -329,5 +298,16 @@ int main(int argc, char* argv[])
 		"<h1>PBL CGI\n</h1>\n"
 		"<p><hr><p>\n"
 		"<h2>Upload OK</h2>\n");
+	return 0;
+}
+
+#ifndef ADB_SERVER
+
+int main(int argc, char* argv[])
+{
+	int rc = upload(argc, argv);
+	adbTraceDuration();
 	return rc;
 }
+
+#endif
@@ -52,15 +52,229 @@ char* pbl_c_id = "$Id: pbl.c,v 1.4 2026/04/25 20:29:18 peter Exp $";
 /* Globals                                                                   */
 /*****************************************************************************/
 
-static char pbl_errbuf[PBL_ERRSTR_LEN + 1];
+/*
+ * The error values are set by the functions of all collections,
+ * they are thread local so the library can be used by several threads,
+ * as long as each collection is used by one thread at a time or only read.
+ */
+PBL_THREAD_LOCAL int    pbl_errno;
+PBL_THREAD_LOCAL char   pbl_errstr[PBL_ERRSTR_LEN + 1];
+
+/*
+ * A chunk of memory of an arena, the memory handed out follows the header
+ */
+typedef struct PblArenaChunk_s
+{
+	struct PblArenaChunk_s* next;
+	size_t size;              /* Number of bytes usable in the chunk   */
+	size_t used;              /* Number of bytes handed out            */
+
+} PblArenaChunk;
 
-int    pbl_errno;
-char* pbl_errstr = pbl_errbuf;
+struct PblArena_s
+{
+	PblArenaChunk* chunks;     /* The chunks in use, the current first  */
+	PblArenaChunk* freeChunks; /* Chunks kept for reuse after a reset   */
+	size_t chunkSize;          /* Usable size of a standard chunk       */
+};
+
+#define PBL_ARENA_ALIGNMENT          16
+#define PBL_ARENA_ALIGN( size )      (((size) + PBL_ARENA_ALIGNMENT - 1) & ~((size_t)PBL_ARENA_ALIGNMENT - 1))
+#define PBL_ARENA_HEADER_SIZE        PBL_ARENA_ALIGN( sizeof( PblArenaChunk ) )
+#define PBL_ARENA_DATA( chunk )      (((char*)(chunk)) + PBL_ARENA_HEADER_SIZE)
+
+/*
+ * The arena the allocations of a thread come from, NULL if they come from the heap,
+ * and the arena of the thread, used to recognize the memory of the arena when it is freed.
+ */
+static PBL_THREAD_LOCAL PblArena* pblArenaCurrent = NULL;
+static PBL_THREAD_LOCAL PblArena* pblArenaOfThread = NULL;
 
 /*****************************************************************************/
 /* Functions                                                                 */
 /*****************************************************************************/
 
+/**
+  * Create an arena allocator.
+  *
+  * The memory of an arena is allocated in chunks, allocations bigger
+  * than a quarter of the chunk size get a chunk of their own.
+  *
+  * @return  PblArena * retptr == NULL: OUT OF MEMORY
+  * @return  PblArena * retptr != NULL: the new arena
+  */
+PblArena* pblArenaNew(
+	size_t chunkSize     /** usable size of a chunk, 0 for the default of 64 KB */
+)
+{
+	PblArena* arena = pbl_malloc0("pblArenaNew", sizeof(PblArena));
+	if (arena)
+	{
+		arena->chunkSize = chunkSize > 0 ? PBL_ARENA_ALIGN(chunkSize) : 64 * 1024;
+	}
+	return arena;
+}
+
+/**
+  * Release all memory allocated from an arena in one shot.
+  *
+  * Chunks of the standard size are kept for the next use of the arena.
+  */
+void pblArenaReset(
+	PblArena* arena      /** the arena to reset */
+)
+{
+	PblArenaChunk* chunk = arena->chunks;
+	while (chunk)
+	{
+		PblArenaChunk* next = chunk->next;
+		if (chunk->size == arena->chunkSize)
+		{
+			chunk->used = 0;
+			chunk->next = arena->freeChunks;
+			arena->freeChunks = chunk;
+		}
+		else
+		{
+			free(chunk);
+		}
+		chunk = next;
+	}
+	arena->chunks = NULL;
+}
+
+/**
+  * Release an arena and all memory allocated from it.
+  */
+void pblArenaFree(
+	PblArena* arena      /** the arena to free */
+)
+{
+	if (!arena)
+	{
+		return;
+	}
+	pblArenaReset(arena);
+	while (arena->freeChunks)
+	{
+		PblArenaChunk* next = arena->freeChunks->next;
+		free(arena->freeChunks);
+		arena->freeChunks = next;
+	}
+	if (pblArenaOfThread == arena)
+	{
+		pblArenaOfThread = NULL;
+	}
+	if (pblArenaCurrent == arena)
+	{
+		pblArenaCurrent = NULL;
+	}
+	free(arena);
+}
+
+/**
+  * Set the arena the calling thread allocates from.
+  *
+  * While an arena is set, pbl_malloc, pbl_malloc0, pbl_memdup and all functions
+  * using them allocate from the arena, pbl_free of that memory does nothing.
+  * Memory that has to outlive the arena is allocated after setting NULL.
+  * A thread should only use one arena.
+  *
+  * @return  PblArena * retptr: the arena set before, NULL for the heap
+  */
+PblArena* pblArenaSet(
+	PblArena* arena      /** the arena to use, NULL for the heap */
+)
+{
+	PblArena* previous = pblArenaCurrent;
+	pblArenaCurrent = arena;
+	if (arena)
+	{
+		pblArenaOfThread = arena;
+	}
+	return previous;
+}
+
+/*
+ * Allocate memory from an arena.
+ */
+static void* pblArenaMalloc(PblArena* arena, size_t size)
+{
+	size = PBL_ARENA_ALIGN(size ? size : 1);
+
+	PblArenaChunk* chunk = arena->chunks;
+	if (chunk && chunk->size - chunk->used >= size)
+	{
+		void* ptr = PBL_ARENA_DATA(chunk) + chunk->used;
+		chunk->used += size;
+		return ptr;
+	}
+
+	if (size > arena->chunkSize / 4)
+	{
+		// A chunk of its own, behind the current chunk
+		//
+		chunk = malloc(PBL_ARENA_HEADER_SIZE + size);
+		if (!chunk)
+		{
+			return NULL;
+		}
+		chunk->size = size;
+		chunk->used = size;
+		if (arena->chunks)
+		{
+			chunk->next = arena->chunks->next;
+			arena->chunks->next = chunk;
+		}
+		else
+		{
+			chunk->next = NULL;
+			arena->chunks = chunk;
+		}
+		return PBL_ARENA_DATA(chunk);
+	}
+
+	if (arena->freeChunks)
+	{
+		chunk = arena->freeChunks;
+		arena->freeChunks = chunk->next;
+	}
+	else
+	{
+		chunk = malloc(PBL_ARENA_HEADER_SIZE + arena->chunkSize);
+		if (!chunk)
+		{
+			return NULL;
+		}
+		chunk->size = arena->chunkSize;
+	}
+	chunk->used = size;
+	chunk->next = arena->chunks;
+	arena->chunks = chunk;
+
+	return PBL_ARENA_DATA(chunk);
+}
+
+/**
+  * Replacement for free(), memory allocated from the arena of the thread is not freed.
+  */
+void pbl_free(
+	void* ptr         /** the memory to free */
+)
+{
+	if (pblArenaOfThread)
+	{
+		for (PblArenaChunk* chunk = pblArenaOfThread->chunks; chunk; chunk = chunk->next)
+		{
+			if ((char*)ptr >= PBL_ARENA_DATA(chunk) && (char*)ptr < PBL_ARENA_DATA(chunk) + chunk->size)
+			{
+				return;
+			}
+		}
+	}
+	free(ptr);
+}
+
 /**
   * Replacement for malloc().
   *
@@ -79,7 +293,7 @@ void* pbl_malloc(
 		tag = "pbl_malloc";
 	}
 
-	ptr = malloc(size);
+	ptr = pblArenaCurrent ? pblArenaMalloc(pblArenaCurrent, size) : malloc(size);
 	if (!ptr)
 	{
 #ifdef PBL_MS_VS_2012
@@ -112,7 +326,18 @@ void* pbl_malloc0(
 		tag = "pbl_malloc0";
 	}
 
-	ptr = calloc((size_t)1, size);
+	if (pblArenaCurrent)
+	{
+		ptr = pblArenaMalloc(pblArenaCurrent, size);
+		if (ptr)
+		{
+			memset(ptr, 0, size);
+		}
+	}
+	else
+	{
+		ptr = calloc((size_t)1, size);
+	}
 	if (!ptr)
 	{
 		snprintf(pbl_errstr, PBL_ERRSTR_LEN,
@@ -143,7 +368,7 @@ void* pbl_memdup(
 		tag = "pbl_memdup";
 	}
 
-	ptr = malloc(size);
+	ptr = pblArenaCurrent ? pblArenaMalloc(pblArenaCurrent, size) : malloc(size);
 	if (!ptr)
 	{
 		snprintf(pbl_errstr, PBL_ERRSTR_LEN,
@@ -81,6 +81,15 @@ extern "C" {
 
 #define PBL_ERRSTR_LEN                    2048
 
+/*
+ * Storage class of variables that have a separate instance per thread
+ */
+#ifdef _WIN32
+#define PBL_THREAD_LOCAL                  __declspec( thread )
+#else
+#define PBL_THREAD_LOCAL                  __thread
+#endif
+
 /** @name B: Files
  *  List of important files of the PBL library
  *  <P>
@@ -242,7 +251,7 @@ extern "C" {
  * Make free save against NULL pointers,
  * @doc also the parameter ptr is set to NULL
  */
-#define PBL_FREE( ptr ) if( ptr ){ free( ptr ); ptr = 0; }
+#define PBL_FREE( ptr ) if( ptr ){ pbl_free( ptr ); ptr = 0; }
 
  /**
   * Macros for linear list handling,
@@ -600,18 +609,23 @@ extern "C" {
 	 */
 	typedef struct PblStringBuilder_s PblStringBuilder;
 
+	/**
+	 * The arena allocator type, the memory allocated from an arena is released in one shot.
+	 */
+	typedef struct PblArena_s PblArena;
+
 	/*****************************************************************************/
 	/* variable declarations                                                     */
 	/*****************************************************************************/
 	/**
-	  * Integer value used for returning error codes
+	  * Integer value used for returning error codes, each thread has its own value
 	  */
-	extern int    pbl_errno;
+	extern PBL_THREAD_LOCAL int    pbl_errno;
 
 	/**
-	  * Character buffer used for returning error strings
+	  * Character buffer used for returning error strings, each thread has its own buffer
 	  */
-	extern char* pbl_errstr;
+	extern PBL_THREAD_LOCAL char   pbl_errstr[PBL_ERRSTR_LEN + 1];
 
 	/*
 	 * "Magic" strings to distinguish between objects
@@ -625,10 +639,16 @@ extern "C" {
 	/*****************************************************************************/
 	/* function declarations                                                     */
 	/*****************************************************************************/
+	extern PblArena* pblArenaNew(size_t chunkSize);
+	extern void pblArenaReset(PblArena* arena);
+	extern void pblArenaFree(PblArena* arena);
+	extern PblArena* pblArenaSet(PblArena* arena);
+
 	extern void* pbl_malloc(char* tag, size_t size);
 	extern void* pbl_malloc0(char* tag, size_t size);
 	extern void* pbl_memdup(char* tag, void* data, size_t size);
 	extern void* pbl_strdup(char* tag, char* data);
+	extern void   pbl_free(void* ptr);
 	extern void* pbl_mem2dup(char* tag, void* mem1, size_t len1,
 		void* mem2, size_t len2);
 	extern int    pbl_memcmplen(void* left, size_t llen,
@@ -37,6 +37,10 @@
   */
 char* pblCgi_c_id = "$Id: pblCgi.c,v 1.8 2026/04/25 20:29:18 peter Exp $";
 
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+
 #include <stdio.h>
 #include <memory.h>
 
@@ -45,6 +49,11 @@ char* pblCgi_c_id = "$Id: pblCgi.c,v 1.8 2026/04/25 20:29:18 peter Exp $";
 #endif
 
 #include <stdlib.h>
+#include <stdint.h>
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
 
 #include "pbl.h"
 #include "pblCgi.h"
@@ -60,14 +69,28 @@ char* pblCgi_c_id = "$Id: pblCgi.c,v 1.8 2026/04/25 20:29:18 peter Exp $";
 /* Variables                                                                 */
 /*****************************************************************************/
 
-PblMap* pblCgiConfigMap = NULL;
-
-struct timeval pblCgiStartTime;
+/*
+ * The request context of the thread
+ */
+PBL_THREAD_LOCAL PblCgiRequest pblCgiRequest = { .contentLength = -1 };
 
 FILE* pblCgiTraceFile = NULL;
-char* pblCgiQueryString = NULL;
-char* pblCgiPostData = NULL;
-int pblCgiContentLength = -1;
+
+/*
+ * Threads started after the first one are numbered in the trace
+ */
+static long pblCgiTraceThreadCount = 0;
+static PBL_THREAD_LOCAL int pblCgiTraceThreadNumber = -1;
+
+static PblCgiMutex pblCgiMutex = PBL_CGI_MUTEX_INITIALIZER;
+
+/*
+ * The mutexes the thread holds, a request ending with an error releases them
+ */
+#define PBL_CGI_MAX_LOCKED 4
+
+static PBL_THREAD_LOCAL PblCgiMutex* pblCgiLocked[PBL_CGI_MAX_LOCKED];
+static PBL_THREAD_LOCAL int pblCgiNLocked = 0;
 
 char* pblCgiCookieKey = PBL_CGI_COOKIE;
 char* pblCgiCookieTag = PBL_CGI_COOKIE "=";
@@ -82,31 +105,89 @@ static char* pblCgiMalloc(char* tag, size_t size)
 	return result;
 }
 
-static char* contentType = NULL;
-static void pblCgiSetContentType(char* type)
+/**
+ * Lock a mutex protecting values shared by the threads of a process.
+ *
+ * A thread can hold up to PBL_CGI_MAX_LOCKED mutexes at a time,
+ * if the request ends with an error, pblCgiExitOnError unlocks them.
+ */
+void pblCgiMutexLock(PblCgiMutex* mutex)
+{
+#ifdef _WIN32
+	AcquireSRWLockExclusive(mutex);
+#else
+	pthread_mutex_lock(mutex);
+#endif
+	if (pblCgiNLocked < PBL_CGI_MAX_LOCKED)
+	{
+		pblCgiLocked[pblCgiNLocked++] = mutex;
+	}
+}
+
+/**
+ * Unlock a mutex locked by pblCgiMutexLock.
+ */
+void pblCgiMutexUnlock(PblCgiMutex* mutex)
+{
+	for (int i = pblCgiNLocked - 1; i >= 0; i--)
+	{
+		if (pblCgiLocked[i] == mutex)
+		{
+			memmove(pblCgiLocked + i, pblCgiLocked + i + 1, (--pblCgiNLocked - i) * sizeof(PblCgiMutex*));
+			break;
+		}
+	}
+#ifdef _WIN32
+	ReleaseSRWLockExclusive(mutex);
+#else
+	pthread_mutex_unlock(mutex);
+#endif
+}
+
+/**
+ * Lock the mutex protecting the values shared by the threads of a process,
+ * e.g. values that are initialized by the first request.
+ */
+void pblCgiLock(void)
+{
+	pblCgiMutexLock(&pblCgiMutex);
+}
+
+/**
+ * Unlock the mutex locked by pblCgiLock.
+ */
+void pblCgiUnlock(void)
+{
+	pblCgiMutexUnlock(&pblCgiMutex);
+}
+
+/**
+ * Print the Content-Type header and the cookie header, only the first call of a request prints.
+ */
+void pblCgiSetContentType(char* type)
 {
-	if (!contentType)
+	if (!pblCgiRequest.contentType)
 	{
 		char* cookie = pblCgiValue(PBL_CGI_COOKIE);
 		char* cookiePath = pblCgiValue(PBL_CGI_COOKIE_PATH);
 		char* cookieDomain = pblCgiValue(PBL_CGI_COOKIE_DOMAIN);
 
-		contentType = type;
+		pblCgiRequest.contentType = type;
 
 		if (cookie && cookiePath && cookieDomain)
 		{
 			char* format = "Content-Type: %s\n";
-			printf(format, contentType);
-			PBL_CGI_TRACE(format, contentType);
+			fprintf(PBL_CGI_OUT, format, pblCgiRequest.contentType);
+			PBL_CGI_TRACE(format, pblCgiRequest.contentType);
 
 			format = "Set-Cookie: %s%s; Path=%s; DOMAIN=%s; HttpOnly\n\n";
-			printf(format, pblCgiCookieTag, cookie, cookiePath, cookieDomain);
+			fprintf(PBL_CGI_OUT, format, pblCgiCookieTag, cookie, cookiePath, cookieDomain);
 			PBL_CGI_TRACE(format, pblCgiCookieTag, cookie, cookiePath, cookieDomain);
 		}
 		else
 		{
-			printf("Content-Type: %s\n\n", contentType);
-			PBL_CGI_TRACE("Content-Type: %s\n", contentType);
+			fprintf(PBL_CGI_OUT, "Content-Type: %s\n\n", pblCgiRequest.contentType);
+			PBL_CGI_TRACE("Content-Type: %s\n", pblCgiRequest.contentType);
 		}
 	}
 }
@@ -240,7 +321,7 @@ char* pblCgiConfigValue(char* key, char* defaultValue)
 {
 	static char* tag = "pblCgiConfigValue";
 
-	if (!pblCgiConfigMap)
+	if (!pblCgiConfigMap && !pblCgiConfigTable)
 	{
 		pblCgiExitOnError("%s: The cgi-configuration file was never read!\n", tag);
 	}
@@ -248,7 +329,7 @@ char* pblCgiConfigValue(char* key, char* defaultValue)
 	{
 		pblCgiExitOnError("%s: Empty key not allowed in cgi-configuration file!\n", tag);
 	}
-	char* value = pblMapGetStr(pblCgiConfigMap, key);
+	char* value = pblCgiConfigTable ? pblCgiConfigTableGet(pblCgiConfigTable, key) : pblMapGetStr(pblCgiConfigMap, key);
 	if (!value)
 	{
 		return defaultValue;
@@ -256,10 +337,153 @@ char* pblCgiConfigValue(char* key, char* defaultValue)
 	return value;
 }
 
+/*
+ * The header of a config table, the buckets and the strings follow it.
+ *
+ * A bucket holds the offsets of a key and its value from the start of the table, 0 if it is empty.
+ */
+typedef struct PblCgiConfigTableHeader_s
+{
+	uint32_t nBuckets;
+	uint32_t nEntries;
+
+} PblCgiConfigTableHeader;
+
+static uint32_t pblCgiConfigTableHash(char* key)
+{
+	// FNV-1a
+	//
+	uint32_t hash = 2166136261u;
+	while (*key)
+	{
+		hash ^= (unsigned char)*key++;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+/**
+ * Build a read-only hash table of the configuration values in a map.
+ *
+ * The table holds its strings and all positions in it are offsets,
+ * so it can be written to a file and used after reading or mapping it at any address.
+ * If the buffer is NULL or too small, only the size needed is returned.
+ *
+ * @return size_t rc: The size of the table in bytes.
+ */
+size_t pblCgiConfigTableBuild(PblMap* map, void* buffer, size_t bufferSize)
+{
+	static char* tag = "pblCgiConfigTableBuild";
+
+	uint32_t nEntries = pblMapSize(map);
+	uint32_t nBuckets = 16;
+	while (nBuckets < 2 * nEntries)
+	{
+		nBuckets *= 2;
+	}
+
+	size_t size = sizeof(PblCgiConfigTableHeader) + 2 * sizeof(uint32_t) * nBuckets;
+	PblIterator* iterator = pblMapIteratorNew(map);
+	if (!iterator)
+	{
+		pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
+	}
+	while (pblIteratorHasNext(iterator) > 0)
+	{
+		void* entry = pblIteratorNext(iterator);
+		size += pblMapEntryKeyLength(entry) + pblMapEntryValueLength(entry);
+	}
+	pblIteratorFree(iterator);
+
+	if (!buffer || bufferSize < size)
+	{
+		return size;
+	}
+	memset(buffer, 0, size);
+
+	PblCgiConfigTableHeader* header = buffer;
+	header->nBuckets = nBuckets;
+	header->nEntries = nEntries;
+	uint32_t* buckets = (uint32_t*)(header + 1);
+	size_t offset = sizeof(PblCgiConfigTableHeader) + 2 * sizeof(uint32_t) * nBuckets;
+
+	iterator = pblMapIteratorNew(map);
+	if (!iterator)
+	{
+		pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
+	}
+	while (pblIteratorHasNext(iterator) > 0)
+	{
+		void* entry = pblIteratorNext(iterator);
+		char* key = pblMapEntryKey(entry);
+
+		uint32_t bucket = pblCgiConfigTableHash(key) & (nBuckets - 1);
+		while (buckets[2 * bucket])
+		{
+			bucket = (bucket + 1) & (nBuckets - 1);
+		}
+
+		buckets[2 * bucket] = (uint32_t)offset;
+		memcpy((char*)buffer + offset, key, pblMapEntryKeyLength(entry));
+		offset += pblMapEntryKeyLength(entry);
+
+		buckets[2 * bucket + 1] = (uint32_t)offset;
+		memcpy((char*)buffer + offset, pblMapEntryValue(entry), pblMapEntryValueLength(entry));
+		offset += pblMapEntryValueLength(entry);
+	}
+	pblIteratorFree(iterator);
+
+	return size;
+}
+
+/**
+ * Get the value given for the key in a config table built by pblCgiConfigTableBuild.
+ *
+ * @return char* retPtr == NULL: The key is not in the table.
+ * @return char* retPtr != NULL: The value, it must not be changed.
+ */
+char* pblCgiConfigTableGet(void* table, char* key)
+{
+	PblCgiConfigTableHeader* header = table;
+	uint32_t* buckets = (uint32_t*)(header + 1);
+
+	uint32_t bucket = pblCgiConfigTableHash(key) & (header->nBuckets - 1);
+	while (buckets[2 * bucket])
+	{
+		if (!strcmp((char*)table + buckets[2 * bucket], key))
+		{
+			return (char*)table + buckets[2 * bucket + 1];
+		}
+		bucket = (bucket + 1) & (header->nBuckets - 1);
+	}
+	return NULL;
+}
+
+static int pblCgiTraceInitialized = 0;
+
+/**
+ * Initialize the trace of a request.
+ *
+ * The trace file is opened by the first call of a process,
+ * a process with several threads has to make that call before it starts the threads.
+ */
 void pblCgiInitTrace(struct timeval* startTime, char* traceFilePath)
 {
 	pblCgiStartTime = *startTime;
 
+	if (pblCgiTraceInitialized)
+	{
+		// A persistent process, the trace file is only opened once
+		//
+		if (pblCgiTraceFile)
+		{
+			fputs("\n", pblCgiTraceFile);
+			PBL_CGI_TRACE("----------------------------------------> Started");
+		}
+		return;
+	}
+	pblCgiTraceInitialized = 1;
+
 	if (traceFilePath && *traceFilePath)
 	{
 		FILE* stream;
@@ -284,24 +508,26 @@ void pblCgiInitTrace(struct timeval* startTime, char* traceFilePath)
 		fputs("\n", pblCgiTraceFile);
 		PBL_CGI_TRACE("----------------------------------------> Started");
 
-		extern char** environ;
-		char** envp = environ;
-
-		while (envp && *envp)
+		if (!pblCgiEnvironmentMap)
 		{
-			PBL_CGI_TRACE("ENV %s", *envp++);
+			extern char** environ;
+			char** envp = environ;
+
+			while (envp && *envp)
+			{
+				PBL_CGI_TRACE("ENV %s", *envp++);
+			}
 		}
 	}
 }
 
-static PblMap* queryMap = NULL;
 static void pblCgiSetQueryValue(char* key, char* value)
 {
 	static char* tag = "pblCgiSetQueryValue";
 
-	if (!queryMap)
+	if (!pblCgiRequest.queryMap)
 	{
-		queryMap = pblCgiNewMap();
+		pblCgiRequest.queryMap = pblCgiNewMap();
 	}
 	if (!key || !*key)
 	{
@@ -312,7 +538,7 @@ static void pblCgiSetQueryValue(char* key, char* value)
 		value = "";
 	}
 
-	if (pblMapAddStrStr(queryMap, key, value) < 0)
+	if (pblMapAddStrStr(pblCgiRequest.queryMap, key, value) < 0)
 	{
 		pblCgiExitOnError("%s: Failed to append a value, pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
 	}
@@ -326,7 +552,7 @@ char* pblCgiQueryValueForIteration(char* key, int iteration)
 {
 	static char* tag = "pblCgiQueryValueForIteration";
 
-	if (!queryMap)
+	if (!pblCgiRequest.queryMap)
 	{
 		return "";
 	}
@@ -337,11 +563,11 @@ char* pblCgiQueryValueForIteration(char* key, int iteration)
 	if (iteration >= 0)
 	{
 		char* iterationKey = pblCgiSprintf("%s_%d", key, iteration);
-		char* value = pblMapGetStr(queryMap, iterationKey);
+		char* value = pblMapGetStr(pblCgiRequest.queryMap, iterationKey);
 		PBL_FREE(iterationKey);
 		return value ? value : "";
 	}
-	char* value = pblMapGetStr(queryMap, key);
+	char* value = pblMapGetStr(pblCgiRequest.queryMap, key);
 	return value ? value : "";
 }
 
@@ -379,28 +605,62 @@ void pblCgiTrace(const char* format, ...)
 	}
 	buffer[sizeof(buffer) - 1] = '\0';
 
+	if (pblCgiTraceThreadNumber < 0)
+	{
+#ifdef _WIN32
+		pblCgiTraceThreadNumber = InterlockedIncrement(&pblCgiTraceThreadCount) - 1;
+#else
+		pblCgiTraceThreadNumber = __sync_fetch_and_add(&pblCgiTraceThreadCount, 1);
+#endif
+	}
+
 	char* now = pblCgiStrFromTime(time((time_t*)NULL));
+
+	// The lines of the threads of a process must not mix
+	//
+#ifdef _WIN32
+	_lock_file(pblCgiTraceFile);
+#else
+	flockfile(pblCgiTraceFile);
+#endif
+
 	fputs(now, pblCgiTraceFile);
 	PBL_FREE(now);
 
 #ifndef _WIN32
-	fprintf(pblCgiTraceFile, " %d: ", getpid());
+	if (pblCgiTraceThreadNumber > 0)
+	{
+		fprintf(pblCgiTraceFile, " %d.%d: ", getpid(), pblCgiTraceThreadNumber);
+	}
+	else
+	{
+		fprintf(pblCgiTraceFile, " %d: ", getpid());
+	}
 #endif
 
 	fputs(" ", pblCgiTraceFile);
 	fputs(buffer, pblCgiTraceFile);
 	fputs("\n", pblCgiTraceFile);
 	fflush(pblCgiTraceFile);
+
+#ifdef _WIN32
+	_unlock_file(pblCgiTraceFile);
+#else
+	funlockfile(pblCgiTraceFile);
+#endif
 }
 
 /**
  * Print an error message and exit the program.
+ *
+ * If the request is run by pblCgiRunRequest, the program does not exit,
+ * the request is ended after the error message is printed.
  */
 void pblCgiExitOnError(const char* format, ...)
 {
 	pblCgiSetContentType("text/html");
 
-	printf(
+	fprintf(PBL_CGI_OUT,
 		"<!DOCTYPE html>\n"
 		"<html>\n"
 		"<head>\n<title>Mission-Base PBL CGI Error</title>\n</head>\n"
@@ -415,8 +675,8 @@ void pblCgiExitOnError(const char* format, ...)
 		scriptName = "unknown";
 	}
 
-	printf("<p>While accessing the script '%s'.\n", scriptName);
-	printf("<p><b>\n");
+	fprintf(PBL_CGI_OUT, "<p>While accessing the script '%s'.\n", scriptName);
+	fprintf(PBL_CGI_OUT, "<p><b>\n");
 
 	va_list args;
 	va_start(args, format);
@@ -427,25 +687,81 @@ void pblCgiExitOnError(const char* format, ...)
 
 	if (rc < 0)
 	{
-		printf("Printing of format '%s' and size %lu failed with errno=%d\n", format, sizeof(buffer) - 1, errno);
+		fprintf(PBL_CGI_OUT, "Printing of format '%s' and size %lu failed with errno=%d\n", format, sizeof(buffer) - 1, errno);
 	}
 	else
 	{
 		buffer[sizeof(buffer) - 1] = '\0';
-		printf("%s", buffer);
+		fprintf(PBL_CGI_OUT, "%s", buffer);
 		PBL_CGI_TRACE("%s", buffer);
 	}
 
-	printf("</b>\n");
-	printf("<p>Please click your browser's back button to continue.\n");
-	printf("<p><hr><p>\n");
-	printf("<small>Copyright &copy; 2018 - Tamiko Thiel and Peter Graf</small>\n");
-	printf("</body></HTML>\n");
+	fprintf(PBL_CGI_OUT, "</b>\n");
+	fprintf(PBL_CGI_OUT, "<p>Please click your browser's back button to continue.\n");
+	fprintf(PBL_CGI_OUT, "<p><hr><p>\n");
+	fprintf(PBL_CGI_OUT, "<small>Copyright &copy; 2018 - Tamiko Thiel and Peter Graf</small>\n");
+	fprintf(PBL_CGI_OUT, "</body></HTML>\n");
+
+	pblCgiExitRequest();
+}
+
+/**
+ * End a request whose error message was printed already and exit the program.
+ *
+ * Like pblCgiExitOnError, if the request is run by pblCgiRunRequest, the program does not exit,
+ * the request is ended.
+ */
+void pblCgiExitRequest(void)
+{
+	char* scriptName = pblCgiGetEnv("SCRIPT_NAME");
+	if (!scriptName || !*scriptName)
+	{
+		scriptName = "unknown";
+	}
+
+	if (pblCgiRequest.errorJump)
+	{
+		PBL_CGI_TRACE("%s request ended with an error", scriptName);
+		while (pblCgiNLocked > 0)
+		{
+			pblCgiMutexUnlock(pblCgiLocked[pblCgiNLocked - 1]);
+		}
+		longjmp(*pblCgiRequest.errorJump, 1);
+	}
 
 	PBL_CGI_TRACE("%s exit(-1)", scriptName);
 	exit(-1);
 }
 
+/**
+ * Run the handler of a request of a persistent process, e.g. a FastCGI application or HTTP server.
+ *
+ * If the handler calls pblCgiExitOnError, the error message is the output of the request
+ * and the handler is left without exiting the process. The memory of the request
+ * is released with the request arena, resources the handler holds outside of it
+ * have to be released by the handler before calling pblCgiExitOnError.
+ *
+ * @return int rc: The return code of the handler, -1 if the request ended with an error.
+ */
+int pblCgiRunRequest(int (*handler)(int argc, char* argv[]), int argc, char* argv[])
+{
+	jmp_buf* previousJump = pblCgiRequest.errorJump;
+	jmp_buf errorJump;
+	int rc;
+
+	if (setjmp(errorJump))
+	{
+		rc = -1;
+	}
+	else
+	{
+		pblCgiRequest.errorJump = &errorJump;
+		rc = handler(argc, argv);
+	}
+	pblCgiRequest.errorJump = previousJump;
+	return rc;
+}
+
 /**
  * Like sprintf, copies the value to the heap.
  */
@@ -748,7 +1064,8 @@ char* pblCgiStrFromTimeAndFormat(time_t t, char* format)
 
 #else
 
-	tm = localtime((time_t*)&(t));
+	struct tm localTm;
+	tm = localtime_r((time_t*)&(t), &localTm);
 
 #endif
 	return pblCgiSprintf(format, (tm->tm_year + 1900) % 100, tm->tm_mon + 1, tm->tm_mday,
@@ -980,6 +1297,11 @@ FILE* pblCgiFopen(char* filePath, char* openType)
  */
 char* pblCgiGetEnv(char* name)
 {
+	if (pblCgiEnvironmentMap)
+	{
+		return pblMapGetStr(pblCgiEnvironmentMap, name);
+	}
+
 #ifdef WIN32
 
 	char* value;
@@ -1055,21 +1377,32 @@ void pblCgiParseQuery(int argc, char* argv[])
 				}
 				pblCgiContentLength = contentLength;
 
-				pblCgiQueryString = realloc(pblCgiQueryString, length + contentLength + 1);
-				if (!pblCgiQueryString)
-				{
-					pblCgiExitOnError("%s: Out of memory\n", tag);
-				}
+				char* queryString = pblCgiMalloc(tag, length + contentLength + 1);
+				memcpy(queryString, pblCgiQueryString, length + 1);
+				PBL_FREE(pblCgiQueryString);
+				pblCgiQueryString = queryString;
 
-				int c;
 				pblCgiPostData = ptr = pblCgiQueryString + length;
-				while (contentLength-- > 0)
+				if (pblCgiInputBuffer)
+				{
+					if (contentLength > pblCgiInputLength)
+					{
+						contentLength = pblCgiInputLength;
+					}
+					memcpy(ptr, pblCgiInputBuffer, contentLength);
+					ptr += contentLength;
+				}
+				else
 				{
-					if ((c = getchar()) == EOF)
+					int c;
+					while (contentLength-- > 0)
 					{
-						break;
+						if ((c = getchar()) == EOF)
+						{
+							break;
+						}
+						*ptr++ = c;
 					}
-					*ptr++ = c;
 				}
 				*ptr = '\0';
 			}
@@ -1112,6 +1445,30 @@ void pblCgiParseQuery(int argc, char* argv[])
 	}
 }
 
+/**
+ * Forget all values of the previous request,
+ * used by persistent processes before the next request is handled.
+ */
+void pblCgiResetRequest(void)
+{
+	if (pblCgiRequest.queryMap)
+	{
+		pblMapFree(pblCgiRequest.queryMap);
+		pblCgiRequest.queryMap = NULL;
+	}
+	if (pblCgiRequest.valueMap)
+	{
+		pblCgiClearValues();
+		pblMapFree(pblCgiRequest.valueMap);
+		pblCgiRequest.valueMap = NULL;
+	}
+
+	pblCgiRequest.contentType = NULL;
+	pblCgiQueryString = NULL;
+	pblCgiPostData = NULL;
+	pblCgiContentLength = -1;
+}
+
 static char* pblCgiReplaceLowerThan(char* string, char* ptr2)
 {
 	static char* tag = "pblCgiReplaceLowerThan";
@@ -1608,14 +1965,14 @@ void pblCgiPrint(char* directory, char* fileName, char* contentType)
 		{
 			if (!skipKey)
 			{
-				fputs(pblCgiReplaceVariable(line, -1), stdout);
+				fputs(pblCgiReplaceVariable(line, -1), PBL_CGI_OUT);
 			}
 			continue;
 		}
 
 		if (skipKey)
 		{
-			skipKey = pblCgiSkip(line, skipKey, stdout, -1);
+			skipKey = pblCgiSkip(line, skipKey, PBL_CGI_OUT, -1);
 			continue;
 		}
 
@@ -1623,7 +1980,7 @@ void pblCgiPrint(char* directory, char* fileName, char* contentType)
 		{
 			while (start < ptr)
 			{
-				fputc(*start++, stdout);
+				fputc(*start++, PBL_CGI_OUT);
 			}
 			ptr += 12;
 
@@ -1634,7 +1991,7 @@ void pblCgiPrint(char* directory, char* fileName, char* contentType)
 				pblCgiPrint(directory, includeFileName, NULL);
 				PBL_FREE(includeFileName);
 
-				skipKey = pblCgiPrintStr(ptr2 + 3, stdout, -1);
+				skipKey = pblCgiPrintStr(ptr2 + 3, PBL_CGI_OUT, -1);
 			}
 			continue;
 		}
@@ -1642,7 +1999,7 @@ void pblCgiPrint(char* directory, char* fileName, char* contentType)
 		{
 			while (start < ptr)
 			{
-				fputc(*start++, stdout);
+				fputc(*start++, PBL_CGI_OUT);
 			}
 			ptr += 8;
 
@@ -1653,7 +2010,7 @@ void pblCgiPrint(char* directory, char* fileName, char* contentType)
 				PblList* lines = pblCgiReadFor(ptr2 + 3, forKey, stream);
 				if (lines)
 				{
-					pblCgiPrintFor(lines, forKey, stdout);
+					pblCgiPrintFor(lines, forKey, PBL_CGI_OUT);
 					while (pblListSize(lines))
 					{
 						char* p = pblListPop(lines);
@@ -1671,9 +2028,9 @@ void pblCgiPrint(char* directory, char* fileName, char* contentType)
 		}
 		while (start < ptr)
 		{
-			fputc(*start++, stdout);
+			fputc(*start++, PBL_CGI_OUT);
 		}
-		skipKey = pblCgiPrintStr(ptr, stdout, -1);
+		skipKey = pblCgiPrintStr(ptr, PBL_CGI_OUT, -1);
 	}
 	fclose(stream);
 }
@@ -1714,15 +2071,13 @@ void pblCgiMapFree(PblMap* map)
 	}
 }
 
-static PblMap* valueMap = NULL;
-
 PblMap* pblCgiValueMap()
 {
-	if (!valueMap)
+	if (!pblCgiRequest.valueMap)
 	{
-		valueMap = pblCgiNewMap();
+		pblCgiRequest.valueMap = pblCgiNewMap();
 	}
-	return valueMap;
+	return pblCgiRequest.valueMap;
 }
 /**
 * Set a value for the given key.
@@ -1763,7 +2118,7 @@ void pblCgiSetValueToMap(char* key, char* value, int iteration, PblMap* map)
 		{
 			pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
 		}
-		if (map == valueMap)
+		if (map == pblCgiRequest.valueMap)
 		{
 			PBL_CGI_TRACE("Out %s=%s", iteratedKey, value);
 		}
@@ -1779,7 +2134,7 @@ void pblCgiSetValueToMap(char* key, char* value, int iteration, PblMap* map)
 			{
 				pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
 			}
-			if (map == valueMap)
+			if (map == pblCgiRequest.valueMap)
 			{
 				PBL_CGI_TRACE("Out %s=%s", iteratedKey, index);
 			}
@@ -1793,7 +2148,7 @@ void pblCgiSetValueToMap(char* key, char* value, int iteration, PblMap* map)
 		{
 			pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
 		}
-		if (map == valueMap)
+		if (map == pblCgiRequest.valueMap)
 		{
 			PBL_CGI_TRACE("Out %s=%s", key, value);
 		}
@@ -1813,13 +2168,13 @@ void pblCgiUnSetValue(char* key)
 */
 void pblCgiClearValues()
 {
-	if (!valueMap)
+	if (!pblCgiRequest.valueMap)
 	{
 		return;
 	}
 
 	PBL_CGI_TRACE("Out cleared");
-	pblMapClear(valueMap);
+	pblMapClear(pblCgiRequest.valueMap);
 }
 
 /**
@@ -1827,11 +2182,11 @@ void pblCgiClearValues()
 */
 void pblCgiUnSetValueForIteration(char* key, int iteration)
 {
-	if (!valueMap)
+	if (!pblCgiRequest.valueMap)
 	{
 		return;
 	}
-	pblCgiUnSetValueFromMap(key, iteration, valueMap);
+	pblCgiUnSetValueFromMap(key, iteration, pblCgiRequest.valueMap);
 }
 
 /**
@@ -1882,14 +2237,14 @@ char* pblCgiValueForIteration(char* key, int iteration)
 	}
 	if (*key && *key == *pblCgiDurationKey && !strcmp(pblCgiDurationKey, key))
 	{
-		return pblCgiValueFromMap(key, iteration, valueMap);
+		return pblCgiValueFromMap(key, iteration, pblCgiRequest.valueMap);
 	}
 
-	if (!valueMap)
+	if (!pblCgiRequest.valueMap)
 	{
 		return NULL;
 	}
-	return pblCgiValueFromMap(key, iteration, valueMap);
+	return pblCgiValueFromMap(key, iteration, pblCgiRequest.valueMap);
 }
 
 /**
@@ -44,6 +44,7 @@ extern "C"
 #include <errno.h>
 #include <ctype.h>
 #include <time.h>
+#include <setjmp.h>
 
 #ifdef _WIN32
 
@@ -52,6 +53,7 @@ extern "C"
 #else
 #include <sys/time.h>
 #include <unistd.h>
+#include <pthread.h>
 #endif
 
 #include "pbl.h"
@@ -66,33 +68,108 @@ extern "C"
 
 #define PBL_CGI_TRACE if(pblCgiTraceFile) pblCgiTrace
 
+#define PBL_CGI_OUT (pblCgiOutputStream ? pblCgiOutputStream : stdout)
+
 #define PBL_CGI_COOKIE                         "PBL_CGI_COOKIE"
 #define PBL_CGI_COOKIE_PATH                    "PBL_CGI_COOKIE_PATH"
 #define PBL_CGI_COOKIE_DOMAIN                  "PBL_CGI_COOKIE_DOMAIN"
 
 #define PBL_CGI_TRACE_FILE                     "TraceFilePath"
 
+	/*****************************************************************************/
+	/* Type declarations                                                         */
+	/*****************************************************************************/
+
+	/*
+	 * A mutex protecting values shared by the threads of a process, see pblCgiMutexLock
+	 */
+#ifdef _WIN32
+	typedef SRWLOCK PblCgiMutex;
+#define PBL_CGI_MUTEX_INITIALIZER              SRWLOCK_INIT
+#else
+	typedef pthread_mutex_t PblCgiMutex;
+#define PBL_CGI_MUTEX_INITIALIZER              PTHREAD_MUTEX_INITIALIZER
+#endif
+
+	/*
+	 * A CGI handler of the HTTP server, the script name is the last component of the request path
+	 */
+	typedef struct PblCgiRoute_s
+	{
+		char* scriptName;
+		int (*handler)(int argc, char* argv[]);
+
+	} PblCgiRoute;
+
+	/*
+	 * The context of a request.
+	 *
+	 * Each thread has its own context, a thread handles one request at a time.
+	 * When running as a persistent process, e.g. as FastCGI application or HTTP server,
+	 * the output of a request is collected in a stream, the environment
+	 * of the request is given as a map and the POST input is given as a buffer.
+	 */
+	typedef struct PblCgiRequest_s
+	{
+		struct timeval startTime;
+		PblMap* configMap;
+		void* configTable;           /* A config table, see pblCgiConfigTableBuild, used instead of the map if set */
+
+		char* queryString;
+		char* postData;
+		int contentLength;
+
+		FILE* outputStream;
+		PblMap* environmentMap;
+		char* inputBuffer;
+		int inputLength;
+
+		char* contentType;           /* The content type printed for the request */
+		PblMap* queryMap;
+		PblMap* valueMap;
+
+		jmp_buf* errorJump;          /* Where pblCgiExitOnError continues, NULL to exit */
+
+	} PblCgiRequest;
+
 	/*****************************************************************************/
 	/* Variable declarations                                                     */
 	/*****************************************************************************/
 
-	extern PblMap* pblCgiConfigMap;
+	extern PBL_THREAD_LOCAL PblCgiRequest pblCgiRequest;
 
-	extern struct timeval pblCgiStartTime;
 	extern FILE* pblCgiTraceFile;
 	extern char* pblCgiValueIncrement;
 
-	extern char* pblCgiQueryString;
 	extern char* pblCgiCookieKey;
 	extern char* pblCgiCookieTag;
-	extern char* pblCgiPostData;
-	extern int pblCgiContentLength;
+
+	/*
+	 * The values of the current request, kept in the request context of the thread
+	 */
+#define pblCgiConfigMap                        (pblCgiRequest.configMap)
+#define pblCgiConfigTable                      (pblCgiRequest.configTable)
+#define pblCgiStartTime                        (pblCgiRequest.startTime)
+#define pblCgiQueryString                      (pblCgiRequest.queryString)
+#define pblCgiPostData                         (pblCgiRequest.postData)
+#define pblCgiContentLength                    (pblCgiRequest.contentLength)
+#define pblCgiOutputStream                     (pblCgiRequest.outputStream)
+#define pblCgiEnvironmentMap                   (pblCgiRequest.environmentMap)
+#define pblCgiInputBuffer                      (pblCgiRequest.inputBuffer)
+#define pblCgiInputLength                      (pblCgiRequest.inputLength)
 
 	/*****************************************************************************/
 	/* Function declarations                                                     */
 	/*****************************************************************************/
 
+	extern void pblCgiLock(void);
+	extern void pblCgiUnlock(void);
+	extern void pblCgiMutexLock(PblCgiMutex* mutex);
+	extern void pblCgiMutexUnlock(PblCgiMutex* mutex);
+
 	extern char* pblCgiConfigValue(char* key, char* defaultValue);
+	extern size_t pblCgiConfigTableBuild(PblMap* map, void* buffer, size_t bufferSize);
+	extern char* pblCgiConfigTableGet(void* table, char* key);
 	extern void pblCgiInitTrace(struct timeval* startTime, char* traceFilePath);
 	extern void pblCgiTrace(const char* format, ...);
 
@@ -101,6 +178,7 @@ extern "C"
 	extern char* pblCgiGetEnv(char* name);
 
 	extern void pblCgiExitOnError(const char* format, ...);
+	extern void pblCgiExitRequest(void);
 	extern char* pblCgiSprintf(const char* format, ...);
 
 	extern int pblCgiStrArrayContains(char** array, char* string);
@@ -125,6 +203,8 @@ extern "C"
 	extern PblMap* pblCgiFileToMap(PblMap* map, char* traceFilePath);
 
 	extern void pblCgiParseQuery(int argc, char* argv[]);
+	extern void pblCgiResetRequest(void);
+	extern int pblCgiRunRequest(int (*handler)(int argc, char* argv[]), int argc, char* argv[]);
 	extern char* pblCgiQueryValue(char* key);
 	extern char* pblCgiQueryValueForIteration(char* key, int iteration);
 
@@ -140,9 +220,24 @@ extern "C"
 	extern char* pblCgiValueForIteration(char* key, int iteration);
 	extern char* pblCgiValueFromMap(char* key, int iteration, PblMap* map);
 
+	extern void pblCgiSetContentType(char* type);
 	extern char* pblCgiGetCookie(char* cookieKey, char* cookieTag);
 	extern void pblCgiPrint(char* directory, char* fileName, char* contentType);
 
+#ifndef _WIN32
+
+	extern int pblFastCgiIsCgi(void);
+	extern int pblFastCgiAccept(void);
+	extern void pblFastCgiFinish(void);
+
+#endif
+
+#ifdef __linux__
+
+	extern int pblCgiServerRun(char* address, char* port, int nProcesses, int nThreads, int idleTimeout, PblCgiRoute* routes);
+
+#endif
+
 #ifdef WIN32
 
 	extern int gettimeofday(struct timeval* tp, struct timezone* tzp);
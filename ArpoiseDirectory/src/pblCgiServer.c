@@ -0,0 +1,1313 @@
+/*
+ pblCgiServer.c - HTTP server front end for CGI programs.
+
+ Copyright (c) 2026 Peter Graf. All rights reserved.
+
+ This file is part of PBL - The Program Base Library.
+ PBL is free software.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+ For more information on the Program Base Library or Peter Graf,
+ please see: http://www.mission-base.com/.
+
+ $Log: pblCgiServer.c,v $
+ Revision 1.1  2026/10/18 14:40:12  peter
+ Added the HTTP server front end
+
+ */
+
+ /*
+  * Make sure "strings <exe> | grep Id | sort -u" shows the source file versions
+  */
+char* pblCgiServer_c_id = "$Id: pblCgiServer.c,v 1.1 2026/10/18 14:40:12 peter Exp $";
+
+#ifdef __linux__
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <ctype.h>
+#include <memory.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+#include "pbl.h"
+#include "pblCgi.h"
+
+/*****************************************************************************/
+/* #defines                                                                  */
+/*****************************************************************************/
+
+#define PBL_CGI_SERVER_SOFTWARE             "pblCgiServer/1.1"
+#define PBL_CGI_SERVER_MAX_HEADER_LENGTH    (64 * 1024)
+#define PBL_CGI_SERVER_MAX_CONTENT_LENGTH   (16 * 1024 * 1024)
+#define PBL_CGI_SERVER_MAX_EVENTS           64
+#define PBL_CGI_SERVER_LISTEN_BACKLOG       1024
+
+/*****************************************************************************/
+/* Variables                                                                 */
+/*****************************************************************************/
+
+typedef struct PblCgiServerBuffer_s
+{
+	char* data;
+	size_t length;
+	size_t capacity;
+
+} PblCgiServerBuffer;
+
+/*
+ * A client connection of a worker process.
+ *
+ * The connections are registered with EPOLLONESHOT, only the thread that
+ * received an event for a connection uses it until it registers it again.
+ */
+typedef struct PblCgiConnection_s
+{
+	int socket;
+	int registered;               /* The connection was added to the epoll set         */
+	int busy;                     /* A thread is handling an event of the connection   */
+	int peerClosed;               /* The client has shut down its sending side         */
+	int keepAlive;                /* The connection stays open after the response      */
+	int continueSent;             /* A "100 Continue" was sent for the current request */
+	time_t lastActive;
+
+	char remoteAddress[INET6_ADDRSTRLEN];
+	char remotePort[8];
+
+	size_t headerLength;          /* Length of the request header once it is complete  */
+	long contentLength;           /* Length of the request body                        */
+	int headOnly;                 /* The request is a HEAD request                     */
+	PblMap* environment;          /* The CGI variables of the request                  */
+
+	PblCgiServerBuffer input;
+	PblCgiServerBuffer output;
+	size_t outputOffset;
+
+	struct PblCgiConnection_s* prev;
+	struct PblCgiConnection_s* next;
+
+} PblCgiConnection;
+
+static int pblCgiServerListenSocket = -1;
+static int pblCgiServerEpoll = -1;
+static char* pblCgiServerPort = "";
+static int pblCgiServerIdleTimeout = 30;
+static PblCgiRoute* pblCgiServerRoutes = NULL;
+static int pblCgiServerThreads = 1;
+
+/*
+ * The list of connections of a worker process, used for closing idle connections
+ */
+static PblCgiConnection* pblCgiServerConnections = NULL;
+static pthread_mutex_t pblCgiServerMutex = PTHREAD_MUTEX_INITIALIZER;
+static time_t pblCgiServerLastCheck = 0;
+
+/*
+ * The connection whose request is currently handled by a thread and the output collected for it
+ */
+static PBL_THREAD_LOCAL PblCgiConnection* pblCgiServerCurrent = NULL;
+static PBL_THREAD_LOCAL char* pblCgiServerOutputData = NULL;
+static PBL_THREAD_LOCAL size_t pblCgiServerOutputSize = 0;
+
+/*
+ * The memory a handler allocates with pbl_malloc comes from the arena of its thread,
+ * the arena is released in one shot when the request is finished.
+ */
+static PBL_THREAD_LOCAL PblArena* pblCgiServerArena = NULL;
+
+static volatile sig_atomic_t pblCgiServerStop = 0;
+static volatile sig_atomic_t pblCgiServerHangup = 0;
+
+/*****************************************************************************/
+/* Functions                                                                 */
+/*****************************************************************************/
+
+static void pblCgiServerReserve(PblCgiServerBuffer* buffer, size_t length)
+{
+	static char* tag = "pblCgiServerReserve";
+
+	if (buffer->length + length + 1 > buffer->capacity)
+	{
+		size_t capacity = buffer->capacity ? 2 * buffer->capacity : 4 * 1024;
+		while (capacity < buffer->length + length + 1)
+		{
+			capacity *= 2;
+		}
+		char* newData = realloc(buffer->data, capacity);
+		if (!newData)
+		{
+			pblCgiExitOnError("%s: Out of memory\n", tag);
+		}
+		buffer->data = newData;
+		buffer->capacity = capacity;
+	}
+}
+
+static void pblCgiServerAppend(PblCgiServerBuffer* buffer, char* data, size_t length)
+{
+	pblCgiServerReserve(buffer, length);
+	if (length > 0)
+	{
+		memcpy(buffer->data + buffer->length, data, length);
+	}
+	buffer->length += length;
+	buffer->data[buffer->length] = '\0';
+}
+
+static void pblCgiServerAppendString(PblCgiServerBuffer* buffer, char* string)
+{
+	pblCgiServerAppend(buffer, string, strlen(string));
+}
+
+/*
+ * Test whether a comma separated header value contains a token, ignoring case.
+ */
+static int pblCgiServerHasToken(char* value, char* token)
+{
+	size_t length = strlen(token);
+
+	while (value && *value)
+	{
+		while (*value == ' ' || *value == '\t' || *value == ',')
+		{
+			value++;
+		}
+		if (!strncasecmp(value, token, length)
+			&& (value[length] == '\0' || value[length] == ',' || value[length] == ' ' || value[length] == '\t'))
+		{
+			return 1;
+		}
+		value = strchr(value, ',');
+	}
+	return 0;
+}
+
+static void pblCgiServerSetVariable(PblMap* environment, char* name, char* value)
+{
+	static char* tag = "pblCgiServerSetVariable";
+
+	if (pblMapAddStrStr(environment, name, value) < 0)
+	{
+		pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
+	}
+}
+
+/*
+ * Set the epoll events a connection waits for.
+ *
+ * The connection is handed back to the epoll set, the caller must not use it afterwards.
+ */
+static void pblCgiServerWatch(PblCgiConnection* connection, unsigned int events)
+{
+	static char* tag = "pblCgiServerWatch";
+
+	struct epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.events = events | EPOLLONESHOT;
+	event.data.ptr = connection;
+
+	int operation = connection->registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+	connection->registered = 1;
+
+	pthread_mutex_lock(&pblCgiServerMutex);
+	connection->busy = 0;
+	pthread_mutex_unlock(&pblCgiServerMutex);
+
+	if (epoll_ctl(pblCgiServerEpoll, operation, connection->socket, &event) < 0)
+	{
+		pblCgiExitOnError("%s: epoll_ctl failed, errno %d\n", tag, errno);
+	}
+}
+
+static void pblCgiServerClose(PblCgiConnection* connection)
+{
+	close(connection->socket);
+
+	pthread_mutex_lock(&pblCgiServerMutex);
+	if (connection->prev)
+	{
+		connection->prev->next = connection->next;
+	}
+	else
+	{
+		pblCgiServerConnections = connection->next;
+	}
+	if (connection->next)
+	{
+		connection->next->prev = connection->prev;
+	}
+	pthread_mutex_unlock(&pblCgiServerMutex);
+
+	if (connection->environment)
+	{
+		pblMapFree(connection->environment);
+	}
+	free(connection->input.data);
+	free(connection->output.data);
+	free(connection);
+}
+
+/*
+ * Accept all pending connections of the listening socket.
+ */
+static void pblCgiServerAccept(void)
+{
+	static char* tag = "pblCgiServerAccept";
+
+	for (;;)
+	{
+		struct sockaddr_storage address;
+		socklen_t length = sizeof(address);
+
+		int socket = accept4(pblCgiServerListenSocket, (struct sockaddr*)&address, &length, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (socket < 0)
+		{
+			if (errno == EINTR || errno == ECONNABORTED)
+			{
+				continue;
+			}
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+			{
+				PBL_CGI_TRACE("%s: accept failed, errno %d", tag, errno);
+			}
+			return;
+		}
+
+		PblCgiConnection* connection = calloc(1, sizeof(PblCgiConnection));
+		if (!connection)
+		{
+			close(socket);
+			PBL_CGI_TRACE("%s: Out of memory", tag);
+			return;
+		}
+		connection->socket = socket;
+		connection->lastActive = time(NULL);
+		connection->contentLength = -1;
+		getnameinfo((struct sockaddr*)&address, length, connection->remoteAddress, sizeof(connection->remoteAddress),
+			connection->remotePort, sizeof(connection->remotePort), NI_NUMERICHOST | NI_NUMERICSERV);
+
+		pthread_mutex_lock(&pblCgiServerMutex);
+		connection->next = pblCgiServerConnections;
+		if (pblCgiServerConnections)
+		{
+			pblCgiServerConnections->prev = connection;
+		}
+		pblCgiServerConnections = connection;
+		pthread_mutex_unlock(&pblCgiServerMutex);
+
+		pblCgiServerWatch(connection, EPOLLIN | EPOLLRDHUP);
+	}
+}
+
+/*
+ * Start the response of a connection with a status line and the common headers.
+ */
+static void pblCgiServerStartResponse(PblCgiConnection* connection, char* status)
+{
+	PblCgiServerBuffer* output = &connection->output;
+
+	pblCgiServerAppendString(output, "HTTP/1.1 ");
+	pblCgiServerAppendString(output, status);
+	pblCgiServerAppendString(output, "\r\nServer: " PBL_CGI_SERVER_SOFTWARE "\r\n");
+
+	char date[64];
+	struct tm tm;
+	time_t now = time(NULL);
+	strftime(date, sizeof(date), "Date: %a, %d %b %Y %H:%M:%S GMT\r\n", gmtime_r(&now, &tm));
+	pblCgiServerAppendString(output, date);
+}
+
+/*
+ * Finish the header of a response and append the body.
+ */
+static void pblCgiServerEndResponse(PblCgiConnection* connection, char* body, size_t length)
+{
+	PblCgiServerBuffer* output = &connection->output;
+
+	char buffer[128];
+	snprintf(buffer, sizeof(buffer), "Content-Length: %lu\r\nConnection: %s\r\n\r\n",
+		(unsigned long)length, connection->keepAlive ? "keep-alive" : "close");
+	pblCgiServerAppendString(output, buffer);
+
+	if (!connection->headOnly)
+	{
+		pblCgiServerAppend(output, body, length);
+	}
+}
+
+/*
+ * Create the response for a request the server itself rejects.
+ */
+static void pblCgiServerError(PblCgiConnection* connection, char* status, int keepAlive)
+{
+	char body[256];
+	snprintf(body, sizeof(body), "<!DOCTYPE html>\n<html>\n<head>\n<title>%s</title>\n</head>\n<body>\n<h1>%s</h1>\n</body>\n</html>\n",
+		status, status);
+
+	connection->keepAlive = keepAlive && connection->keepAlive;
+	pblCgiServerStartResponse(connection, status);
+	pblCgiServerAppendString(&connection->output, "Content-Type: text/html\r\n");
+	pblCgiServerEndResponse(connection, body, strlen(body));
+}
+
+/*
+ * Convert the output of a CGI handler to an HTTP response.
+ *
+ * The CGI header lines are passed on, a "Status:" header gives the status line,
+ * a "Location:" header without status is a redirect.
+ */
+static void pblCgiServerSetResponse(PblCgiConnection* connection, char* data, size_t size)
+{
+	char* end = data + size;
+	char* ptr = data;
+	char* body = NULL;
+	char* status = NULL;
+	size_t statusLength = 0;
+	int isRedirect = 0;
+
+	while (ptr < end)
+	{
+		char* eol = memchr(ptr, '\n', end - ptr);
+		if (!eol)
+		{
+			break;
+		}
+		char* lineEnd = (eol > ptr && eol[-1] == '\r') ? eol - 1 : eol;
+		if (lineEnd == ptr)
+		{
+			body = eol + 1;
+			break;
+		}
+		if (!memchr(ptr, ':', lineEnd - ptr))
+		{
+			break;
+		}
+		if (!strncasecmp(ptr, "Status:", 7))
+		{
+			for (status = ptr + 7; status < lineEnd && (*status == ' ' || *status == '\t'); status++)
+				;
+			statusLength = lineEnd - status;
+		}
+		else if (!strncasecmp(ptr, "Location:", 9))
+		{
+			isRedirect = 1;
+		}
+		ptr = eol + 1;
+	}
+
+	if (!body)
+	{
+		// The output does not start with a CGI header
+		//
+		pblCgiServerStartResponse(connection, "200 OK");
+		pblCgiServerAppendString(&connection->output, "Content-Type: text/html\r\n");
+		pblCgiServerEndResponse(connection, data, size);
+		return;
+	}
+
+	if (status && statusLength > 0)
+	{
+		char* statusLine = pblCgiStrRangeDup(status, status + statusLength);
+		pblCgiServerStartResponse(connection, statusLine);
+		PBL_FREE(statusLine);
+	}
+	else
+	{
+		pblCgiServerStartResponse(connection, isRedirect ? "302 Found" : "200 OK");
+	}
+
+	for (ptr = data; ptr < body;)
+	{
+		char* eol = memchr(ptr, '\n', body - ptr);
+		char* lineEnd = (eol > ptr && eol[-1] == '\r') ? eol - 1 : eol;
+		if (lineEnd > ptr && strncasecmp(ptr, "Status:", 7))
+		{
+			pblCgiServerAppend(&connection->output, ptr, lineEnd - ptr);
+			pblCgiServerAppendString(&connection->output, "\r\n");
+		}
+		ptr = eol + 1;
+	}
+	pblCgiServerEndResponse(connection, body, end - body);
+}
+
+/*
+ * Finish the request currently handled, the output collected becomes the HTTP response.
+ */
+static void pblCgiServerFinish(void)
+{
+	PblCgiConnection* connection = pblCgiServerCurrent;
+	if (!connection)
+	{
+		return;
+	}
+	pblCgiServerCurrent = NULL;
+
+	fclose(pblCgiOutputStream);
+	pblCgiOutputStream = NULL;
+	pblCgiEnvironmentMap = NULL;
+	pblCgiInputBuffer = NULL;
+	pblCgiInputLength = 0;
+
+	pblCgiServerSetResponse(connection, pblCgiServerOutputData, pblCgiServerOutputSize);
+
+	free(pblCgiServerOutputData);
+	pblCgiServerOutputData = NULL;
+	pblCgiServerOutputSize = 0;
+}
+
+/*
+ * A request that exits the worker, e.g. with a pblCgiExitOnError outside of pblCgiRunRequest,
+ * still gets its output.
+ */
+static void pblCgiServerAtExit(void)
+{
+	PblCgiConnection* connection = pblCgiServerCurrent;
+	if (!connection)
+	{
+		return;
+	}
+	connection->keepAlive = 0;
+	pblCgiServerFinish();
+
+	int flags = fcntl(connection->socket, F_GETFL, 0);
+	fcntl(connection->socket, F_SETFL, flags & ~O_NONBLOCK);
+
+	char* ptr = connection->output.data + connection->outputOffset;
+	size_t length = connection->output.length - connection->outputOffset;
+	while (length > 0)
+	{
+		ssize_t rc = send(connection->socket, ptr, length, MSG_NOSIGNAL);
+		if (rc < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if (rc <= 0)
+		{
+			break;
+		}
+		ptr += rc;
+		length -= rc;
+	}
+	close(connection->socket);
+}
+
+/*
+ * Find the handler for a request path, the last component of the path is the script name.
+ */
+static PblCgiRoute* pblCgiServerRoute(char* path)
+{
+	if (!path)
+	{
+		return NULL;
+	}
+	char* scriptName = strrchr(path, '/');
+	scriptName = scriptName ? scriptName + 1 : path;
+
+	for (PblCgiRoute* route = pblCgiServerRoutes; route && route->scriptName; route++)
+	{
+		if (!strcmp(route->scriptName, scriptName))
+		{
+			return route;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Run the CGI handler for the complete request of a connection.
+ */
+static void pblCgiServerRunHandler(PblCgiConnection* connection, PblCgiRoute* route, char* body)
+{
+	static char* tag = "pblCgiServerRunHandler";
+
+	pblCgiResetRequest();
+	pblCgiEnvironmentMap = connection->environment;
+	pblCgiInputBuffer = body;
+	pblCgiInputLength = connection->contentLength > 0 ? connection->contentLength : 0;
+
+	pblCgiOutputStream = open_memstream(&pblCgiServerOutputData, &pblCgiServerOutputSize);
+	if (!pblCgiOutputStream)
+	{
+		pblCgiExitOnError("%s: open_memstream failed, errno %d\n", tag, errno);
+	}
+	pblCgiServerCurrent = connection;
+
+	if (!pblCgiServerArena && !(pblCgiServerArena = pblArenaNew(0)))
+	{
+		pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
+	}
+	PblArena* previousArena = pblArenaSet(pblCgiServerArena);
+
+	char* argv[] = { route->scriptName, NULL };
+	pblCgiRunRequest(route->handler, 1, argv);
+
+	pblCgiServerFinish();
+
+	pblCgiResetRequest();
+	pblArenaSet(previousArena);
+	pblArenaReset(pblCgiServerArena);
+}
+
+/*
+ * Parse the header of a request into the CGI variables of the connection.
+ *
+ * Returns NULL if the header is valid, the status of the error response otherwise.
+ */
+static char* pblCgiServerParseHeader(PblCgiConnection* connection, char* header)
+{
+	if (connection->environment)
+	{
+		pblMapClear(connection->environment);
+	}
+	else
+	{
+		connection->environment = pblCgiNewMap();
+	}
+	PblMap* environment = connection->environment;
+
+	// The request line, method, request uri and protocol
+	//
+	char* eol = strchr(header, '\n');
+	if (!eol)
+	{
+		return "400 Bad Request";
+	}
+	*eol = '\0';
+	if (eol > header && eol[-1] == '\r')
+	{
+		eol[-1] = '\0';
+	}
+
+	char* method = header;
+	char* uri = strchr(method, ' ');
+	if (!uri)
+	{
+		return "400 Bad Request";
+	}
+	*uri++ = '\0';
+	char* protocol = strchr(uri, ' ');
+	if (!protocol || *uri != '/')
+	{
+		return "400 Bad Request";
+	}
+	*protocol++ = '\0';
+	if (strncmp(protocol, "HTTP/1.", 7))
+	{
+		return "505 HTTP Version Not Supported";
+	}
+
+	pblCgiServerSetVariable(environment, "GATEWAY_INTERFACE", "CGI/1.1");
+	pblCgiServerSetVariable(environment, "SERVER_SOFTWARE", PBL_CGI_SERVER_SOFTWARE);
+	pblCgiServerSetVariable(environment, "SERVER_PROTOCOL", protocol);
+	pblCgiServerSetVariable(environment, "SERVER_PORT", pblCgiServerPort);
+	pblCgiServerSetVariable(environment, "REMOTE_ADDR", connection->remoteAddress);
+	pblCgiServerSetVariable(environment, "REMOTE_PORT", connection->remotePort);
+
+	// A HEAD request is handled as GET, the body of the response is not sent
+	//
+	connection->headOnly = !strcmp(method, "HEAD");
+	if (connection->headOnly)
+	{
+		method = "GET";
+	}
+	else if (strcmp(method, "GET") && strcmp(method, "POST"))
+	{
+		return "501 Not Implemented";
+	}
+	pblCgiServerSetVariable(environment, "REQUEST_METHOD", method);
+	pblCgiServerSetVariable(environment, "REQUEST_URI", uri);
+
+	connection->keepAlive = strcmp(protocol, "HTTP/1.0") != 0;
+	connection->contentLength = 0;
+
+	char* queryString = strchr(uri, '?');
+	if (queryString)
+	{
+		*queryString++ = '\0';
+	}
+	pblCgiServerSetVariable(environment, "QUERY_STRING", queryString ? queryString : "");
+	pblCgiServerSetVariable(environment, "SCRIPT_NAME", uri);
+
+	// The header lines, passed on as HTTP_* variables like a web server does
+	//
+	for (char* line = eol + 1; *line; line = eol + 1)
+	{
+		eol = strchr(line, '\n');
+		if (!eol)
+		{
+			break;
+		}
+		*eol = '\0';
+		if (eol > line && eol[-1] == '\r')
+		{
+			eol[-1] = '\0';
+		}
+		if (!*line)
+		{
+			break;
+		}
+
+		char* value = strchr(line, ':');
+		if (!value || value == line)
+		{
+			return "400 Bad Request";
+		}
+		*value++ = '\0';
+		while (*value == ' ' || *value == '\t')
+		{
+			value++;
+		}
+		pblCgiStrTrim(value);
+
+		if (!strcasecmp(line, "Content-Length"))
+		{
+			char* ptr;
+			connection->contentLength = strtol(value, &ptr, 10);
+			if (*ptr || connection->contentLength < 0)
+			{
+				return "400 Bad Request";
+			}
+			if (connection->contentLength > PBL_CGI_SERVER_MAX_CONTENT_LENGTH)
+			{
+				return "413 Payload Too Large";
+			}
+			pblCgiServerSetVariable(environment, "CONTENT_LENGTH", value);
+			continue;
+		}
+		if (!strcasecmp(line, "Content-Type"))
+		{
+			pblCgiServerSetVariable(environment, "CONTENT_TYPE", value);
+			continue;
+		}
+		if (!strcasecmp(line, "Transfer-Encoding"))
+		{
+			return "411 Length Required";
+		}
+		if (!strcasecmp(line, "Connection"))
+		{
+			if (pblCgiServerHasToken(value, "close"))
+			{
+				connection->keepAlive = 0;
+			}
+			else if (pblCgiServerHasToken(value, "keep-alive"))
+			{
+				connection->keepAlive = 1;
+			}
+		}
+		else if (!strcasecmp(line, "Expect"))
+		{
+			if (!strcasecmp(value, "100-continue") && !connection->continueSent)
+			{
+				connection->continueSent = 1;
+				send(connection->socket, "HTTP/1.1 100 Continue\r\n\r\n", 25, MSG_NOSIGNAL);
+			}
+		}
+		else if (!strcasecmp(line, "Host"))
+		{
+			char* serverName = pblCgiStrDup(value);
+			char* ptr = strrchr(serverName, ':');
+			if (ptr && !strchr(ptr, ']'))
+			{
+				*ptr = '\0';
+			}
+			pblCgiServerSetVariable(environment, "SERVER_NAME", serverName);
+			PBL_FREE(serverName);
+		}
+
+		char* name = pblCgiStrCat("HTTP_", line);
+		for (char* ptr = name + 5; *ptr; ptr++)
+		{
+			*ptr = *ptr == '-' ? '_' : toupper((unsigned char)*ptr);
+		}
+		char* oldValue = pblMapGetStr(environment, name);
+		if (oldValue)
+		{
+			char* newValue = pblCgiSprintf("%s%s%s", oldValue, strcmp(name, "HTTP_COOKIE") ? ", " : "; ", value);
+			pblCgiServerSetVariable(environment, name, newValue);
+			PBL_FREE(newValue);
+		}
+		else
+		{
+			pblCgiServerSetVariable(environment, name, value);
+		}
+		PBL_FREE(name);
+	}
+	return NULL;
+}
+
+/*
+ * Handle the requests received on a connection, as long as no response is pending.
+ *
+ * Returns 0 if the connection is still open, -1 if it was closed.
+ */
+static int pblCgiServerProcess(PblCgiConnection* connection)
+{
+	static char* tag = "pblCgiServerProcess";
+	PblCgiServerBuffer* input = &connection->input;
+
+	while (connection->outputOffset >= connection->output.length)
+	{
+		connection->output.length = 0;
+		connection->outputOffset = 0;
+
+		if (!connection->headerLength)
+		{
+			char* ptr = input->length ? strstr(input->data, "\r\n\r\n") : NULL;
+			size_t length = ptr ? ptr + 4 - input->data : 0;
+			if (!ptr && input->length)
+			{
+				ptr = strstr(input->data, "\n\n");
+				length = ptr ? ptr + 2 - input->data : 0;
+			}
+			if (!ptr)
+			{
+				if (input->length > PBL_CGI_SERVER_MAX_HEADER_LENGTH)
+				{
+					connection->keepAlive = 0;
+					pblCgiServerError(connection, "431 Request Header Fields Too Large", 0);
+					break;
+				}
+				if (connection->peerClosed || (input->length && strlen(input->data) < input->length))
+				{
+					pblCgiServerClose(connection);
+					return -1;
+				}
+				pblCgiServerWatch(connection, EPOLLIN | EPOLLRDHUP);
+				return 0;
+			}
+			connection->headerLength = length;
+		}
+
+		if (connection->contentLength < 0)
+		{
+			// The header is copied with the empty line ending it, the parser needs the end of each line
+			//
+			char* header = pbl_memdup(tag, input->data, connection->headerLength + 1);
+			if (!header)
+			{
+				pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
+			}
+			header[connection->headerLength] = '\0';
+			char* status = pblCgiServerParseHeader(connection, header);
+			PBL_FREE(header);
+			if (status)
+			{
+				pblCgiServerError(connection, status, 0);
+				break;
+			}
+		}
+
+		if (input->length < connection->headerLength + connection->contentLength)
+		{
+			// Waiting for the rest of the request body
+			//
+			if (connection->peerClosed)
+			{
+				pblCgiServerClose(connection);
+				return -1;
+			}
+			pblCgiServerWatch(connection, EPOLLIN | EPOLLRDHUP);
+			return 0;
+		}
+
+		PblCgiRoute* route = pblCgiServerRoute(pblMapGetStr(connection->environment, "SCRIPT_NAME"));
+		if (!route)
+		{
+			pblCgiServerError(connection, "404 Not Found", 1);
+		}
+		else
+		{
+			pblCgiServerRunHandler(connection, route, input->data + connection->headerLength);
+		}
+
+		// The request is handled, remove it from the input, pipelined requests stay
+		//
+		size_t consumed = connection->headerLength + connection->contentLength;
+		if (consumed > input->length)
+		{
+			consumed = input->length;
+		}
+		memmove(input->data, input->data + consumed, input->length - consumed + 1);
+		input->length -= consumed;
+		connection->headerLength = 0;
+		connection->contentLength = -1;
+		connection->continueSent = 0;
+
+		// Send the response
+		//
+		while (connection->outputOffset < connection->output.length)
+		{
+			ssize_t rc = send(connection->socket, connection->output.data + connection->outputOffset,
+				connection->output.length - connection->outputOffset, MSG_NOSIGNAL);
+			if (rc < 0)
+			{
+				if (errno == EINTR)
+				{
+					continue;
+				}
+				if (errno == EAGAIN || errno == EWOULDBLOCK)
+				{
+					pblCgiServerWatch(connection, EPOLLOUT);
+					return 0;
+				}
+				pblCgiServerClose(connection);
+				return -1;
+			}
+			connection->outputOffset += rc;
+		}
+
+		if (!connection->keepAlive)
+		{
+			pblCgiServerClose(connection);
+			return -1;
+		}
+	}
+
+	// An error response created above, the connection is closed once it is sent
+	//
+	pblCgiServerWatch(connection, EPOLLOUT);
+	return 0;
+}
+
+/*
+ * Handle the epoll events of a connection.
+ */
+static void pblCgiServerHandle(PblCgiConnection* connection, unsigned int events)
+{
+	pthread_mutex_lock(&pblCgiServerMutex);
+	connection->busy = 1;
+	pthread_mutex_unlock(&pblCgiServerMutex);
+
+	connection->lastActive = time(NULL);
+
+	if (events & EPOLLERR)
+	{
+		pblCgiServerClose(connection);
+		return;
+	}
+
+	if (connection->outputOffset < connection->output.length)
+	{
+		while (connection->outputOffset < connection->output.length)
+		{
+			ssize_t rc = send(connection->socket, connection->output.data + connection->outputOffset,
+				connection->output.length - connection->outputOffset, MSG_NOSIGNAL);
+			if (rc < 0)
+			{
+				if (errno == EINTR)
+				{
+					continue;
+				}
+				if (errno == EAGAIN || errno == EWOULDBLOCK)
+				{
+					pblCgiServerWatch(connection, EPOLLOUT);
+					return;
+				}
+				pblCgiServerClose(connection);
+				return;
+			}
+			connection->outputOffset += rc;
+		}
+		if (!connection->keepAlive)
+		{
+			pblCgiServerClose(connection);
+			return;
+		}
+	}
+
+	if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP))
+	{
+		for (;;)
+		{
+			PblCgiServerBuffer* input = &connection->input;
+			pblCgiServerReserve(input, 16 * 1024);
+
+			ssize_t rc = recv(connection->socket, input->data + input->length, input->capacity - input->length - 1, 0);
+			if (rc > 0)
+			{
+				input->length += rc;
+				input->data[input->length] = '\0';
+
+				if (input->length > PBL_CGI_SERVER_MAX_HEADER_LENGTH + PBL_CGI_SERVER_MAX_CONTENT_LENGTH)
+				{
+					pblCgiServerClose(connection);
+					return;
+				}
+				continue;
+			}
+			if (rc == 0)
+			{
+				connection->peerClosed = 1;
+				break;
+			}
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+			{
+				break;
+			}
+			pblCgiServerClose(connection);
+			return;
+		}
+	}
+
+	pblCgiServerProcess(connection);
+}
+
+/*
+ * Close the connections that were idle for longer than the idle timeout.
+ *
+ * The connections are only shut down, the thread receiving the resulting event closes them.
+ */
+static void pblCgiServerCloseIdle(void)
+{
+	time_t now = time(NULL);
+
+	pthread_mutex_lock(&pblCgiServerMutex);
+	if (now != pblCgiServerLastCheck)
+	{
+		pblCgiServerLastCheck = now;
+
+		for (PblCgiConnection* connection = pblCgiServerConnections; connection; connection = connection->next)
+		{
+			if (!connection->busy && now - connection->lastActive > pblCgiServerIdleTimeout)
+			{
+				shutdown(connection->socket, SHUT_RDWR);
+			}
+		}
+	}
+	pthread_mutex_unlock(&pblCgiServerMutex);
+}
+
+/*
+ * The event loop of the threads of a worker process.
+ *
+ * All threads wait on the same epoll set, a thread handles the request of a connection
+ * until the response is sent or the socket would block.
+ */
+static void* pblCgiServerLoop(void* arg)
+{
+	static char* tag = "pblCgiServerLoop";
+
+	int maxEvents = pblCgiServerThreads > 1 ? 1 : PBL_CGI_SERVER_MAX_EVENTS;
+	struct epoll_event events[PBL_CGI_SERVER_MAX_EVENTS];
+
+	for (;;)
+	{
+		int n = epoll_wait(pblCgiServerEpoll, events, maxEvents, 1000);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			pblCgiExitOnError("%s: epoll_wait failed, errno %d\n", tag, errno);
+		}
+
+		for (int i = 0; i < n; i++)
+		{
+			if (!events[i].data.ptr)
+			{
+				pblCgiServerAccept();
+			}
+			else
+			{
+				pblCgiServerHandle(events[i].data.ptr, events[i].events);
+			}
+		}
+		pblCgiServerCloseIdle();
+	}
+	return NULL;
+}
+
+/*
+ * Start the threads of a worker process.
+ */
+static void pblCgiServerWorker(void)
+{
+	static char* tag = "pblCgiServerWorker";
+
+	pblCgiServerEpoll = epoll_create1(EPOLL_CLOEXEC);
+	if (pblCgiServerEpoll < 0)
+	{
+		pblCgiExitOnError("%s: epoll_create1 failed, errno %d\n", tag, errno);
+	}
+
+	struct epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN;
+#ifdef EPOLLEXCLUSIVE
+	event.events |= EPOLLEXCLUSIVE;
+#endif
+	event.data.ptr = NULL;
+	if (epoll_ctl(pblCgiServerEpoll, EPOLL_CTL_ADD, pblCgiServerListenSocket, &event) < 0)
+	{
+		pblCgiExitOnError("%s: epoll_ctl failed, errno %d\n", tag, errno);
+	}
+
+	atexit(pblCgiServerAtExit);
+	pblCgiServerLastCheck = time(NULL);
+
+	// SIGHUP is blocked in all threads of the worker, it must not interrupt a request,
+	// a handler can start a thread of its own to receive it, e.g. with signalfd
+	//
+	sigset_t hangup;
+	sigemptyset(&hangup);
+	sigaddset(&hangup, SIGHUP);
+	pthread_sigmask(SIG_BLOCK, &hangup, NULL);
+
+	for (int i = 1; i < pblCgiServerThreads; i++)
+	{
+		pthread_t thread;
+		int rc = pthread_create(&thread, NULL, pblCgiServerLoop, NULL);
+		if (rc)
+		{
+			pblCgiExitOnError("%s: pthread_create failed, rc %d\n", tag, rc);
+		}
+		pthread_detach(thread);
+	}
+	pblCgiServerLoop(NULL);
+}
+
+static int pblCgiServerListen(char* address, char* port)
+{
+	static char* tag = "pblCgiServerListen";
+
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+
+	struct addrinfo* addresses = NULL;
+	int rc = getaddrinfo(address && *address ? address : NULL, port, &hints, &addresses);
+	if (rc)
+	{
+		pblCgiExitOnError("%s: getaddrinfo of '%s' port %s failed, %s\n", tag, address ? address : "", port, gai_strerror(rc));
+	}
+
+	int listenSocket = -1;
+	for (struct addrinfo* ai = addresses; ai; ai = ai->ai_next)
+	{
+		listenSocket = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol);
+		if (listenSocket < 0)
+		{
+			continue;
+		}
+		int on = 1;
+		setsockopt(listenSocket, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+		if (ai->ai_family == AF_INET6)
+		{
+			int off = 0;
+			setsockopt(listenSocket, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+		}
+		if (!bind(listenSocket, ai->ai_addr, ai->ai_addrlen) && !listen(listenSocket, PBL_CGI_SERVER_LISTEN_BACKLOG))
+		{
+			break;
+		}
+		close(listenSocket);
+		listenSocket = -1;
+	}
+	freeaddrinfo(addresses);
+
+	if (listenSocket < 0)
+	{
+		pblCgiExitOnError("%s: Cannot listen on '%s' port %s, errno %d\n", tag, address ? address : "", port, errno);
+	}
+	return listenSocket;
+}
+
+static void pblCgiServerSignal(int signal)
+{
+	if (signal == SIGHUP)
+	{
+		pblCgiServerHangup = 1;
+		return;
+	}
+	pblCgiServerStop = 1;
+}
+
+static pid_t pblCgiServerFork(void)
+{
+	static char* tag = "pblCgiServerFork";
+
+	if (pblCgiTraceFile)
+	{
+		fflush(pblCgiTraceFile);
+	}
+	fflush(stdout);
+
+	pid_t pid = fork();
+	if (pid < 0)
+	{
+		PBL_CGI_TRACE("%s: fork failed, errno %d", tag, errno);
+		return -1;
+	}
+	if (pid == 0)
+	{
+		signal(SIGTERM, SIG_DFL);
+		signal(SIGINT, SIG_DFL);
+		pblCgiServerWorker();
+		exit(0);
+	}
+	return pid;
+}
+
+/**
+ * Run an HTTP server that passes its requests to CGI handler functions.
+ *
+ * The server listens on the address and port given, the request path selects the
+ * handler, the last component of the path has to be the script name of a route.
+ * A handler is called with the CGI variables, the request body and the output set
+ * up like for a CGI program started by a web server.
+ *
+ * The requests are handled by worker processes, each with a pool of threads running
+ * an epoll event loop, each thread has its own request context.
+ * The calling process supervises the workers and replaces a worker that exits,
+ * e.g. because a request ended with pblCgiExitOnError.
+ *
+ * SIGHUP is passed on to the workers, they keep it blocked in all their threads.
+ *
+ * The function returns when the process receives SIGTERM or SIGINT.
+ *
+ * @return int rc == 0: The server was stopped.
+ */
+int pblCgiServerRun(
+	char* address,           /** The address to listen on, NULL or empty for all addresses */
+	char* port,              /** The port to listen on                                      */
+	int nProcesses,          /** The number of worker processes                             */
+	int nThreads,            /** The number of threads of a worker process                  */
+	int idleTimeout,         /** Seconds an idle connection is kept open                    */
+	PblCgiRoute* routes      /** The handlers, terminated by a route with a NULL script name */
+)
+{
+	pblCgiServerRoutes = routes;
+	pblCgiServerPort = port;
+	pblCgiServerIdleTimeout = idleTimeout > 0 ? idleTimeout : 30;
+	pblCgiServerThreads = nThreads > 0 ? nThreads : 1;
+	if (nProcesses < 1)
+	{
+		nProcesses = 1;
+	}
+
+	pblCgiServerListenSocket = pblCgiServerListen(address, port);
+
+	// No SA_RESTART, waitpid has to return when the server is stopped
+	//
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = pblCgiServerSignal;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGTERM, &action, NULL);
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGHUP, &action, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	pid_t* pids = calloc(nProcesses, sizeof(pid_t));
+	time_t* startTimes = calloc(nProcesses, sizeof(time_t));
+	if (!pids || !startTimes)
+	{
+		pblCgiExitOnError("pblCgiServerRun: Out of memory\n");
+	}
+
+	PBL_CGI_TRACE("Listening on '%s' port %s, %d processes, %d threads", address ? address : "", port, nProcesses, pblCgiServerThreads);
+
+	while (!pblCgiServerStop)
+	{
+		for (int i = 0; i < nProcesses && !pblCgiServerStop; i++)
+		{
+			if (pids[i] <= 0)
+			{
+				if (startTimes[i] && time(NULL) - startTimes[i] < 1)
+				{
+					// Do not restart a failing worker in a tight loop
+					//
+					sleep(1);
+				}
+				startTimes[i] = time(NULL);
+				pids[i] = pblCgiServerFork();
+			}
+		}
+
+		int status = 0;
+		pid_t pid = waitpid(-1, &status, 0);
+		if (pblCgiServerHangup)
+		{
+			pblCgiServerHangup = 0;
+			PBL_CGI_TRACE("SIGHUP, passing it on to the workers");
+			for (int i = 0; i < nProcesses; i++)
+			{
+				if (pids[i] > 0)
+				{
+					kill(pids[i], SIGHUP);
+				}
+			}
+		}
+		if (pid < 0)
+		{
+			if (errno == ECHILD)
+			{
+				sleep(1);
+			}
+			continue;
+		}
+		for (int i = 0; i < nProcesses; i++)
+		{
+			if (pids[i] == pid)
+			{
+				pids[i] = 0;
+				PBL_CGI_TRACE("Worker %d exited, status %d", pid, WIFEXITED(status) ? WEXITSTATUS(status) : -WTERMSIG(status));
+				break;
+			}
+		}
+	}
+
+	for (int i = 0; i < nProcesses; i++)
+	{
+		if (pids[i] > 0)
+		{
+			kill(pids[i], SIGTERM);
+		}
+	}
+	while (wait(NULL) > 0 || errno == EINTR)
+		;
+
+	close(pblCgiServerListenSocket);
+	pblCgiServerListenSocket = -1;
+	free(pids);
+	free(startTimes);
+
+	PBL_CGI_TRACE("Server stopped");
+	return 0;
+}
+
+#endif
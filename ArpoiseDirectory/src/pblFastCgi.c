@@ -0,0 +1,626 @@
+/*
+ pblFastCgi.c - FastCGI responder functions.
+
+ Copyright (c) 2026 Peter Graf. All rights reserved.
+
+ This file is part of PBL - The Program Base Library.
+ PBL is free software.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+ For more information on the Program Base Library or Peter Graf,
+ please see: http://www.mission-base.com/.
+
+ $Log: pblFastCgi.c,v $
+ Revision 1.1  2026/10/18 10:12:31  peter
+ Added FastCGI mode
+
+ */
+
+ /*
+  * Make sure "strings <exe> | grep Id | sort -u" shows the source file versions
+  */
+char* pblFastCgi_c_id = "$Id: pblFastCgi.c,v 1.1 2026/10/18 10:12:31 peter Exp $";
+
+#ifndef _WIN32
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <memory.h>
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "pbl.h"
+#include "pblCgi.h"
+
+/*****************************************************************************/
+/* #defines                                                                  */
+/*****************************************************************************/
+
+/*
+ * The values of the FastCGI specification 1.0
+ */
+#define PBL_FCGI_LISTENSOCK_FILENO      0
+#define PBL_FCGI_HEADER_LEN             8
+#define PBL_FCGI_VERSION_1              1
+#define PBL_FCGI_MAX_CONTENT_LEN        65535
+
+#define PBL_FCGI_BEGIN_REQUEST          1
+#define PBL_FCGI_ABORT_REQUEST          2
+#define PBL_FCGI_END_REQUEST            3
+#define PBL_FCGI_PARAMS                 4
+#define PBL_FCGI_STDIN                  5
+#define PBL_FCGI_STDOUT                 6
+#define PBL_FCGI_GET_VALUES             9
+#define PBL_FCGI_GET_VALUES_RESULT      10
+#define PBL_FCGI_UNKNOWN_TYPE           11
+
+#define PBL_FCGI_KEEP_CONN              1
+#define PBL_FCGI_RESPONDER              1
+
+#define PBL_FCGI_REQUEST_COMPLETE       0
+#define PBL_FCGI_CANT_MPX_CONN          1
+#define PBL_FCGI_UNKNOWN_ROLE           3
+
+/*****************************************************************************/
+/* Variables                                                                 */
+/*****************************************************************************/
+
+typedef struct PblFastCgiBuffer_s
+{
+	char* data;
+	size_t length;
+	size_t capacity;
+
+} PblFastCgiBuffer;
+
+static int pblFastCgiSocket = -1;
+static int pblFastCgiRequestId = 0;
+static int pblFastCgiKeepConnection = 0;
+
+static PblFastCgiBuffer pblFastCgiParams;
+static PblFastCgiBuffer pblFastCgiStdin;
+
+static char* pblFastCgiOutputData = NULL;
+static size_t pblFastCgiOutputSize = 0;
+
+/*
+ * The memory a request allocates with pbl_malloc comes from the arena,
+ * the arena is released in one shot when the next request is accepted.
+ */
+static PblArena* pblFastCgiArena = NULL;
+
+/*****************************************************************************/
+/* Functions                                                                 */
+/*****************************************************************************/
+
+static void pblFastCgiAppend(PblFastCgiBuffer* buffer, unsigned char* data, size_t length)
+{
+	static char* tag = "pblFastCgiAppend";
+
+	if (buffer->length + length + 1 > buffer->capacity)
+	{
+		size_t capacity = buffer->capacity ? 2 * buffer->capacity : 4 * 1024;
+		while (capacity < buffer->length + length + 1)
+		{
+			capacity *= 2;
+		}
+		char* newData = realloc(buffer->data, capacity);
+		if (!newData)
+		{
+			pblCgiExitOnError("%s: Out of memory\n", tag);
+		}
+		buffer->data = newData;
+		buffer->capacity = capacity;
+	}
+	if (length > 0)
+	{
+		memcpy(buffer->data + buffer->length, data, length);
+	}
+	buffer->length += length;
+	buffer->data[buffer->length] = '\0';
+}
+
+/*
+ * Read exactly length bytes from the web server connection.
+ */
+static int pblFastCgiRead(unsigned char* buffer, size_t length)
+{
+	while (length > 0)
+	{
+		errno = 0;
+		ssize_t rc = read(pblFastCgiSocket, buffer, length);
+		if (rc < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if (rc <= 0)
+		{
+			return -1;
+		}
+		buffer += rc;
+		length -= rc;
+	}
+	return 0;
+}
+
+/*
+ * Write all bytes to the web server connection.
+ */
+static int pblFastCgiWrite(unsigned char* buffer, size_t length)
+{
+	while (length > 0)
+	{
+		errno = 0;
+		ssize_t rc = write(pblFastCgiSocket, buffer, length);
+		if (rc < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if (rc <= 0)
+		{
+			return -1;
+		}
+		buffer += rc;
+		length -= rc;
+	}
+	return 0;
+}
+
+static int pblFastCgiWriteRecord(int type, int requestId, unsigned char* content, size_t length)
+{
+	unsigned char header[PBL_FCGI_HEADER_LEN];
+	unsigned char padding[8] = { 0 };
+	int paddingLength = (8 - (length % 8)) % 8;
+
+	header[0] = PBL_FCGI_VERSION_1;
+	header[1] = type;
+	header[2] = (requestId >> 8) & 0xff;
+	header[3] = requestId & 0xff;
+	header[4] = (length >> 8) & 0xff;
+	header[5] = length & 0xff;
+	header[6] = paddingLength;
+	header[7] = 0;
+
+	if (pblFastCgiWrite(header, sizeof(header))
+		|| (length > 0 && pblFastCgiWrite(content, length))
+		|| (paddingLength > 0 && pblFastCgiWrite(padding, paddingLength)))
+	{
+		return -1;
+	}
+	return 0;
+}
+
+static int pblFastCgiWriteEndRequest(int requestId, int protocolStatus)
+{
+	unsigned char body[8] = { 0 };
+	body[4] = protocolStatus;
+	return pblFastCgiWriteRecord(PBL_FCGI_END_REQUEST, requestId, body, sizeof(body));
+}
+
+/*
+ * Read the length of a name or value of a name-value pair.
+ */
+static int pblFastCgiPairLength(unsigned char** ptr, unsigned char* end, size_t* length)
+{
+	unsigned char* p = *ptr;
+	if (p >= end)
+	{
+		return -1;
+	}
+	if (!(*p & 0x80))
+	{
+		*length = *p;
+		*ptr = p + 1;
+		return 0;
+	}
+	if (p + 4 > end)
+	{
+		return -1;
+	}
+	*length = ((size_t)(p[0] & 0x7f) << 24) | ((size_t)p[1] << 16) | ((size_t)p[2] << 8) | p[3];
+	*ptr = p + 4;
+	return 0;
+}
+
+/*
+ * Answer the FCGI_GET_VALUES management record, we neither multiplex nor take concurrent connections.
+ */
+static int pblFastCgiGetValues(unsigned char* content, size_t length)
+{
+	PblFastCgiBuffer result = { NULL, 0, 0 };
+	unsigned char* ptr = content;
+	unsigned char* end = content + length;
+
+	while (ptr < end)
+	{
+		size_t nameLength;
+		size_t valueLength;
+		if (pblFastCgiPairLength(&ptr, end, &nameLength) || pblFastCgiPairLength(&ptr, end, &valueLength)
+			|| ptr + nameLength + valueLength > end)
+		{
+			break;
+		}
+		char* value = NULL;
+		if (nameLength == 14 && !memcmp(ptr, "FCGI_MAX_CONNS", 14))
+		{
+			value = "1";
+		}
+		else if (nameLength == 13 && !memcmp(ptr, "FCGI_MAX_REQS", 13))
+		{
+			value = "1";
+		}
+		else if (nameLength == 15 && !memcmp(ptr, "FCGI_MPXS_CONNS", 15))
+		{
+			value = "0";
+		}
+		if (value && nameLength < 128)
+		{
+			unsigned char lengths[2] = { (unsigned char)nameLength, (unsigned char)strlen(value) };
+			pblFastCgiAppend(&result, lengths, 2);
+			pblFastCgiAppend(&result, ptr, nameLength);
+			pblFastCgiAppend(&result, (unsigned char*)value, strlen(value));
+		}
+		ptr += nameLength + valueLength;
+	}
+	int rc = pblFastCgiWriteRecord(PBL_FCGI_GET_VALUES_RESULT, 0, (unsigned char*)result.data, result.length);
+	free(result.data);
+	return rc;
+}
+
+/*
+ * Convert the FCGI_PARAMS stream to the environment map of the request.
+ */
+static void pblFastCgiSetEnvironment(void)
+{
+	static char* tag = "pblFastCgiSetEnvironment";
+
+	if (pblCgiEnvironmentMap)
+	{
+		pblMapClear(pblCgiEnvironmentMap);
+	}
+	else
+	{
+		pblCgiEnvironmentMap = pblCgiNewMap();
+	}
+
+	unsigned char* ptr = (unsigned char*)pblFastCgiParams.data;
+	unsigned char* end = ptr + pblFastCgiParams.length;
+
+	while (ptr < end)
+	{
+		size_t nameLength;
+		size_t valueLength;
+		if (pblFastCgiPairLength(&ptr, end, &nameLength) || pblFastCgiPairLength(&ptr, end, &valueLength)
+			|| ptr + nameLength + valueLength > end)
+		{
+			break;
+		}
+		char* name = pblCgiStrRangeDup((char*)ptr, (char*)ptr + nameLength);
+		char* value = pbl_memdup(tag, ptr + nameLength, valueLength + 1);
+		if (!value)
+		{
+			pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
+		}
+		value[valueLength] = '\0';
+
+		if (*name && pblMapAddStrStr(pblCgiEnvironmentMap, name, value) < 0)
+		{
+			pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
+		}
+		PBL_FREE(name);
+		PBL_FREE(value);
+
+		ptr += nameLength + valueLength;
+	}
+}
+
+/*
+ * Read the records of the next request from the web server connection.
+ *
+ * Returns 0 if a complete responder request was received, -1 if the connection ended.
+ */
+static int pblFastCgiReadRequest(void)
+{
+	unsigned char header[PBL_FCGI_HEADER_LEN];
+	unsigned char content[PBL_FCGI_MAX_CONTENT_LEN + 255];
+	int paramsDone = 0;
+
+	pblFastCgiRequestId = 0;
+	pblFastCgiParams.length = 0;
+	pblFastCgiStdin.length = 0;
+
+	for (;;)
+	{
+		if (pblFastCgiRead(header, sizeof(header)))
+		{
+			return -1;
+		}
+		if (header[0] != PBL_FCGI_VERSION_1)
+		{
+			return -1;
+		}
+
+		int type = header[1];
+		int requestId = (header[2] << 8) | header[3];
+		size_t contentLength = (header[4] << 8) | header[5];
+		size_t paddingLength = header[6];
+
+		if (pblFastCgiRead(content, contentLength + paddingLength))
+		{
+			return -1;
+		}
+
+		if (requestId == 0)
+		{
+			// A management record
+			//
+			if (type == PBL_FCGI_GET_VALUES)
+			{
+				if (pblFastCgiGetValues(content, contentLength))
+				{
+					return -1;
+				}
+			}
+			else
+			{
+				unsigned char body[8] = { 0 };
+				body[0] = type;
+				if (pblFastCgiWriteRecord(PBL_FCGI_UNKNOWN_TYPE, 0, body, sizeof(body)))
+				{
+					return -1;
+				}
+			}
+			continue;
+		}
+
+		if (type == PBL_FCGI_BEGIN_REQUEST)
+		{
+			if (pblFastCgiRequestId)
+			{
+				if (pblFastCgiWriteEndRequest(requestId, PBL_FCGI_CANT_MPX_CONN))
+				{
+					return -1;
+				}
+				continue;
+			}
+			if (contentLength < 8)
+			{
+				return -1;
+			}
+
+			int role = (content[0] << 8) | content[1];
+			pblFastCgiKeepConnection = content[2] & PBL_FCGI_KEEP_CONN;
+			if (role != PBL_FCGI_RESPONDER)
+			{
+				if (pblFastCgiWriteEndRequest(requestId, PBL_FCGI_UNKNOWN_ROLE))
+				{
+					return -1;
+				}
+				if (!pblFastCgiKeepConnection)
+				{
+					return -1;
+				}
+				continue;
+			}
+			pblFastCgiRequestId = requestId;
+			paramsDone = 0;
+			pblFastCgiParams.length = 0;
+			pblFastCgiStdin.length = 0;
+			continue;
+		}
+
+		if (requestId != pblFastCgiRequestId)
+		{
+			// Records of requests we do not know, ignore them
+			continue;
+		}
+
+		switch (type)
+		{
+		case PBL_FCGI_ABORT_REQUEST:
+			pblFastCgiRequestId = 0;
+			if (pblFastCgiWriteEndRequest(requestId, PBL_FCGI_REQUEST_COMPLETE))
+			{
+				return -1;
+			}
+			if (!pblFastCgiKeepConnection)
+			{
+				return -1;
+			}
+			break;
+
+		case PBL_FCGI_PARAMS:
+			if (contentLength == 0)
+			{
+				paramsDone = 1;
+			}
+			else
+			{
+				pblFastCgiAppend(&pblFastCgiParams, content, contentLength);
+			}
+			break;
+
+		case PBL_FCGI_STDIN:
+			if (contentLength == 0)
+			{
+				if (paramsDone)
+				{
+					return 0;
+				}
+			}
+			else
+			{
+				pblFastCgiAppend(&pblFastCgiStdin, content, contentLength);
+			}
+			break;
+
+		default:
+			break;
+		}
+	}
+	return -1;
+}
+
+static int pblFastCgiAtExitRegistered = 0;
+
+static void pblFastCgiAtExit(void)
+{
+	pblFastCgiFinish();
+}
+
+/**
+ * Test whether the program was started as a plain CGI program.
+ *
+ * A FastCGI application is started with a listening socket as its standard input.
+ *
+ * @return int rc != 0: The program is a CGI program.
+ * @return int rc == 0: The program is a FastCGI application.
+ */
+int pblFastCgiIsCgi(void)
+{
+	struct sockaddr_storage address;
+	socklen_t length = sizeof(address);
+
+	errno = 0;
+	if (getpeername(PBL_FCGI_LISTENSOCK_FILENO, (struct sockaddr*)&address, &length) < 0 && errno == ENOTCONN)
+	{
+		return 0;
+	}
+	return 1;
+}
+
+/**
+ * Finish the current FastCGI request, the output collected is sent to the web server.
+ */
+void pblFastCgiFinish(void)
+{
+	if (!pblFastCgiRequestId)
+	{
+		return;
+	}
+	int requestId = pblFastCgiRequestId;
+	pblFastCgiRequestId = 0;
+
+	int rc = 0;
+	if (pblCgiOutputStream)
+	{
+		fclose(pblCgiOutputStream);
+		pblCgiOutputStream = NULL;
+
+		unsigned char* ptr = (unsigned char*)pblFastCgiOutputData;
+		size_t length = pblFastCgiOutputSize;
+		while (rc == 0 && length > 0)
+		{
+			size_t n = length > 32 * 1024 ? 32 * 1024 : length;
+			rc = pblFastCgiWriteRecord(PBL_FCGI_STDOUT, requestId, ptr, n);
+			ptr += n;
+			length -= n;
+		}
+		free(pblFastCgiOutputData);
+		pblFastCgiOutputData = NULL;
+		pblFastCgiOutputSize = 0;
+	}
+
+	if (rc || pblFastCgiWriteRecord(PBL_FCGI_STDOUT, requestId, NULL, 0)
+		|| pblFastCgiWriteEndRequest(requestId, PBL_FCGI_REQUEST_COMPLETE)
+		|| !pblFastCgiKeepConnection)
+	{
+		close(pblFastCgiSocket);
+		pblFastCgiSocket = -1;
+	}
+}
+
+/**
+ * Accept the next FastCGI request, like FCGI_Accept of the FastCGI developer's kit.
+ *
+ * The previous request is finished, the per request values are reset,
+ * the environment map and the input buffer are set from the request
+ * and the output of the request is collected until the next call.
+ * The memory the request allocates with pbl_malloc comes from an arena
+ * that is released by the next call, memory that has to outlive the
+ * request is allocated after pblArenaSet(NULL).
+ *
+ * @return int rc == 0: A request was accepted.
+ * @return int rc  < 0: The listening socket was closed.
+ */
+int pblFastCgiAccept(void)
+{
+	static char* tag = "pblFastCgiAccept";
+
+	if (!pblFastCgiAtExitRegistered)
+	{
+		// A request that exits the process still gets its output
+		//
+		atexit(pblFastCgiAtExit);
+		pblFastCgiAtExitRegistered = 1;
+
+		signal(SIGPIPE, SIG_IGN);
+	}
+
+	pblFastCgiFinish();
+	pblCgiResetRequest();
+	if (pblFastCgiArena)
+	{
+		pblArenaSet(NULL);
+		pblArenaReset(pblFastCgiArena);
+	}
+	else if (!(pblFastCgiArena = pblArenaNew(0)))
+	{
+		pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
+	}
+
+	for (;;)
+	{
+		if (pblFastCgiSocket < 0)
+		{
+			errno = 0;
+			pblFastCgiSocket = accept(PBL_FCGI_LISTENSOCK_FILENO, NULL, NULL);
+			if (pblFastCgiSocket < 0)
+			{
+				if (errno == EINTR || errno == ECONNABORTED)
+				{
+					continue;
+				}
+				return -1;
+			}
+		}
+		if (!pblFastCgiReadRequest())
+		{
+			break;
+		}
+		close(pblFastCgiSocket);
+		pblFastCgiSocket = -1;
+	}
+
+	pblFastCgiSetEnvironment();
+	pblCgiInputBuffer = pblFastCgiStdin.data ? pblFastCgiStdin.data : "";
+	pblCgiInputLength = pblFastCgiStdin.length;
+
+	pblCgiOutputStream = open_memstream(&pblFastCgiOutputData, &pblFastCgiOutputSize);
+	if (!pblCgiOutputStream)
+	{
+		pblCgiExitOnError("%s: open_memstream failed, errno %d\n", tag, errno);
+	}
+	pblArenaSet(pblFastCgiArena);
+	return 0;
+}
+
+#endif
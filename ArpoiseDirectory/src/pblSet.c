@@ -82,13 +82,13 @@ char* PblTreeSetMagic = "PblTreeSetMagic";
    * Step sizes used for the different capacities, the smallest prime numbers
    * that are bigger than the powers of two.
    */
-static int pblPrimeStepSize[] = { 5, 11, 17, 37, 67, 131, 257, 521, 1031, 2053, 4099, 8209, 16411, 32771, 65537, 131101,
+static const int pblPrimeStepSize[] = { 5, 11, 17, 37, 67, 131, 257, 521, 1031, 2053, 4099, 8209, 16411, 32771, 65537, 131101,
 		262147, 524309, 1048583, 2097169, 4194319, 8388617, 16777259, 33554467, 67108879, 134217757 };
 
 /*
  * Capacities used for the hash set, the powers of two.
  */
-static int pblCapacities[] = { 0x8, 0x10, 0x20, 0x40, 0x80, 0x100, 0x200, 0x400, 0x800, 0x1000, 0x2000, 0x4000, 0x8000,
+static const int pblCapacities[] = { 0x8, 0x10, 0x20, 0x40, 0x80, 0x100, 0x200, 0x400, 0x800, 0x1000, 0x2000, 0x4000, 0x8000,
 		0x10000, 0x20000, 0x40000, 0x80000, 0x100000, 0x200000, 0x400000, 0x800000, 0x1000000, 0x2000000, 0x4000000,
 		0x8000000, 0x10000000, 0x20000000, 0x40000000 };
 
@@ -341,6 +341,9 @@ int pblHtInsert(
 /**
  * Search for a key in a hash table.
  *
+ * The item found becomes the current item of the table,
+ * so a table searched by several threads needs a lock.
+ *
  * @return void * retptr != NULL: The pointer to data of item found.
  * @return void * retptr == NULL: An error, see pbl_errno:
  * <BR>PBL_ERROR_NOT_FOUND - No item found with the given key.